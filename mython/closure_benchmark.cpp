@@ -0,0 +1,199 @@
+// Сравнивает runtime::Closure с std::unordered_map, на котором таблица символов была построена
+// раньше, на типичных для интерпретатора способах обращения к именам.
+// Запуск: ClosureBenchmark [множитель числа повторений]
+
+#include "runtime.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using runtime::ObjectHolder;
+using runtime::Symbol;
+
+namespace
+{
+
+using UnorderedClosure =
+    unordered_map<Symbol, ObjectHolder, hash<Symbol>, equal_to<Symbol>,
+                  runtime::AccountedAllocator<pair<const Symbol, ObjectHolder>>>;
+
+// Имена и значения создаются заранее, чтобы замер включал только работу с таблицей
+struct Names
+{
+    explicit Names(size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            symbols.emplace_back("name_"s + to_string(i));
+            values.push_back(ObjectHolder::Own(runtime::Number{static_cast<int>(i)}));
+        }
+    }
+
+    vector<Symbol> symbols;
+    vector<ObjectHolder> values;
+};
+
+// Не даёт компилятору выбросить результаты поиска
+uintptr_t g_sink = 0;
+
+void Consume(const ObjectHolder& value)
+{
+    g_sink += reinterpret_cast<uintptr_t>(value.Get());
+}
+
+// Кадр вызова метода: self и параметры, несколько обращений к ним, затем кадр уничтожается
+template <typename Map>
+void MethodFrames(const Names& names, size_t repeats)
+{
+    const Symbol self("self");
+    for (size_t i = 0; i < repeats; ++i)
+    {
+        Map frame;
+        frame[self] = names.values[0];
+        const size_t params = 2 + i % 3;
+        for (size_t p = 0; p < params; ++p)
+        {
+            frame[names.symbols[p]] = names.values[p + 1];
+        }
+        for (size_t access = 0; access < 10; ++access)
+        {
+            const Symbol name = access % 3 == 0 ? self : names.symbols[access % params];
+            if (auto it = frame.find(name); it != frame.end())
+            {
+                Consume(it->second);
+            }
+        }
+    }
+}
+
+// Поля экземпляров: таблицы живут долго, поля читаются и перезаписываются.
+// Экземпляров много, и обращения переходят от одного к другому, как при обходе списка объектов
+template <typename Map>
+void InstanceFields(const Names& names, size_t repeats)
+{
+    constexpr size_t FIELDS = 6;
+    constexpr size_t INSTANCES = 4096;
+    vector<Map> instances(INSTANCES);
+    for (Map& fields : instances)
+    {
+        for (size_t f = 0; f < FIELDS; ++f)
+        {
+            fields[names.symbols[f]] = names.values[f];
+        }
+    }
+    for (size_t i = 0; i < repeats; ++i)
+    {
+        Map& fields = instances[i * 97 % INSTANCES];
+        const size_t f = i * 7 % FIELDS;
+        if (i % 4 == 0)
+        {
+            fields[names.symbols[f]] = names.values[i % names.values.size()];
+        }
+        else
+        {
+            Consume(fields.find(names.symbols[f])->second);
+        }
+    }
+}
+
+// Глобальная таблица программы: десятки классов и переменных, в основном чтение,
+// в том числе имён, которых в таблице нет
+template <typename Map>
+void Globals(const Names& names, size_t repeats)
+{
+    constexpr size_t GLOBALS = 50;
+    Map globals;
+    for (size_t g = 0; g < GLOBALS; ++g)
+    {
+        globals[names.symbols[g]] = names.values[g];
+    }
+    for (size_t i = 0; i < repeats; ++i)
+    {
+        const size_t g = i * 31 % (GLOBALS + GLOBALS / 5);
+        if (auto it = globals.find(names.symbols[g]); it != globals.end())
+        {
+            Consume(it->second);
+        }
+    }
+}
+
+// Большая таблица, которая растёт и из которой удаляются имена
+template <typename Map>
+void LargeTable(const Names& names, size_t repeats)
+{
+    constexpr size_t ENTRIES = 1000;
+    Map table;
+    for (size_t i = 0; i < repeats; ++i)
+    {
+        const Symbol name = names.symbols[i * 37 % ENTRIES];
+        switch (i % 4)
+        {
+        case 0:
+            table[name] = names.values[i % ENTRIES];
+            break;
+        case 1:
+            table.erase(name);
+            break;
+        default:
+            if (auto it = table.find(name); it != table.end())
+            {
+                Consume(it->second);
+            }
+        }
+    }
+}
+
+double Measure(void (*pattern)(const Names&, size_t), const Names& names, size_t repeats)
+{
+    // Первый прогон прогревает кэши и распределитель памяти
+    pattern(names, repeats / 10 + 1);
+    const auto start = chrono::steady_clock::now();
+    pattern(names, repeats);
+    const chrono::duration<double, nano> duration = chrono::steady_clock::now() - start;
+    return duration.count() / static_cast<double>(repeats);
+}
+
+struct Pattern
+{
+    const char* name;
+    void (*flat)(const Names&, size_t);
+    void (*unordered)(const Names&, size_t);
+    size_t repeats;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    const size_t scale = argc > 1 ? max(atol(argv[1]), 1L) : 1;
+    const Names names(1000);
+    const Pattern patterns[] = {
+        {"method frames", MethodFrames<runtime::Closure>, MethodFrames<UnorderedClosure>,
+         1'000'000},
+        {"instance fields", InstanceFields<runtime::Closure>, InstanceFields<UnorderedClosure>,
+         10'000'000},
+        {"globals", Globals<runtime::Closure>, Globals<UnorderedClosure>, 10'000'000},
+        {"large table", LargeTable<runtime::Closure>, LargeTable<UnorderedClosure>, 5'000'000},
+    };
+
+    cout << left << setw(18) << "pattern" << right << setw(14) << "Closure, ns" << setw(20)
+         << "unordered_map, ns" << setw(10) << "speedup" << '\n';
+    cout << fixed << setprecision(2);
+    for (const Pattern& pattern : patterns)
+    {
+        const size_t repeats = pattern.repeats * scale;
+        const double flat = Measure(pattern.flat, names, repeats);
+        const double unordered = Measure(pattern.unordered, names, repeats);
+        cout << left << setw(18) << pattern.name << right << setw(14) << flat << setw(20)
+             << unordered << setw(9) << unordered / flat << "x\n";
+    }
+    return g_sink == 1 ? 1 : 0;
+}
@@ -0,0 +1,750 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace util
+{
+
+// Хэш-таблица с открытой адресацией, которая хранит элементы в одном массиве.
+// Пока элементов не больше INLINE_CAPACITY, они лежат внутри самой таблицы и ищутся перебором,
+// без вычисления хэша и без выделения памяти. Большие таблицы устроены как Swiss table:
+// для каждой ячейки хранится байт управления с 7 битами хэша ключа, и поиск сравнивает
+// сразу группу из 16 байт управления (через SSE2, если он доступен).
+// Интерфейс повторяет часть интерфейса std::unordered_map, но добавление элемента делает
+// недействительными ссылки и итераторы на другие элементы
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>,
+          typename Allocator = std::allocator<std::pair<const Key, Value>>,
+          size_t INLINE_CAPACITY = 8>
+class FlatMap
+{
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+    using size_type = size_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using allocator_type = Allocator;
+
+    template <bool IS_CONST>
+    class Iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = FlatMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<IS_CONST, const value_type*, value_type*>;
+        using reference = std::conditional_t<IS_CONST, const value_type&, value_type&>;
+
+        Iterator() = default;
+
+        template <bool OTHER_CONST, typename = std::enable_if_t<IS_CONST && !OTHER_CONST>>
+        Iterator(const Iterator<OTHER_CONST>& other) noexcept  // NOLINT(google-explicit-constructor)
+            : slot_(other.slot_), ctrl_(other.ctrl_), end_(other.end_)
+        {
+        }
+
+        reference operator*() const noexcept
+        {
+            return *slot_;
+        }
+
+        pointer operator->() const noexcept
+        {
+            return slot_;
+        }
+
+        Iterator& operator++() noexcept
+        {
+            ++slot_;
+            if (ctrl_)
+            {
+                ++ctrl_;
+                SkipFree();
+            }
+            return *this;
+        }
+
+        Iterator operator++(int) noexcept
+        {
+            Iterator result = *this;
+            ++*this;
+            return result;
+        }
+
+        friend bool operator==(const Iterator& lhs, const Iterator& rhs) noexcept
+        {
+            return lhs.slot_ == rhs.slot_;
+        }
+
+        friend bool operator!=(const Iterator& lhs, const Iterator& rhs) noexcept
+        {
+            return lhs.slot_ != rhs.slot_;
+        }
+
+    private:
+        friend class FlatMap;
+        friend class Iterator<true>;
+
+        // ctrl равен nullptr, если таблица хранит элементы внутри себя подряд
+        Iterator(pointer slot, const int8_t* ctrl, pointer end) noexcept
+            : slot_(slot), ctrl_(ctrl), end_(end)
+        {
+            if (ctrl_)
+            {
+                SkipFree();
+            }
+        }
+
+        void SkipFree() noexcept
+        {
+            while (slot_ != end_ && *ctrl_ < 0)
+            {
+                ++slot_;
+                ++ctrl_;
+            }
+        }
+
+        pointer slot_ = nullptr;
+        const int8_t* ctrl_ = nullptr;
+        pointer end_ = nullptr;
+    };
+
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    FlatMap() noexcept(std::is_nothrow_default_constructible_v<Allocator>) = default;
+
+    explicit FlatMap(const Allocator& allocator) noexcept
+        : allocator_(allocator)
+    {
+    }
+
+    FlatMap(std::initializer_list<value_type> values, const Allocator& allocator = Allocator())
+        : allocator_(allocator)
+    {
+        for (const value_type& value : values)
+        {
+            emplace(value.first, value.second);
+        }
+    }
+
+    FlatMap(const FlatMap& other)
+        : FlatMap(other, std::allocator_traits<Allocator>::select_on_container_copy_construction(
+                             other.allocator_))
+    {
+    }
+
+    // Копирует элементы other в память, выделенную распределителем allocator
+    FlatMap(const FlatMap& other, const Allocator& allocator)
+        : allocator_(allocator)
+    {
+        if (other.size_ > INLINE_CAPACITY)
+        {
+            Rehash(other.capacity_);
+        }
+        for (const value_type& value : other)
+        {
+            emplace(value.first, value.second);
+        }
+    }
+
+    FlatMap(FlatMap&& other) noexcept
+        : allocator_(other.allocator_)
+    {
+        MoveFrom(other);
+    }
+
+    FlatMap& operator=(const FlatMap& other)
+    {
+        if (this != &other)
+        {
+            // Память копии выделяет распределитель, которым будет освобождаться таблица
+            constexpr bool propagate = std::allocator_traits<
+                Allocator>::propagate_on_container_copy_assignment::value;
+            FlatMap copy(other, propagate ? other.allocator_ : allocator_);
+            clear();
+            Deallocate();
+            allocator_ = copy.allocator_;
+            MoveFrom(copy);
+        }
+        return *this;
+    }
+
+    FlatMap& operator=(FlatMap&& other) noexcept
+    {
+        if (this != &other)
+        {
+            clear();
+            Deallocate();
+            allocator_ = other.allocator_;
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    ~FlatMap()
+    {
+        clear();
+        Deallocate();
+    }
+
+    [[nodiscard]] allocator_type get_allocator() const noexcept
+    {
+        return allocator_;
+    }
+
+    iterator begin() noexcept
+    {
+        return iterator(Slots(), ctrl_, SlotsEnd());
+    }
+
+    iterator end() noexcept
+    {
+        return iterator(SlotsEnd(), nullptr, SlotsEnd());
+    }
+
+    const_iterator begin() const noexcept
+    {
+        return const_iterator(Slots(), ctrl_, SlotsEnd());
+    }
+
+    const_iterator end() const noexcept
+    {
+        return const_iterator(SlotsEnd(), nullptr, SlotsEnd());
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return size_ == 0;
+    }
+
+    // Удаляет все элементы. Выделенная память остаётся за таблицей
+    void clear() noexcept
+    {
+        if (!ctrl_)
+        {
+            std::destroy_n(InlineSlots(), size_);
+        }
+        else
+        {
+            for (size_t i = 0; i < capacity_; ++i)
+            {
+                if (ctrl_[i] >= 0)
+                {
+                    std::destroy_at(&slots_[i]);
+                }
+            }
+            std::memset(ctrl_, EMPTY, capacity_);
+            growth_left_ = MaxLoad(capacity_);
+        }
+        size_ = 0;
+    }
+
+    iterator find(const Key& key)
+    {
+        const size_t index = Find(key);
+        return index == NPOS ? end() : MakeIterator(index);
+    }
+
+    const_iterator find(const Key& key) const
+    {
+        const size_t index = Find(key);
+        return index == NPOS ? end() : MakeIterator(index);
+    }
+
+    [[nodiscard]] size_t count(const Key& key) const
+    {
+        return Find(key) == NPOS ? 0 : 1;
+    }
+
+    Value& at(const Key& key)
+    {
+        const size_t index = Find(key);
+        if (index == NPOS)
+        {
+            throw std::out_of_range("FlatMap::at");
+        }
+        return SlotAt(index).second;
+    }
+
+    const Value& at(const Key& key) const
+    {
+        const size_t index = Find(key);
+        if (index == NPOS)
+        {
+            throw std::out_of_range("FlatMap::at");
+        }
+        return SlotAt(index).second;
+    }
+
+    Value& operator[](const Key& key)
+    {
+        return try_emplace(key).first->second;
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args)
+    {
+        if (const size_t index = Find(key); index != NPOS)
+        {
+            return {MakeIterator(index), false};
+        }
+        value_type* slot = Insert(key);
+        try
+        {
+            new (slot) value_type(std::piecewise_construct, std::forward_as_tuple(key),
+                                  std::forward_as_tuple(std::forward<Args>(args)...));
+        }
+        catch (...)
+        {
+            Unreserve(slot);
+            throw;
+        }
+        ++size_;
+        return {MakeIterator(static_cast<size_t>(slot - Slots())), true};
+    }
+
+    template <typename K, typename V>
+    std::pair<iterator, bool> emplace(K&& key, V&& value)
+    {
+        return try_emplace(Key(std::forward<K>(key)), std::forward<V>(value));
+    }
+
+    size_t erase(const Key& key)
+    {
+        const size_t index = Find(key);
+        if (index == NPOS)
+        {
+            return 0;
+        }
+        Erase(index);
+        return 1;
+    }
+
+    // Удаляет элемент pos. Возвращает итератор на следующий элемент, если таблица хранит
+    // элементы отдельно, и на элемент, занявший место удалённого, если внутри себя
+    iterator erase(const_iterator pos)
+    {
+        const auto index = static_cast<size_t>(pos.slot_ - Slots());
+        Erase(index);
+        return ctrl_ ? iterator(Slots() + index, ctrl_ + index, SlotsEnd()) : MakeIterator(index);
+    }
+
+    // Готовит таблицу к хранению count элементов без перераспределения памяти
+    void reserve(size_t count)
+    {
+        if (count > (ctrl_ ? size_ + growth_left_ : INLINE_CAPACITY))
+        {
+            Rehash(CapacityFor(count));
+        }
+    }
+
+private:
+    using SlotAllocator =
+        typename std::allocator_traits<Allocator>::template rebind_alloc<value_type>;
+
+    static constexpr int8_t EMPTY = -128;
+    static constexpr int8_t DELETED = -2;
+    static constexpr size_t GROUP_SIZE = 16;
+    static constexpr size_t NPOS = static_cast<size_t>(-1);
+
+    // Маска совпадений в группе: бит i установлен, если подходит байт управления i
+    class Group
+    {
+    public:
+        explicit Group(const int8_t* ctrl) noexcept
+        {
+#if defined(__SSE2__)
+            ctrl_ = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+#else
+            std::memcpy(ctrl_, ctrl, GROUP_SIZE);
+#endif
+        }
+
+        [[nodiscard]] uint32_t Match(int8_t h2) const noexcept
+        {
+#if defined(__SSE2__)
+            return static_cast<uint32_t>(
+                _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl_)));
+#else
+            uint32_t mask = 0;
+            for (size_t i = 0; i < GROUP_SIZE; ++i)
+            {
+                mask |= static_cast<uint32_t>(ctrl_[i] == h2) << i;
+            }
+            return mask;
+#endif
+        }
+
+        [[nodiscard]] uint32_t MatchEmpty() const noexcept
+        {
+            return Match(EMPTY);
+        }
+
+        // Свободные ячейки: пустые и удалённые
+        [[nodiscard]] uint32_t MatchFree() const noexcept
+        {
+#if defined(__SSE2__)
+            return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), ctrl_)));
+#else
+            uint32_t mask = 0;
+            for (size_t i = 0; i < GROUP_SIZE; ++i)
+            {
+                mask |= static_cast<uint32_t>(ctrl_[i] < -1) << i;
+            }
+            return mask;
+#endif
+        }
+
+    private:
+#if defined(__SSE2__)
+        __m128i ctrl_;
+#else
+        int8_t ctrl_[GROUP_SIZE];
+#endif
+    };
+
+    // Последовательность групп, которые просматриваются при поиске ключа с хэшем hash.
+    // Шаг растёт на каждой группе, поэтому при числе групп, равном степени двойки,
+    // последовательность обходит все группы
+    class ProbeSequence
+    {
+    public:
+        ProbeSequence(size_t hash, size_t group_mask) noexcept
+            : group_(hash & group_mask), mask_(group_mask)
+        {
+        }
+
+        [[nodiscard]] size_t Offset() const noexcept
+        {
+            return group_ * GROUP_SIZE;
+        }
+
+        void Next() noexcept
+        {
+            ++step_;
+            group_ = (group_ + step_) & mask_;
+        }
+
+    private:
+        size_t group_;
+        size_t mask_;
+        size_t step_ = 0;
+    };
+
+    static unsigned LowestBit(uint32_t mask) noexcept
+    {
+        return static_cast<unsigned>(__builtin_ctz(mask));
+    }
+
+    // Перемешивает хэш: хэши подряд идущих номеров тоже должны расходиться по группам
+    size_t MixedHash(const Key& key) const
+    {
+        return static_cast<size_t>(static_cast<uint64_t>(hash_(key)) * 0x9E3779B97F4A7C15ULL);
+    }
+
+    // Старшие 7 бит хэша хранятся в байте управления, остальные выбирают группу
+    static int8_t H2(size_t hash) noexcept
+    {
+        return static_cast<int8_t>(hash >> (sizeof(size_t) * 8 - 7));
+    }
+
+    static size_t H1(size_t hash) noexcept
+    {
+        return hash >> 7;
+    }
+
+    // Сколько элементов помещается в таблицу из capacity ячеек: 7/8 ячеек
+    static size_t MaxLoad(size_t capacity) noexcept
+    {
+        return capacity - capacity / 8;
+    }
+
+    static size_t CapacityFor(size_t count) noexcept
+    {
+        size_t capacity = GROUP_SIZE;
+        while (MaxLoad(capacity) < count)
+        {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    value_type* InlineSlots() noexcept
+    {
+        return std::launder(reinterpret_cast<value_type*>(inline_));
+    }
+
+    const value_type* InlineSlots() const noexcept
+    {
+        return std::launder(reinterpret_cast<const value_type*>(inline_));
+    }
+
+    value_type* Slots() noexcept
+    {
+        return ctrl_ ? slots_ : InlineSlots();
+    }
+
+    const value_type* Slots() const noexcept
+    {
+        return ctrl_ ? slots_ : InlineSlots();
+    }
+
+    value_type* SlotsEnd() noexcept
+    {
+        return ctrl_ ? slots_ + capacity_ : InlineSlots() + size_;
+    }
+
+    const value_type* SlotsEnd() const noexcept
+    {
+        return ctrl_ ? slots_ + capacity_ : InlineSlots() + size_;
+    }
+
+    value_type& SlotAt(size_t index) noexcept
+    {
+        return Slots()[index];
+    }
+
+    const value_type& SlotAt(size_t index) const noexcept
+    {
+        return Slots()[index];
+    }
+
+    iterator MakeIterator(size_t index) noexcept
+    {
+        return iterator(Slots() + index, ctrl_ ? ctrl_ + index : nullptr, SlotsEnd());
+    }
+
+    const_iterator MakeIterator(size_t index) const noexcept
+    {
+        return const_iterator(Slots() + index, ctrl_ ? ctrl_ + index : nullptr, SlotsEnd());
+    }
+
+    size_t Find(const Key& key) const
+    {
+        if (!ctrl_)
+        {
+            const value_type* slots = InlineSlots();
+            for (size_t i = 0; i < size_; ++i)
+            {
+                if (equal_(slots[i].first, key))
+                {
+                    return i;
+                }
+            }
+            return NPOS;
+        }
+        const size_t hash = MixedHash(key);
+        const int8_t h2 = H2(hash);
+        for (ProbeSequence probe(H1(hash), capacity_ / GROUP_SIZE - 1);; probe.Next())
+        {
+            const Group group(ctrl_ + probe.Offset());
+            for (uint32_t mask = group.Match(h2); mask != 0; mask &= mask - 1)
+            {
+                const size_t index = probe.Offset() + LowestBit(mask);
+                if (equal_(slots_[index].first, key))
+                {
+                    return index;
+                }
+            }
+            if (group.MatchEmpty() != 0)
+            {
+                return NPOS;
+            }
+        }
+    }
+
+    // Находит свободную ячейку для ключа key, которого нет в таблице, и помечает её занятой.
+    // Элемент в ячейке конструирует вызывающий
+    value_type* Insert(const Key& key)
+    {
+        if (!ctrl_)
+        {
+            if (size_ < INLINE_CAPACITY)
+            {
+                return InlineSlots() + size_;
+            }
+            Rehash(CapacityFor(size_ + 1));
+        }
+        const size_t hash = MixedHash(key);
+        size_t index = FindFree(hash);
+        if (growth_left_ == 0 && ctrl_[index] == EMPTY)
+        {
+            // Удалённые ячейки тоже занимают место: если их много, таблица перестраивается
+            // в прежнем размере
+            Rehash(size_ + 1 > MaxLoad(capacity_) / 2 ? capacity_ * 2 : capacity_);
+            index = FindFree(hash);
+        }
+        if (ctrl_[index] == EMPTY)
+        {
+            --growth_left_;
+        }
+        ctrl_[index] = H2(hash);
+        return slots_ + index;
+    }
+
+    // Возвращает ячейку, занятую Insert, если элемент в ней не удалось создать
+    void Unreserve(value_type* slot) noexcept
+    {
+        if (ctrl_)
+        {
+            ctrl_[slot - slots_] = DELETED;
+        }
+    }
+
+    size_t FindFree(size_t hash) const noexcept
+    {
+        for (ProbeSequence probe(H1(hash), capacity_ / GROUP_SIZE - 1);; probe.Next())
+        {
+            if (const uint32_t mask = Group(ctrl_ + probe.Offset()).MatchFree(); mask != 0)
+            {
+                return probe.Offset() + LowestBit(mask);
+            }
+        }
+    }
+
+    void Erase(size_t index) noexcept
+    {
+        if (!ctrl_)
+        {
+            value_type* slots = InlineSlots();
+            std::destroy_at(&slots[index]);
+            // Элементы внутри таблицы лежат подряд: последний занимает место удалённого
+            if (index + 1 != size_)
+            {
+                new (&slots[index]) value_type(std::move(slots[size_ - 1]));
+                std::destroy_at(&slots[size_ - 1]);
+            }
+        }
+        else
+        {
+            std::destroy_at(&slots_[index]);
+            // Если в группе есть пустая ячейка, поиск на ней остановится и без этой ячейки
+            const size_t group = index / GROUP_SIZE * GROUP_SIZE;
+            if (Group(ctrl_ + group).MatchEmpty() != 0)
+            {
+                ctrl_[index] = EMPTY;
+                ++growth_left_;
+            }
+            else
+            {
+                ctrl_[index] = DELETED;
+            }
+        }
+        --size_;
+    }
+
+    // Переносит элементы в отдельный массив из capacity ячеек
+    void Rehash(size_t capacity)
+    {
+        SlotAllocator allocator(allocator_);
+        // Байты управления лежат в том же блоке сразу за ячейками
+        const size_t ctrl_slots = (capacity + sizeof(value_type) - 1) / sizeof(value_type);
+        value_type* slots = std::allocator_traits<SlotAllocator>::allocate(allocator,
+                                                                           capacity + ctrl_slots);
+        auto* ctrl = reinterpret_cast<int8_t*>(slots + capacity);
+        std::memset(ctrl, EMPTY, capacity);
+
+        value_type* old_slots = Slots();
+        int8_t* old_ctrl = ctrl_;
+        const size_t old_capacity = ctrl_ ? capacity_ : size_;
+        slots_ = slots;
+        ctrl_ = ctrl;
+        capacity_ = capacity;
+        growth_left_ = MaxLoad(capacity) - size_;
+        // Перемещение пары с константным ключом не выбрасывает исключений, если их
+        // не выбрасывает перемещение значения
+        for (size_t i = 0; i < old_capacity; ++i)
+        {
+            if (old_ctrl && old_ctrl[i] < 0)
+            {
+                continue;
+            }
+            const size_t hash = MixedHash(old_slots[i].first);
+            const size_t index = FindFree(hash);
+            ctrl_[index] = H2(hash);
+            new (&slots_[index]) value_type(std::move(old_slots[i]));
+            std::destroy_at(&old_slots[i]);
+        }
+        if (old_ctrl)
+        {
+            DeallocateSlots(old_slots, old_capacity);
+        }
+    }
+
+    void DeallocateSlots(value_type* slots, size_t capacity) noexcept
+    {
+        SlotAllocator allocator(allocator_);
+        const size_t ctrl_slots = (capacity + sizeof(value_type) - 1) / sizeof(value_type);
+        std::allocator_traits<SlotAllocator>::deallocate(allocator, slots, capacity + ctrl_slots);
+    }
+
+    // Освобождает отдельный массив. Таблица должна быть пуста
+    void Deallocate() noexcept
+    {
+        if (ctrl_)
+        {
+            DeallocateSlots(slots_, capacity_);
+            slots_ = nullptr;
+            ctrl_ = nullptr;
+            capacity_ = 0;
+            growth_left_ = 0;
+        }
+    }
+
+    // Забирает элементы other, other остаётся пустым. Таблица должна быть пуста
+    // и не должна владеть отдельным массивом
+    void MoveFrom(FlatMap& other) noexcept
+    {
+        if (other.ctrl_)
+        {
+            slots_ = std::exchange(other.slots_, nullptr);
+            ctrl_ = std::exchange(other.ctrl_, nullptr);
+            capacity_ = std::exchange(other.capacity_, 0);
+            growth_left_ = std::exchange(other.growth_left_, 0);
+        }
+        else
+        {
+            std::uninitialized_move_n(other.InlineSlots(), other.size_, InlineSlots());
+            std::destroy_n(other.InlineSlots(), other.size_);
+        }
+        size_ = std::exchange(other.size_, 0);
+    }
+
+    static_assert(std::is_nothrow_move_constructible_v<Value>);
+
+    Hash hash_;
+    KeyEqual equal_;
+    Allocator allocator_;
+    size_t size_ = 0;
+    // Отдельный массив ячеек и байты управления. Пока их нет, элементы лежат в inline_
+    value_type* slots_ = nullptr;
+    int8_t* ctrl_ = nullptr;
+    size_t capacity_ = 0;
+    // Сколько ещё элементов можно добавить в отдельный массив без перестроения
+    size_t growth_left_ = 0;
+    alignas(value_type) std::byte inline_[INLINE_CAPACITY * sizeof(value_type)];
+};
+
+}  // namespace util
@@ -2,6 +2,8 @@
 
 #include <algorithm>
 #include <charconv>
+#include <limits>
+#include <string_view>
 #include <unordered_map>
 
 using namespace std;
@@ -94,17 +96,187 @@ Lexer::Lexer(std::istream& input)
     }
 }
 
-const Token& Lexer::CurrentToken() const
+const Token& TokenStream::CurrentToken() const
 {
     return current_token_;
 }
 
-Token Lexer::NextToken()
+Token TokenStream::NextToken()
 {
     ParseNextToken();
     return current_token_;
 }
 
+TokenReplay::TokenReplay(std::vector<Token> tokens)
+    : tokens_(move(tokens))
+{
+    ParseNextToken();
+}
+
+void TokenReplay::ParseNextToken()
+{
+    if (next_token_ < tokens_.size())
+    {
+        current_token_ = move(tokens_[next_token_++]);
+    }
+    else
+    {
+        current_token_ = token_type::Eof();
+    }
+}
+
+PipelinedLexer::PipelinedLexer(istream& input, size_t capacity)
+    : tokens_(capacity)
+{
+    producer_ = thread([this, &input] { Produce(input); });
+    try
+    {
+        ParseNextToken();
+    }
+    catch (...)
+    {
+        producer_.join();
+        throw;
+    }
+}
+
+PipelinedLexer::~PipelinedLexer()
+{
+    stopped_.store(true, memory_order_relaxed);
+    {
+        lock_guard lock(mutex_);
+        not_full_.notify_one();
+    }
+    producer_.join();
+}
+
+namespace
+{
+
+// Сколько раз поток проверяет очередь, прежде чем заснуть
+constexpr int SPIN_TRIES = 64;
+
+}  // namespace
+
+void PipelinedLexer::Produce(istream& input)
+{
+    try
+    {
+        Lexer lexer(input);
+        Token token = lexer.CurrentToken();
+        while (Push(token) && !lexer.CurrentToken().Is<token_type::Eof>())
+        {
+            token = lexer.NextToken();
+        }
+    }
+    catch (...)
+    {
+        error_ = current_exception();
+    }
+    finished_.store(true, memory_order_release);
+    lock_guard lock(mutex_);
+    not_empty_.notify_one();
+}
+
+bool PipelinedLexer::Push(Token& token)
+{
+    for (int tries = 0; !tokens_.TryPush(token); ++tries)
+    {
+        if (stopped_.load(memory_order_relaxed))
+        {
+            return false;
+        }
+        if (tries < SPIN_TRIES)
+        {
+            this_thread::yield();
+            continue;
+        }
+        bool pushed = false;
+        {
+            unique_lock lock(mutex_);
+            producer_waiting_.store(true, memory_order_relaxed);
+            // Пара с барьером в WakeProducer: либо потребитель увидит флаг ожидания,
+            // либо проверка ниже увидит освободившееся место
+            atomic_thread_fence(memory_order_seq_cst);
+            not_full_.wait(lock, [&] {
+                pushed = tokens_.TryPush(token);
+                return pushed || stopped_.load(memory_order_relaxed);
+            });
+            producer_waiting_.store(false, memory_order_relaxed);
+        }
+        if (!pushed)
+        {
+            return false;
+        }
+        break;
+    }
+    WakeConsumer();
+    return true;
+}
+
+void PipelinedLexer::ParseNextToken()
+{
+    for (int tries = 0; !tokens_.TryPop(current_token_); ++tries)
+    {
+        if (finished_.load(memory_order_acquire))
+        {
+            // Лексер мог положить в очередь последние лексемы перед завершением
+            if (tokens_.TryPop(current_token_))
+            {
+                break;
+            }
+            if (error_)
+            {
+                rethrow_exception(error_);
+            }
+            current_token_ = token_type::Eof();
+            return;
+        }
+        if (tries < SPIN_TRIES)
+        {
+            this_thread::yield();
+            continue;
+        }
+        bool popped = false;
+        {
+            unique_lock lock(mutex_);
+            consumer_waiting_.store(true, memory_order_relaxed);
+            // Пара с барьером в WakeConsumer
+            atomic_thread_fence(memory_order_seq_cst);
+            not_empty_.wait(lock, [&] {
+                popped = tokens_.TryPop(current_token_);
+                return popped || finished_.load(memory_order_acquire);
+            });
+            consumer_waiting_.store(false, memory_order_relaxed);
+        }
+        if (popped)
+        {
+            break;
+        }
+    }
+    WakeProducer();
+}
+
+void PipelinedLexer::WakeConsumer()
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (consumer_waiting_.load(memory_order_relaxed))
+    {
+        lock_guard lock(mutex_);
+        not_empty_.notify_one();
+    }
+}
+
+void PipelinedLexer::WakeProducer()
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (producer_waiting_.load(memory_order_relaxed))
+    {
+        lock_guard lock(mutex_);
+        not_full_.notify_one();
+    }
+}
+
 void Lexer::ParseNextToken()
 {
     char c = input_.peek();
@@ -192,10 +364,11 @@ void Lexer::ParseLineEnd()
 void Lexer::ParseSpaces()
 {
     int spaces_count = 0;
-    while (input_.peek() == ' ')
+    auto* buffer = input_.rdbuf();
+    while (buffer->sgetc() == ' ')
     {
         ++spaces_count;
-        input_.get();
+        buffer->sbumpc();
     }
     if (input_.peek() == '#')
     {
@@ -357,23 +530,72 @@ void Lexer::ParseChar()
 
 void Lexer::SkipComment()
 {
-    while (input_ && input_.peek() != -1 && input_.peek() != '\n')
+    // ignore ищет конец строки сразу по буферу потока, а не по одному символу
+    input_.ignore(numeric_limits<streamsize>::max(), '\n');
+    if (!input_.eof() && !is_line_start_)
     {
-        input_.get();
+        input_.unget();
     }
-    if (input_.peek() == '\n' && is_line_start_)
+}
+
+namespace
+{
+
+// Дописывает в str строку raw, заменяя escape-последовательности соответствующими символами.
+// Фрагменты без escape-последовательностей копируются целиком
+void AppendUnescaped(string_view raw, string& str)
+{
+    while (!raw.empty())
     {
-        input_.get();
+        size_t pos = raw.find('\\');
+        str.append(raw.substr(0, pos));
+        if (pos == raw.npos || pos + 1 == raw.size())
+        {
+            break;
+        }
+        switch (raw[pos + 1])
+        {
+        case 'n':
+            str += '\n';
+            break;
+        case '"':
+            str += '\"';
+            break;
+        case '\'':
+            str += '\'';
+            break;
+        case 't':
+            str += '\t';
+            break;
+        case '\\':
+            str += '\\';
+            break;
+        default:
+            break;
+        }
+        raw.remove_prefix(pos + 2);
     }
 }
 
+// Проверяет, что кавычка после raw экранирована, то есть raw оканчивается
+// нечётным количеством обратных слэшей
+bool IsQuoteEscaped(string_view raw)
+{
+    size_t last = raw.find_last_not_of('\\');
+    size_t slashes = last == raw.npos ? raw.size() : raw.size() - last - 1;
+    return slashes % 2 == 1;
+}
+
+}  // namespace
+
 token_type::Number ReadNumber(std::istream &input)
 {
     int result = 0;
-    while (isdigit(input.peek()))
+    auto* buffer = input.rdbuf();
+    for (int c = buffer->sgetc(); isdigit(c); c = buffer->snextc())
     {
         result *= 10;
-        result += input.get() - '0';
+        result += c - '0';
     }
     return token_type::Number{result};
 }
@@ -381,54 +603,31 @@ token_type::Number ReadNumber(std::istream &input)
 token_type::String ReadString(std::istream &input)
 {
     string str;
+    string raw;
     char string_end = input.get();
-    char c = input.get();
-    while (c != string_end)
+    // getline находит закрывающую кавычку сразу по буферу потока и копирует строку целиком.
+    // Если кавычка оказалась экранированной, чтение продолжается до следующей
+    while (getline(input, raw, string_end) && !input.eof())
     {
-        if (c != '\\')
-        {
-            str += c;
-        }
-        else
-        {
-            c = input.get();
-            switch (c)
-            {
-            case 'n':
-                str += '\n';
-                break;
-            case '"':
-                str += '\"';
-                break;
-            case '\'':
-                str += '\'';
-                break;
-            case 't':
-                str += '\t';
-                break;
-            case '\\':
-                str += '\\';
-                break;
-            default:
-                break;
-            }
-        }
-        if (!input.get(c))
+        if (!IsQuoteEscaped(raw))
         {
-//			throw
+            AppendUnescaped(raw, str);
+            return token_type::String{move(str)};
         }
+        raw.pop_back();
+        AppendUnescaped(raw, str);
+        str += string_end;
     }
-    return token_type::String{move(str)};
+    throw LexerError("Unterminated string literal"s);
 }
 
 token_type::Id ReadId(std::istream &input)
 {
     string str;
-    char c = input.peek();
-    while (c == '_' || isalpha(c) || isdigit(c))
+    auto* buffer = input.rdbuf();
+    for (int c = buffer->sgetc(); c == '_' || isalnum(c); c = buffer->snextc())
     {
-        str += input.get();
-        c = input.peek();
+        str += static_cast<char>(c);
     }
     return token_type::Id{move(str)};
 }
@@ -1,13 +1,20 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <iosfwd>
+#include <mutex>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <variant>
 #include <vector>
 
+#include "spsc_queue.h"
+
 namespace parse
 {
 
@@ -98,10 +105,11 @@ public:
     using std::runtime_error::runtime_error;
 };
 
-class Lexer
+// Поток лексем. Хранит текущую лексему, а очередную лексему получает от наследника
+class TokenStream
 {
 public:
-    explicit Lexer(std::istream& input);
+    virtual ~TokenStream() = default;
 
     // Возвращает ссылку на текущий токен или token_type::Eof, если поток токенов закончился
     [[nodiscard]] const Token& CurrentToken() const;
@@ -160,8 +168,20 @@ public:
         }
     }
 
+protected:
+    // Записывает в current_token_ очередную лексему
+    virtual void ParseNextToken() = 0;
+
+    Token current_token_;
+};
+
+class Lexer : public TokenStream
+{
+public:
+    explicit Lexer(std::istream& input);
+
 private:
-    void ParseNextToken();
+    void ParseNextToken() override;
 
     bool IsIndentChanged();
 
@@ -175,13 +195,69 @@ private:
     void ParseChar();
     void SkipComment();
 
-    Token current_token_;
     std::istream& input_;
     bool is_line_start_ = true;
     int line_indent_ = 0;
     int current_indent_ = 0;
 };
 
+// Поток лексем, воспроизводящий заранее прочитанную последовательность.
+// После последней лексемы последовательности возвращает token_type::Eof
+class TokenReplay : public TokenStream
+{
+public:
+    explicit TokenReplay(std::vector<Token> tokens);
+
+private:
+    void ParseNextToken() override;
+
+    std::vector<Token> tokens_;
+    size_t next_token_ = 0;
+};
+
+// Поток лексем, который читает входной поток в отдельном потоке выполнения.
+// Лексер работает параллельно с потребителем лексем и передаёт их через ограниченную очередь,
+// поэтому расход памяти не зависит от размера входных данных.
+// Исключение, выброшенное лексером, повторно выбрасывается потребителю
+// после того, как тот получит все лексемы, прочитанные до ошибки.
+// Поток, которому пришлось ждать другого, недолго проверяет очередь снова, а затем засыпает,
+// поэтому медленный ввод или медленный потребитель не занимают ожидающим потоком ядро
+class PipelinedLexer : public TokenStream
+{
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 4096;
+
+    explicit PipelinedLexer(std::istream& input, size_t capacity = DEFAULT_CAPACITY);
+
+    PipelinedLexer(const PipelinedLexer&) = delete;
+    PipelinedLexer& operator=(const PipelinedLexer&) = delete;
+
+    // Останавливает поток лексера, даже если входные данные прочитаны не до конца
+    ~PipelinedLexer() override;
+
+private:
+    void ParseNextToken() override;
+
+    void Produce(std::istream& input);
+    bool Push(Token& token);
+    // Будят поток, который заснул, ожидая лексему или место в очереди
+    void WakeConsumer();
+    void WakeProducer();
+
+    util::SpscQueue<Token> tokens_;
+    std::exception_ptr error_;
+    std::atomic<bool> finished_ = false;
+    std::atomic<bool> stopped_ = false;
+    // Очередь работает без блокировок. Мьютекс нужен только потоку, который засыпает,
+    // и потоку, который видит, что другой поток спит, и будит его
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::atomic<bool> consumer_waiting_ = false;
+    std::atomic<bool> producer_waiting_ = false;
+    std::thread producer_;
+};
+
 token_type::Number ReadNumber(std::istream& input);
 
 token_type::String ReadString(std::istream& input);
@@ -1,8 +1,12 @@
 #include "lexer.h"
 #include "test_runner_p.h"
 
+#include <chrono>
+#include <ctime>
 #include <sstream>
+#include <streambuf>
 #include <string>
+#include <thread>
 
 using namespace std;
 
@@ -494,6 +498,139 @@ class GCD:
 
 }
 
+void TestLongStringsAndComments()
+{
+    const string long_text(10000, 'x');
+    {
+        istringstream is("# "s + long_text + "\n'"s + long_text + "'\nprint 1 # "s + long_text);
+        Lexer lexer(is);
+
+        ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::String{long_text}));
+        ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Newline{}));
+        ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Print{}));
+        ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Number{1}));
+        ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Newline{}));
+        ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Eof{}));
+    }
+    {
+        istringstream is(R"('a\'b' "c\"d\\" 'e\\\'f\tg\n')"s);
+        Lexer lexer(is);
+
+        ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::String{"a'b"s}));
+        ASSERT_EQUAL(lexer.NextToken(), Token(token_type::String{"c\"d\\"s}));
+        ASSERT_EQUAL(lexer.NextToken(), Token(token_type::String{"e\\'f\tg\n"s}));
+    }
+    {
+        istringstream is("x = 'unterminated"s);
+        Lexer lexer(is);
+
+        lexer.NextToken();
+        ASSERT_THROWS(lexer.NextToken(), LexerError);
+    }
+}
+
+void TestPipelinedLexer()
+{
+    string program;
+    for (int i = 0; i < 2000; ++i)
+    {
+        program += "class C"s + to_string(i) + ":\n  def f(x):\n    return x + 'str' # comment\n\n"s;
+    }
+
+    auto read_all = [](TokenStream& tokens) {
+        vector<Token> result{tokens.CurrentToken()};
+        while (!result.back().Is<token_type::Eof>())
+        {
+            result.push_back(tokens.NextToken());
+        }
+        return result;
+    };
+
+    istringstream expected_input(program);
+    Lexer lexer(expected_input);
+    const vector<Token> expected = read_all(lexer);
+
+    for (size_t capacity : {1, 16, 4096})
+    {
+        istringstream is(program);
+        PipelinedLexer pipelined(is, capacity);
+        ASSERT(read_all(pipelined) == expected);
+        ASSERT_EQUAL(pipelined.NextToken(), Token(token_type::Eof{}));
+    }
+    {
+        // Потребитель прекратил чтение раньше, чем лексер дошёл до конца
+        istringstream is(program);
+        PipelinedLexer pipelined(is, 16);
+        ASSERT_EQUAL(pipelined.CurrentToken(), Token(token_type::Class{}));
+    }
+    {
+        istringstream is("x = 'unterminated"s);
+        PipelinedLexer pipelined(is);
+
+        ASSERT_EQUAL(pipelined.CurrentToken(), Token(token_type::Id{"x"s}));
+        ASSERT_EQUAL(pipelined.NextToken(), Token(token_type::Char{'='}));
+        ASSERT_THROWS(pipelined.NextToken(), LexerError);
+    }
+    {
+        istringstream is("'unterminated"s);
+        ASSERT_THROWS(PipelinedLexer{is}, LexerError);
+    }
+}
+
+// Отдаёт первую строку сразу, а вторую после паузы, как медленный источник ввода
+class StallingBuffer : public streambuf
+{
+public:
+    StallingBuffer(string first, string second, chrono::milliseconds stall)
+        : first_(move(first))
+        , second_(move(second))
+        , stall_(stall)
+    {
+        setg(first_.data(), first_.data(), first_.data() + first_.size());
+    }
+
+protected:
+    int_type underflow() override
+    {
+        if (stalled_)
+        {
+            return traits_type::eof();
+        }
+        stalled_ = true;
+        this_thread::sleep_for(stall_);
+        setg(second_.data(), second_.data(), second_.data() + second_.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    string first_;
+    string second_;
+    chrono::milliseconds stall_;
+    bool stalled_ = false;
+};
+
+void TestPipelinedLexerSleepsWhileWaiting()
+{
+    StallingBuffer buffer("x = 1\n"s, "y = 2\n"s, 300ms);
+    istream is(&buffer);
+    const clock_t cpu_start = clock();
+    PipelinedLexer pipelined(is);
+
+    ASSERT_EQUAL(pipelined.CurrentToken(), Token(token_type::Id{"x"s}));
+    ASSERT_EQUAL(pipelined.NextToken(), Token(token_type::Char{'='}));
+    ASSERT_EQUAL(pipelined.NextToken(), Token(token_type::Number{1}));
+    ASSERT_EQUAL(pipelined.NextToken(), Token(token_type::Newline{}));
+    ASSERT_EQUAL(pipelined.NextToken(), Token(token_type::Id{"y"s}));
+    ASSERT_EQUAL(pipelined.NextToken(), Token(token_type::Char{'='}));
+    ASSERT_EQUAL(pipelined.NextToken(), Token(token_type::Number{2}));
+    ASSERT_EQUAL(pipelined.NextToken(), Token(token_type::Newline{}));
+    ASSERT_EQUAL(pipelined.NextToken(), Token(token_type::Eof{}));
+
+    // Пока лексер ждёт ввод, потребитель спит, а не крутится в цикле
+    const double cpu_seconds = static_cast<double>(clock() - cpu_start) / CLOCKS_PER_SEC;
+    ASSERT(cpu_seconds < 0.1);
+}
+
 }  // namespace
 
 void RunOpenLexerTests(TestRunner& tr)
@@ -512,6 +649,9 @@ void RunOpenLexerTests(TestRunner& tr)
     RUN_TEST(tr, parse::TestAlwaysEmitsNewlineAtTheEndOfNonemptyLine);
     RUN_TEST(tr, parse::TestCommentsAreIgnored);
     RUN_TEST(tr, parse::MyTest);
+    RUN_TEST(tr, parse::TestLongStringsAndComments);
+    RUN_TEST(tr, parse::TestPipelinedLexer);
+    RUN_TEST(tr, parse::TestPipelinedLexerSleepsWhileWaiting);
 }
 
 }  // namespace parse
@@ -1,47 +1,745 @@
 #include "lexer.h"
+#include "output.h"
 #include "parse.h"
 #include "runtime.h"
+#include "server.h"
+#include "snapshot.h"
 #include "statement.h"
-
+#include "thread_pool.h"
+#include "watchdog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <csignal>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
 
 using namespace std;
 
-void InterpretMythonProgram(istream& input, ostream& output)
+// Настройки интерпретатора, задаваемые в командной строке
+struct InterpreterOptions
+{
+    ParseOptions parse;
+    // Разбирать программу в несколько потоков
+    bool parallel_parse = false;
+    // Читать лексемы в отдельном потоке параллельно с разбором
+    bool pipelined_lex = false;
+    runtime::OutputOptions output;
+    // Каталог кэша вывода. Если пуст, вывод не кэшируется
+    std::filesystem::path output_cache;
+    // Файл снимка состояния программы после пролога. Если пуст, снимок не используется
+    std::filesystem::path snapshot;
+    runtime::ExecutionLimits limits;
+    // Сколько может выполняться одна программа, 0 - без ограничения
+    chrono::milliseconds timeout{0};
+    runtime::CollectorOptions collector;
+    // Выводить в stderr счётчики сборщика циклов
+    bool collector_stats = false;
+};
+
+unique_ptr<runtime::Executable> ParseMythonProgram(istream& input, const InterpreterOptions& options)
 {
+    if (options.parallel_parse)
+    {
+        ostringstream source;
+        source << input.rdbuf();
+        return ParseProgramParallel(source.str(), options.parse);
+    }
+    if (options.pipelined_lex)
+    {
+        parse::PipelinedLexer lexer(input);
+        return ParseProgram(lexer, options.parse);
+    }
     parse::Lexer lexer(input);
-    unique_ptr<runtime::Executable> exec = ParseProgram(lexer);
-    runtime::SimpleContext context{output};
-    runtime::Closure closure;
+    return ParseProgram(lexer, options.parse);
+}
+
+void InterpretMythonProgram(istream& input, runtime::Context& context,
+                            const InterpreterOptions& options = {})
+{
+    unique_ptr<runtime::Executable> exec = ParseMythonProgram(input, options);
+    context.SetLimits(options.limits);
+    context.SetCollectorOptions(options.collector);
+    runtime::Closure closure = runtime::MakeClosure(context);
     exec->Execute(closure, context);
 }
 
-int main(int argc, const char** argv) {
-    if (argc != 3) {
-            std::filesystem::path interpreter = argv[0];
-            cerr << "Usage Mython interpreter: "sv << interpreter.filename() << " <file_in> <file_out>"sv << endl;
-            return 1;
+void InterpretMythonProgram(istream& input, ostream& output, const InterpreterOptions& options = {})
+{
+    runtime::SimpleContext context{output};
+    InterpretMythonProgram(input, context, options);
+}
+
+// Выполняет программу source, начиная с состояния после пролога, сохранённого в снимке
+// snapshot_path. Если снимка нет, он сделан для другого пролога или другой версией
+// интерпретатора, пролог выполняется, и снимок создаётся заново.
+// Программа без маркера снимка выполняется целиком
+void InterpretWithSnapshot(string_view source, const std::filesystem::path& snapshot_path,
+                           runtime::Context& context, const InterpreterOptions& options)
+{
+    auto parts = runtime::SplitAtSnapshotMarker(source);
+    if (!parts)
+    {
+        istringstream input{string(source)};
+        InterpretMythonProgram(input, context, options);
+        return;
+    }
+    const auto [prologue, main_part] = *parts;
+    // Пролог разбирается и тогда, когда его не нужно выполнять: деревом пролога
+    // владеют классы, объекты которых восстанавливаются из снимка
+    ProgramWithPrologue program = ParseProgramWithPrologue(prologue, main_part, options.parse);
+    context.SetLimits(options.limits);
+    context.SetCollectorOptions(options.collector);
+    runtime::Closure closure = runtime::MakeClosure(context);
+
+    optional<runtime::Snapshot> snapshot;
+    try
+    {
+        snapshot.emplace(snapshot_path);
+    }
+    catch (const system_error&)
+    {
+    }
+    catch (const runtime::SnapshotError&)
+    {
+    }
+
+    ostream& output = context.GetOutputStream();
+    if (snapshot && snapshot->Prologue() == prologue)
+    {
+        output.write(snapshot->Output().data(), static_cast<streamsize>(snapshot->Output().size()));
+        if (!snapshot->IsOutputDeterministic())
+        {
+            context.MarkOutputNondeterministic();
+        }
+        snapshot->Restore(closure, program.prologue_classes, context);
+    }
+    else
+    {
+        snapshot.reset();
+        ostringstream prologue_output;
+        runtime::SimpleContext prologue_context(prologue_output);
+        // Пролог расходует топливо и память всей программы. При запуске из снимка он
+        // не выполняется и топлива не расходует
+        prologue_context.SetLimits(options.limits);
+        prologue_context.SetCollectorOptions(options.collector);
+        prologue_context.SetCancellationToken(context.GetCancellationToken());
+        prologue_context.SetMemoryAccount(context.GetMemoryAccount());
+        const uint64_t fuel = prologue_context.GetFuelLeft();
+        program.prologue->Execute(closure, prologue_context);
+        context.ConsumeFuel(fuel - prologue_context.GetFuelLeft());
+        const string printed = prologue_output.str();
+        output.write(printed.data(), static_cast<streamsize>(printed.size()));
+        if (!prologue_context.IsOutputDeterministic())
+        {
+            context.MarkOutputNondeterministic();
+        }
+        try
+        {
+            runtime::SaveSnapshot(snapshot_path, prologue, printed,
+                                  prologue_context.IsOutputDeterministic(), closure,
+                                  program.prologue_classes);
+        }
+        catch (const system_error&)
+        {
+            // Без снимка следующий запуск просто выполнит пролог снова
+        }
+    }
+    // Экземпляры пролога отслеживал сборщик контекста пролога, а восстановленные из снимка
+    // не отслеживал никто. Циклы из них освобождает сборщик основной части программы
+    if (runtime::CycleCollector* collector = context.GetCollector())
+    {
+        collector->TrackReachable(closure);
+    }
+    program.main->Execute(closure, context);
+}
+
+// Сведения о выполнении программы
+struct RunStats
+{
+    // Наибольший объём памяти в байтах, который занимали объекты программы,
+    // или 0, если память не учитывалась
+    size_t peak_memory = 0;
+    runtime::CollectorStats collector;
+    // Вывод взят из кэша, и программа не выполнялась
+    bool from_cache = false;
+};
+
+// Собирает циклы, оставшиеся от программы, выполненной в context, после того как её
+// переменные освобождены, и возвращает сведения о выполнении
+RunStats FinishRun(runtime::Context& context)
+{
+    RunStats stats;
+    if (const auto& account = context.GetMemoryAccount())
+    {
+        stats.peak_memory = account->GetPeak();
+    }
+    if (runtime::CycleCollector* collector = context.GetCollector())
+    {
+        collector->Collect();
+        stats.collector = collector->GetStats();
+    }
+    return stats;
+}
+
+// Возвращает вариант записей кэша вывода для настроек options: запуски с настройками,
+// от которых зависит результат программы, не должны получать вывод друг друга
+string OutputCacheVariant(const InterpreterOptions& options)
+{
+    string variant;
+    // Программа, которой хватило топлива, может не уложиться в меньший запас
+    if (options.limits.fuel > 0)
+    {
+        variant += "fuel="sv;
+        variant += to_string(options.limits.fuel);
+        variant += ';';
+    }
+    // Уложится ли программа в лимит памяти, зависит и от того, как часто собираются циклы
+    if (options.limits.memory > 0)
+    {
+        variant += "memory="sv;
+        variant += to_string(options.limits.memory);
+        variant += ";gc="sv;
+        variant += to_string(options.collector.threshold);
+        variant += '/';
+        variant += to_string(options.collector.growth);
+        variant += ';';
+    }
+    return variant;
+}
+
+// Выполняет программу из файла file_in и записывает её вывод в файл file_out.
+// Выбрасывает исключение, если файлы не удалось открыть или программа завершилась с ошибкой.
+// Если вывод взят из кэша, возвращает сведения с from_cache, равным true
+RunStats InterpretMythonFile(const std::filesystem::path& file_in,
+                           const std::filesystem::path& file_out, const InterpreterOptions& options)
+{
+    ifstream input(file_in);
+    if (!input.is_open())
+    {
+        throw runtime_error("Can't open file "s + file_in.string());
+    }
+    runtime::CancellationToken cancellation;
+    optional<runtime::Watchdog> watchdog;
+    if (options.timeout.count() > 0)
+    {
+        watchdog.emplace(cancellation, options.timeout);
+    }
+
+    if (options.output_cache.empty() && options.snapshot.empty())
+    {
+        runtime::FileOutputContext context(file_out, options.output);
+        context.SetCancellationToken(&cancellation);
+        InterpretMythonProgram(input, context, options);
+        context.Flush();
+        return FinishRun(context);
+    }
+
+    const string source(istreambuf_iterator<char>(input), istreambuf_iterator<char>{});
+    optional<runtime::OutputCache> cache;
+    if (!options.output_cache.empty())
+    {
+        cache.emplace(options.output_cache, OutputCacheVariant(options));
+        if (cache->Load(source, file_out))
+        {
+            RunStats stats;
+            stats.from_cache = true;
+            return stats;
+        }
     }
+    bool deterministic = false;
+    RunStats stats;
+    {
+        runtime::FileOutputContext context(file_out, options.output);
+        context.SetCancellationToken(&cancellation);
+        if (options.snapshot.empty())
+        {
+            istringstream program(source);
+            InterpretMythonProgram(program, context, options);
+        }
+        else
+        {
+            InterpretWithSnapshot(source, options.snapshot, context, options);
+        }
+        context.Flush();
+        deterministic = context.IsOutputDeterministic();
+        stats = FinishRun(context);
+    }
+    // Размер отображённого в память файла вывода окончательно устанавливается при
+    // разрушении контекста, поэтому вывод сохраняется в кэш после этого
+    if (cache && deterministic)
+    {
+        cache->Store(source, file_out);
+    }
+    return stats;
+}
+
+// Задание пакетного режима: файл с программой и файл для её вывода
+struct BatchJob
+{
+    std::filesystem::path input;
+    std::filesystem::path output;
+};
+
+// Читает список заданий: в каждой строке файла manifest через пробел записаны входной
+// и выходной файлы. Пустые строки и строки, начинающиеся с #, пропускаются
+vector<BatchJob> ReadManifest(const std::filesystem::path& manifest)
+{
+    ifstream input(manifest);
+    if (!input.is_open())
+    {
+        throw runtime_error("Can't open file "s + manifest.string());
+    }
+
+    vector<BatchJob> jobs;
+    string line;
+    for (size_t line_number = 1; getline(input, line); ++line_number)
+    {
+        istringstream fields(line);
+        string file_in;
+        string file_out;
+        if (!(fields >> file_in) || file_in.front() == '#')
+        {
+            continue;
+        }
+        string extra;
+        if (!(fields >> file_out) || fields >> extra)
+        {
+            throw runtime_error("Wrong manifest line "s + to_string(line_number) + ": "s + line);
+        }
+        jobs.push_back({file_in, file_out});
+    }
+    return jobs;
+}
+
+// Составляет задания для всех файлов каталога input_dir. Вывод каждой программы
+// записывается в файл с тем же именем в каталоге output_dir
+vector<BatchJob> ListDirectory(const std::filesystem::path& input_dir,
+                               const std::filesystem::path& output_dir)
+{
+    vector<BatchJob> jobs;
+    for (const auto& entry : std::filesystem::directory_iterator(input_dir))
+    {
+        if (entry.is_regular_file())
+        {
+            jobs.push_back({entry.path(), output_dir / entry.path().filename()});
+        }
+    }
+    sort(jobs.begin(), jobs.end(), [](const BatchJob& lhs, const BatchJob& rhs) {
+        return lhs.input < rhs.input;
+    });
+    std::filesystem::create_directories(output_dir);
+    return jobs;
+}
+
+// Выполняет задания в thread_count потоков и выводит в report состояние и время
+// выполнения каждого задания, как только оно завершится. Возвращает количество
+// неудавшихся заданий
+size_t RunBatch(const vector<BatchJob>& jobs, const InterpreterOptions& options, size_t thread_count,
+                ostream& report)
+{
+    const auto start = chrono::steady_clock::now();
+    mutex report_mutex;
+    size_t failed = 0;
+    report << fixed << setprecision(3);
+    atomic<size_t> remaining = jobs.size();
+    promise<void> all_done;
+
+    auto run_job = [&](const BatchJob& job) {
+        string error;
+        size_t peak_memory = 0;
+        bool from_cache = false;
+        const auto job_start = chrono::steady_clock::now();
+        try
+        {
+            const RunStats stats = InterpretMythonFile(job.input, job.output, options);
+            peak_memory = stats.peak_memory;
+            from_cache = stats.from_cache;
+        }
+        catch (const std::exception& e)
+        {
+            error = e.what();
+        }
+        const chrono::duration<double, milli> duration = chrono::steady_clock::now() - job_start;
+        {
+            lock_guard lock(report_mutex);
+            report << (error.empty() ? "OK   "sv : "FAIL "sv) << duration.count() << " ms "sv
+                   << job.input.string();
+            if (!error.empty())
+            {
+                report << ": "sv << error;
+                ++failed;
+            }
+            else if (from_cache)
+            {
+                report << ", output from cache"sv;
+            }
+            else if (options.limits.memory > 0)
+            {
+                report << ", peak memory "sv << peak_memory << " bytes"sv;
+            }
+            report << endl;
+        }
+        if (remaining.fetch_sub(1) == 1)
+        {
+            all_done.set_value();
+        }
+    };
+
+    if (!jobs.empty())
+    {
+        util::ThreadPool pool(thread_count);
+        // Поток выполняет первое задание диапазона, а вторую половину оставшихся ставит
+        // в свою очередь, откуда её забирают свободные потоки и делят дальше. Так задания
+        // расходятся по потокам без общей очереди
+        function<void(size_t, size_t)> run_range = [&](size_t begin, size_t end) {
+            while (end - begin > 1)
+            {
+                const size_t middle = begin + (end - begin) / 2;
+                (void)pool.Submit([&run_range, middle, end] { run_range(middle, end); });
+                end = middle;
+            }
+            run_job(jobs[begin]);
+        };
+        (void)pool.Submit([&run_range, &jobs] { run_range(0, jobs.size()); });
+        // Пул останавливается, только когда все задания выполнены: иначе потоки,
+        // которым сейчас нечего делать, завершились бы, не дождавшись новых половин
+        all_done.get_future().wait();
+    }
+
+    const chrono::duration<double, milli> total = chrono::steady_clock::now() - start;
+    report << "Jobs: "sv << jobs.size() << ", failed: "sv << failed << ", "sv << total.count() << " ms"sv
+           << endl;
+    return failed;
+}
+
+// Выполняет server.Run(), пока процесс не получит SIGINT или SIGTERM
+template <typename Server>
+void RunUntilSignal(Server& server)
+{
+    static Server* running = nullptr;
+    running = &server;
+    auto stop = [](int /*signal*/) { running->Stop(); };
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    server.Run();
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    running = nullptr;
+}
+
+// Выполняет программы, присланные через сокет socket_path, пока процесс не получит
+// SIGINT или SIGTERM
+void ServeMythonPrograms(const std::filesystem::path& socket_path, const InterpreterOptions& options,
+                         size_t thread_count)
+{
+    server::ServerOptions server_options;
+    server_options.parse = options.parse;
+    server_options.output = options.output;
+    server_options.limits = options.limits;
+    server_options.timeout = options.timeout;
+    server_options.collector = options.collector;
+    server_options.thread_count = thread_count;
+    server::Server server(socket_path, server_options);
+    RunUntilSignal(server);
+}
+
+// Выполняет каждую программу, присланную через сокет socket_path, в отдельном процессе,
+// пока процесс сервера не получит SIGINT или SIGTERM. Программы из файлов preload
+// разбираются заранее
+void ForkServeMythonPrograms(const std::filesystem::path& socket_path,
+                             const vector<string_view>& preload, const InterpreterOptions& options,
+                             size_t workers)
+{
+    server::ForkServerOptions server_options;
+    server_options.parse = options.parse;
+    server_options.output = options.output;
+    server_options.limits = options.limits;
+    server_options.timeout = options.timeout;
+    server_options.collector = options.collector;
+    server_options.workers = workers;
+    for (string_view file : preload)
+    {
+        ifstream input{std::filesystem::path(file), ios::binary};
+        if (!input.is_open())
+        {
+            throw runtime_error("Can't open file "s + string(file));
+        }
+        server_options.preload.emplace_back(istreambuf_iterator<char>(input),
+                                            istreambuf_iterator<char>{});
+    }
+    server::ForkServer server(socket_path, move(server_options));
+    RunUntilSignal(server);
+}
+
+// Выполняет программу из файла file_in на сервере, который слушает сокет socket_path.
+// Сервер записывает вывод программы в файл file_out
+void InterpretOnServer(const std::filesystem::path& socket_path, const std::filesystem::path& file_in,
+                       const std::filesystem::path& file_out)
+{
+    ifstream input(file_in, ios::binary);
+    if (!input.is_open())
+    {
+        throw runtime_error("Can't open file "s + file_in.string());
+    }
+    const string source(istreambuf_iterator<char>(input), istreambuf_iterator<char>{});
+    server::Client client(socket_path);
+    client.Execute(source, std::filesystem::absolute(file_out));
+}
+
+// Читает неотрицательное число из value. Возвращает false, если value не является числом
+bool ParseSize(string_view value, size_t& result)
+{
+    auto [ptr, ec] = from_chars(value.data(), value.data() + value.size(), result);
+    return ec == errc() && ptr == value.data() + value.size();
+}
 
-    std::filesystem::path file_in = argv[1];
-    std::filesystem::path file_out = argv[2];
+void PrintUsage(const char* argv0)
+{
+    std::filesystem::path interpreter = argv0;
+    cerr << "Usage Mython interpreter: "sv << interpreter.filename()
+         << " [options] <file_in> <file_out>\n"sv
+         << "    or: "sv << interpreter.filename() << " [options] --batch <manifest>\n"sv
+         << "    or: "sv << interpreter.filename() << " [options] --batch-dir <dir_in> <dir_out>\n"sv
+         << "    or: "sv << interpreter.filename() << " [options] --serve <socket>\n"sv
+         << "    or: "sv << interpreter.filename()
+         << " [options] [--preload=<file>...] --fork-server <socket>\n"sv
+         << "    or: "sv << interpreter.filename() << " --connect <socket> <file_in> <file_out>\n"sv
+         << "Options: [--eager-parse] [--parallel-parse] [--pipelined-lex] [--mmap-output]"sv
+         << " [--async-output] [--output-buffer=<bytes>] [--output-cache=<dir>]"sv
+         << " [--snapshot=<file>] [--fuel=<steps>] [--timeout-ms=<ms>]"sv
+         << " [--memory-limit=<bytes>] [--gc-threshold=<instances>] [--gc-growth=<percent>]"sv
+         << " [--gc-stats] [--jobs=<count>]"sv << endl;
+}
 
-    ifstream ifile(file_in);
-    if (!ifile.is_open())
+int main(int argc, const char** argv) {
+    InterpreterOptions options;
+    vector<string_view> files;
+    // Количество потоков пакетного режима, 0 - по числу ядер
+    size_t jobs = 0;
+    bool batch = false;
+    bool batch_dir = false;
+    bool serve = false;
+    bool fork_server = false;
+    bool connect = false;
+    // Программы, которые сервер с отдельными процессами разбирает заранее
+    vector<string_view> preload;
+    for (int i = 1; i < argc; ++i)
     {
-        std::cerr << "Can't open file "s << file_in << endl;
+        string_view arg = argv[i];
+        if (arg == "--eager-parse"sv)
+        {
+            options.parse.lazy_method_bodies = false;
+        }
+        else if (arg == "--parallel-parse"sv)
+        {
+            options.parallel_parse = true;
+        }
+        else if (arg == "--pipelined-lex"sv)
+        {
+            options.pipelined_lex = true;
+        }
+        else if (arg == "--mmap-output"sv)
+        {
+            options.output.memory_mapped = true;
+        }
+        else if (arg == "--async-output"sv)
+        {
+            options.output.async = true;
+        }
+        else if (arg == "--gc-stats"sv)
+        {
+            options.collector_stats = true;
+        }
+        else if (arg == "--batch"sv)
+        {
+            batch = true;
+        }
+        else if (arg == "--batch-dir"sv)
+        {
+            batch_dir = true;
+        }
+        else if (arg == "--serve"sv)
+        {
+            serve = true;
+        }
+        else if (arg == "--fork-server"sv)
+        {
+            fork_server = true;
+        }
+        else if (arg == "--connect"sv)
+        {
+            connect = true;
+        }
+        else if (constexpr auto prefix = "--output-buffer="sv; arg.substr(0, prefix.size()) == prefix)
+        {
+            if (!ParseSize(arg.substr(prefix.size()), options.output.buffer_size))
+            {
+                cerr << "Wrong output buffer size: "sv << arg.substr(prefix.size()) << endl;
+                return 1;
+            }
+        }
+        else if (constexpr auto prefix = "--output-cache="sv; arg.substr(0, prefix.size()) == prefix)
+        {
+            options.output_cache = arg.substr(prefix.size());
+        }
+        else if (constexpr auto prefix = "--preload="sv; arg.substr(0, prefix.size()) == prefix)
+        {
+            preload.push_back(arg.substr(prefix.size()));
+        }
+        else if (constexpr auto prefix = "--snapshot="sv; arg.substr(0, prefix.size()) == prefix)
+        {
+            options.snapshot = arg.substr(prefix.size());
+        }
+        else if (constexpr auto prefix = "--fuel="sv; arg.substr(0, prefix.size()) == prefix)
+        {
+            size_t fuel = 0;
+            if (!ParseSize(arg.substr(prefix.size()), fuel))
+            {
+                cerr << "Wrong fuel: "sv << arg.substr(prefix.size()) << endl;
+                return 1;
+            }
+            options.limits.fuel = fuel;
+        }
+        else if (constexpr auto prefix = "--memory-limit="sv; arg.substr(0, prefix.size()) == prefix)
+        {
+            if (!ParseSize(arg.substr(prefix.size()), options.limits.memory))
+            {
+                cerr << "Wrong memory limit: "sv << arg.substr(prefix.size()) << endl;
+                return 1;
+            }
+        }
+        else if (constexpr auto prefix = "--gc-threshold="sv; arg.substr(0, prefix.size()) == prefix)
+        {
+            if (!ParseSize(arg.substr(prefix.size()), options.collector.threshold))
+            {
+                cerr << "Wrong collector threshold: "sv << arg.substr(prefix.size()) << endl;
+                return 1;
+            }
+        }
+        else if (constexpr auto prefix = "--gc-growth="sv; arg.substr(0, prefix.size()) == prefix)
+        {
+            size_t percent = 0;
+            if (!ParseSize(arg.substr(prefix.size()), percent))
+            {
+                cerr << "Wrong collector growth: "sv << arg.substr(prefix.size()) << endl;
+                return 1;
+            }
+            options.collector.growth = static_cast<double>(percent) / 100.0;
+        }
+        else if (constexpr auto prefix = "--timeout-ms="sv; arg.substr(0, prefix.size()) == prefix)
+        {
+            size_t timeout = 0;
+            if (!ParseSize(arg.substr(prefix.size()), timeout))
+            {
+                cerr << "Wrong timeout: "sv << arg.substr(prefix.size()) << endl;
+                return 1;
+            }
+            options.timeout = chrono::milliseconds(timeout);
+        }
+        else if (constexpr auto prefix = "--jobs="sv; arg.substr(0, prefix.size()) == prefix)
+        {
+            if (!ParseSize(arg.substr(prefix.size()), jobs))
+            {
+                cerr << "Wrong number of jobs: "sv << arg.substr(prefix.size()) << endl;
+                return 1;
+            }
+        }
+        else
+        {
+            files.push_back(arg);
+        }
     }
-    ofstream ofile(file_out);
-    if (!ofile.is_open())
+
+    if (serve || fork_server || connect)
     {
-        std::cerr << "Can't open file "s << file_out << endl;
+        if (serve + fork_server + connect != 1 || batch || batch_dir
+            || files.size() != (connect ? 3U : 1U) || (!fork_server && !preload.empty()))
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        try
+        {
+            if (serve)
+            {
+                ServeMythonPrograms(files[0], options, jobs);
+            }
+            else if (fork_server)
+            {
+                ForkServeMythonPrograms(files[0], preload, options, jobs);
+            }
+            else
+            {
+                InterpretOnServer(files[0], files[1], files[2]);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (batch || batch_dir)
+    {
+        if (batch == batch_dir || files.size() != (batch ? 1U : 2U))
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        try
+        {
+            vector<BatchJob> batch_jobs = batch ? ReadManifest(files[0]) : ListDirectory(files[0], files[1]);
+            return RunBatch(batch_jobs, options, jobs, cout) == 0 ? 0 : 1;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (files.size() != 2) {
+        PrintUsage(argv[0]);
+        return 1;
     }
 
     try
     {
-        InterpretMythonProgram(ifile, ofile);
+        const RunStats stats = InterpretMythonFile(files[0], files[1], options);
+        // Для вывода из кэша программа не выполнялась, и счётчиков выполнения нет
+        if (stats.from_cache)
+        {
+            if (options.limits.memory > 0 || options.collector_stats)
+            {
+                cerr << "Output taken from cache"sv << endl;
+            }
+        }
+        else if (options.limits.memory > 0)
+        {
+            cerr << "Peak memory: "sv << stats.peak_memory << " bytes"sv << endl;
+        }
+        if (options.collector_stats && !stats.from_cache)
+        {
+            cerr << "Collections: "sv << stats.collector.collections << ", collected instances: "sv
+                 << stats.collector.collected << ", live instances: "sv
+                 << stats.collector.tracked << endl;
+        }
     }
     catch (const std::exception& e)
     {
@@ -74,6 +772,10 @@ int main(int argc, const char** argv) {
 //void RunObjectsTests(TestRunner& tr);
 //}  // namespace runtime
 
+//namespace server {
+//void RunServerTests(TestRunner& tr);
+//}  // namespace server
+
 //void TestParseProgram(TestRunner& tr);
 
 //namespace {
@@ -172,6 +874,7 @@ int main(int argc, const char** argv) {
 //    runtime::RunObjectsTests(tr);
 //    ast::RunUnitTests(tr);
 //    TestParseProgram(tr);
+//    server::RunServerTests(tr);
 
 //    RUN_TEST(tr, TestSimplePrints);
 //    RUN_TEST(tr, TestAssignments);
@@ -0,0 +1,662 @@
+#include "output.h"
+
+#include "version.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+using namespace std;
+
+namespace runtime
+{
+
+namespace
+{
+
+[[noreturn]] void ThrowSystemError(const char* what)
+{
+    throw system_error(errno, generic_category(), what);
+}
+
+// Записывает все части parts, повторяя writev после частичной записи
+void WriteAll(int fd, iovec* parts, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, parts, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ThrowSystemError("Can't write output");
+        }
+        auto rest = static_cast<size_t>(written);
+        while (count > 0 && rest >= parts->iov_len)
+        {
+            rest -= parts->iov_len;
+            ++parts;
+            --count;
+        }
+        if (count > 0)
+        {
+            parts->iov_base = static_cast<char*>(parts->iov_base) + rest;
+            parts->iov_len -= rest;
+        }
+    }
+}
+
+// Проверяет, можно ли отобразить файл fd в память для записи
+bool CanMap(int fd)
+{
+    struct stat info{};
+    const int flags = fcntl(fd, F_GETFL);
+    return fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && flags >= 0
+           && (flags & O_ACCMODE) == O_RDWR;
+}
+
+// Закрывает дескриптор при выходе из области видимости
+class FileDescriptor
+{
+public:
+    explicit FileDescriptor(int fd)
+        : fd_(fd)
+    {
+    }
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    ~FileDescriptor()
+    {
+        if (fd_ >= 0)
+        {
+            close(fd_);
+        }
+    }
+
+    [[nodiscard]] int Get() const
+    {
+        return fd_;
+    }
+
+private:
+    int fd_;
+};
+
+// Читает size байт файла fd, начиная с offset. Возвращает false, если файл короче
+bool ReadAt(int fd, char* data, size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t count = pread(fd, data, size, offset);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        data += count;
+        size -= static_cast<size_t>(count);
+        offset += count;
+    }
+    return true;
+}
+
+// Копирует size байт файла in_fd, начиная с offset, в файл out_fd. Данные копируются
+// внутри ядра: copy_file_range между файлами и sendfile, если out_fd - сокет или канал
+void CopyRange(int in_fd, off_t offset, int out_fd, size_t size)
+{
+#ifdef __linux__
+    bool use_copy_file_range = true;
+    while (size > 0)
+    {
+        ssize_t count = use_copy_file_range
+                            ? copy_file_range(in_fd, &offset, out_fd, nullptr, size, 0)
+                            : sendfile(out_fd, in_fd, &offset, size);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // copy_file_range не поддерживается для этой пары файлов
+            if (use_copy_file_range
+                && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP
+                    || errno == EBADF))
+            {
+                use_copy_file_range = false;
+                continue;
+            }
+            if (errno == EINVAL || errno == ENOSYS)
+            {
+                break;
+            }
+            ThrowSystemError("Can't write output");
+        }
+        if (count == 0)
+        {
+            throw system_error(EIO, generic_category(), "Output cache entry is truncated");
+        }
+        size -= static_cast<size_t>(count);
+    }
+#endif
+
+    array<char, 64 << 10> buffer;
+    while (size > 0)
+    {
+        const size_t chunk = min(size, buffer.size());
+        if (!ReadAt(in_fd, buffer.data(), chunk, offset))
+        {
+            throw system_error(EIO, generic_category(), "Output cache entry is truncated");
+        }
+        iovec part{buffer.data(), chunk};
+        WriteAll(out_fd, &part, 1);
+        offset += static_cast<off_t>(chunk);
+        size -= chunk;
+    }
+}
+
+// Хеш FNV-1a: не зависит от реализации стандартной библиотеки, поэтому годится для имён файлов
+uint64_t HashFnv1a(string_view data, uint64_t hash = 14695981039346656037ULL)
+{
+    for (unsigned char c : data)
+    {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+}  // namespace
+
+void OutputBuffer::Advance(size_t count)
+{
+    for (; count > INT_MAX; count -= INT_MAX)
+    {
+        pbump(INT_MAX);
+    }
+    pbump(static_cast<int>(count));
+}
+
+FdOutputBuffer::FdOutputBuffer(int fd, size_t buffer_size)
+    : fd_(fd), buffer_(max(buffer_size, size_t{1}))
+{
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+void FdOutputBuffer::Flush()
+{
+    iovec part{pbase(), static_cast<size_t>(pptr() - pbase())};
+    if (part.iov_len == 0)
+    {
+        return;
+    }
+    WriteAll(fd_, &part, 1);
+    flushed_ += part.iov_len;
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+size_t FdOutputBuffer::BytesWritten() const
+{
+    return flushed_ + static_cast<size_t>(pptr() - pbase());
+}
+
+FdOutputBuffer::int_type FdOutputBuffer::overflow(int_type ch)
+{
+    Flush();
+    if (!traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+streamsize FdOutputBuffer::xsputn(const char* s, streamsize n)
+{
+    const auto size = static_cast<size_t>(n);
+    if (size <= static_cast<size_t>(epptr() - pptr()))
+    {
+        memcpy(pptr(), s, size);
+        Advance(size);
+        return n;
+    }
+
+    // Накопленный вывод и новые данные записываются одним вызовом
+    iovec parts[2] = {{pbase(), static_cast<size_t>(pptr() - pbase())},
+                      {const_cast<char*>(s), size}};  // NOLINT
+    WriteAll(fd_, parts, 2);
+    flushed_ += static_cast<size_t>(pptr() - pbase()) + size;
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+    return n;
+}
+
+int FdOutputBuffer::sync()
+{
+    Flush();
+    return 0;
+}
+
+AsyncOutputBuffer::AsyncOutputBuffer(int fd, size_t buffer_size)
+    : fd_(fd)
+{
+    for (auto& buffer : buffers_)
+    {
+        buffer.resize(max(buffer_size, size_t{1}));
+    }
+    setp(buffers_[filling_].data(), buffers_[filling_].data() + buffers_[filling_].size());
+    writer_ = thread([this] { Write(); });
+}
+
+AsyncOutputBuffer::~AsyncOutputBuffer()
+{
+    try
+    {
+        Flush();
+    }
+    catch (const system_error&)
+    {
+    }
+    {
+        lock_guard lock(mutex_);
+        stopped_ = true;
+    }
+    changed_.notify_all();
+    writer_.join();
+}
+
+void AsyncOutputBuffer::Flush()
+{
+    Submit();
+    unique_lock lock(mutex_);
+    WaitWriter(lock);
+}
+
+size_t AsyncOutputBuffer::BytesWritten() const
+{
+    return submitted_ + static_cast<size_t>(pptr() - pbase());
+}
+
+void AsyncOutputBuffer::Submit()
+{
+    const auto size = static_cast<size_t>(pptr() - pbase());
+    if (size == 0)
+    {
+        return;
+    }
+    {
+        unique_lock lock(mutex_);
+        WaitWriter(lock);
+        pending_data_ = pbase();
+        pending_size_ = size;
+    }
+    changed_.notify_all();
+
+    submitted_ += size;
+    filling_ ^= 1;
+    setp(buffers_[filling_].data(), buffers_[filling_].data() + buffers_[filling_].size());
+}
+
+void AsyncOutputBuffer::WaitWriter(unique_lock<mutex>& lock)
+{
+    changed_.wait(lock, [this] { return pending_size_ == 0; });
+    if (error_)
+    {
+        rethrow_exception(error_);
+    }
+}
+
+void AsyncOutputBuffer::Write()
+{
+    unique_lock lock(mutex_);
+    while (true)
+    {
+        changed_.wait(lock, [this] { return pending_size_ != 0 || stopped_; });
+        if (pending_size_ == 0)
+        {
+            return;
+        }
+
+        iovec part{const_cast<char*>(pending_data_), pending_size_};  // NOLINT
+        lock.unlock();
+        exception_ptr error;
+        try
+        {
+            WriteAll(fd_, &part, 1);
+        }
+        catch (...)
+        {
+            error = current_exception();
+        }
+        lock.lock();
+
+        if (error && !error_)
+        {
+            error_ = error;
+        }
+        pending_data_ = nullptr;
+        pending_size_ = 0;
+        changed_.notify_all();
+    }
+}
+
+AsyncOutputBuffer::int_type AsyncOutputBuffer::overflow(int_type ch)
+{
+    Submit();
+    if (!traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+streamsize AsyncOutputBuffer::xsputn(const char* s, streamsize n)
+{
+    auto rest = static_cast<size_t>(n);
+    while (rest > 0)
+    {
+        if (pptr() == epptr())
+        {
+            Submit();
+        }
+        const size_t size = min(rest, static_cast<size_t>(epptr() - pptr()));
+        memcpy(pptr(), s, size);
+        Advance(size);
+        s += size;
+        rest -= size;
+    }
+    return n;
+}
+
+int AsyncOutputBuffer::sync()
+{
+    Flush();
+    return 0;
+}
+
+MappedOutputBuffer::MappedOutputBuffer(int fd, size_t initial_size)
+    : fd_(fd)
+{
+    Grow(max(initial_size, size_t{1}));
+}
+
+MappedOutputBuffer::~MappedOutputBuffer()
+{
+    const size_t written = BytesWritten();
+    munmap(data_, size_);
+    // Файл обрезается до фактического размера вывода, ошибки здесь сообщить некому
+    [[maybe_unused]] int result = ftruncate(fd_, static_cast<off_t>(written));
+}
+
+void MappedOutputBuffer::Flush()
+{
+    // Данные уже находятся в страничном кэше операционной системы
+}
+
+size_t MappedOutputBuffer::BytesWritten() const
+{
+    return static_cast<size_t>(pptr() - data_);
+}
+
+void MappedOutputBuffer::Grow(size_t min_free)
+{
+    const size_t written = data_ ? BytesWritten() : 0;
+    size_t new_size = max(size_, size_t{1});
+    while (new_size - written < min_free)
+    {
+        new_size *= 2;
+    }
+
+#ifdef __linux__
+    // Место на диске выделяется заранее. Иначе при его нехватке запись в отображение
+    // завершила бы процесс сигналом SIGBUS вместо ошибки записи
+    if (const int error = posix_fallocate(fd_, 0, static_cast<off_t>(new_size)); error != 0)
+    {
+        throw system_error(error, generic_category(), "Can't reserve space for output file");
+    }
+#else
+    if (ftruncate(fd_, static_cast<off_t>(new_size)) != 0)
+    {
+        ThrowSystemError("Can't resize output file");
+    }
+#endif
+    void* data = MAP_FAILED;
+    if (data_)
+    {
+#ifdef __linux__
+        data = mremap(data_, size_, new_size, MREMAP_MAYMOVE);
+#else
+        munmap(data_, size_);
+        data_ = nullptr;
+        data = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+#endif
+    }
+    else
+    {
+        data = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    }
+    if (data == MAP_FAILED)
+    {
+        ThrowSystemError("Can't map output file");
+    }
+
+    data_ = static_cast<char*>(data);
+    size_ = new_size;
+    setp(data_, data_ + size_);
+    Advance(written);
+}
+
+MappedOutputBuffer::int_type MappedOutputBuffer::overflow(int_type ch)
+{
+    Grow(1);
+    if (!traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+streamsize MappedOutputBuffer::xsputn(const char* s, streamsize n)
+{
+    const auto size = static_cast<size_t>(n);
+    if (size > static_cast<size_t>(epptr() - pptr()))
+    {
+        Grow(size);
+    }
+    memcpy(pptr(), s, size);
+    Advance(size);
+    return n;
+}
+
+FileOutputContext::FileOutputContext(const std::filesystem::path& path, OutputOptions options)
+    : FileOutputContext(open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644), true,
+                        options)
+{
+}
+
+FileOutputContext::FileOutputContext(int fd, OutputOptions options)
+    : FileOutputContext(fd, false, options)
+{
+}
+
+FileOutputContext::FileOutputContext(int fd, bool owns_fd, OutputOptions options)
+    : fd_(fd), owns_fd_(owns_fd), output_(nullptr)
+{
+    if (fd_ < 0)
+    {
+        ThrowSystemError("Can't open output file");
+    }
+    try
+    {
+        if (options.memory_mapped && CanMap(fd_))
+        {
+            buffer_ = make_unique<MappedOutputBuffer>(fd_, options.mapped_size);
+        }
+        else if (options.async)
+        {
+            buffer_ = make_unique<AsyncOutputBuffer>(fd_, options.buffer_size);
+        }
+        else
+        {
+            buffer_ = make_unique<FdOutputBuffer>(fd_, options.buffer_size);
+        }
+    }
+    catch (...)
+    {
+        if (owns_fd_)
+        {
+            close(fd_);
+        }
+        throw;
+    }
+    output_.rdbuf(buffer_.get());
+    // Ошибки записи буфера выбрасываются из операций вывода
+    output_.exceptions(ios::badbit);
+}
+
+FileOutputContext::~FileOutputContext()
+{
+    try
+    {
+        buffer_->Flush();
+    }
+    catch (const system_error&)
+    {
+    }
+    buffer_.reset();
+    if (owns_fd_)
+    {
+        close(fd_);
+    }
+}
+
+std::ostream& FileOutputContext::GetOutputStream()
+{
+    return output_;
+}
+
+void FileOutputContext::Flush()
+{
+    buffer_->Flush();
+}
+
+size_t FileOutputContext::BytesWritten() const
+{
+    return buffer_->BytesWritten();
+}
+
+OutputCache::OutputCache(std::filesystem::path directory, std::string_view variant)
+    : directory_(move(directory)), variant_(variant)
+{
+    std::filesystem::create_directories(directory_);
+}
+
+bool OutputCache::Load(std::string_view source, const std::filesystem::path& output) const
+{
+    const string header = MakeHeader(source);
+    FileDescriptor entry(open(EntryPath(header, source).c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat info{};
+    if (entry.Get() < 0 || fstat(entry.Get(), &info) != 0)
+    {
+        return false;
+    }
+    const size_t prefix_size = header.size() + source.size();
+    if (static_cast<size_t>(info.st_size) < prefix_size)
+    {
+        return false;
+    }
+    string prefix(prefix_size, '\0');
+    if (!ReadAt(entry.Get(), prefix.data(), prefix.size(), 0)
+        || string_view(prefix).substr(0, header.size()) != header
+        || string_view(prefix).substr(header.size()) != source)
+    {
+        return false;
+    }
+
+    FileDescriptor out(open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (out.Get() < 0)
+    {
+        ThrowSystemError("Can't open output file");
+    }
+    CopyRange(entry.Get(), static_cast<off_t>(prefix_size), out.Get(),
+              static_cast<size_t>(info.st_size) - prefix_size);
+    return true;
+}
+
+bool OutputCache::Store(std::string_view source, const std::filesystem::path& output) const
+{
+    FileDescriptor in(open(output.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat info{};
+    if (in.Get() < 0 || fstat(in.Get(), &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        return false;
+    }
+
+    const string header = MakeHeader(source);
+    string temp_path = (directory_ / "tmp-XXXXXX"s).string();
+    FileDescriptor temp(mkstemp(temp_path.data()));
+    if (temp.Get() < 0)
+    {
+        return false;
+    }
+    try
+    {
+        iovec parts[2] = {{const_cast<char*>(header.data()), header.size()},  // NOLINT
+                          {const_cast<char*>(source.data()), source.size()}};  // NOLINT
+        WriteAll(temp.Get(), parts, 2);
+        CopyRange(in.Get(), 0, temp.Get(), static_cast<size_t>(info.st_size));
+    }
+    catch (const system_error&)
+    {
+        unlink(temp_path.c_str());
+        return false;
+    }
+    // Переименование атомарно: другие процессы видят либо старую запись, либо новую целиком
+    if (rename(temp_path.c_str(), EntryPath(header, source).c_str()) != 0)
+    {
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+string OutputCache::MakeHeader(std::string_view source) const
+{
+    string header = "Mython output cache\n"s;
+    header.append(MYTHON_VERSION).append("\n"sv);
+    header.append(variant_).append("\n"sv);
+    header.append(to_string(source.size())).append("\n"sv);
+    return header;
+}
+
+std::filesystem::path OutputCache::EntryPath(std::string_view header, std::string_view source) const
+{
+    array<char, 16> name{};
+    const uint64_t hash = HashFnv1a(source, HashFnv1a(header));
+    const auto result = to_chars(name.data(), name.data() + name.size(), hash, 16);
+    return directory_ / string(name.data(), result.ptr);
+}
+
+}  // namespace runtime
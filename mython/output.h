@@ -0,0 +1,222 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace runtime
+{
+
+// Настройки вывода программы в файл
+struct OutputOptions
+{
+    // Размер буфера, который накапливает вывод перед записью в файл
+    size_t buffer_size = 1 << 20;
+    // Писать вывод прямо в отображённый в память файл. Если файл нельзя отобразить
+    // в память (например, это канал), вывод записывается через буфер.
+    // Файл прерванного запуска может остаться дополненным нулями до mapped_size
+    bool memory_mapped = false;
+    // Начальный размер отображённого в память файла. При нехватке места размер удваивается
+    size_t mapped_size = 64 << 20;
+    // Записывать вывод в файл в отдельном потоке, пока программа заполняет второй буфер.
+    // Не применяется к отображённому в память файлу
+    bool async = false;
+};
+
+// Буфер потока вывода в файловый дескриптор. Ошибки записи выбрасываются как
+// std::system_error
+class OutputBuffer : public std::streambuf
+{
+public:
+    // Передаёт операционной системе весь накопленный вывод
+    virtual void Flush() = 0;
+
+    // Возвращает количество байт, выведенных в буфер, включая ещё не записанные в файл
+    [[nodiscard]] virtual size_t BytesWritten() const = 0;
+
+protected:
+    // Сдвигает позицию записи на count байт. В отличие от pbump, count может превышать INT_MAX
+    void Advance(size_t count);
+};
+
+// Буфер, который записывает накопленный вывод вызовами write и writev.
+// Данные, которые не помещаются в буфер, записываются сразу, без копирования
+class FdOutputBuffer : public OutputBuffer
+{
+public:
+    FdOutputBuffer(int fd, size_t buffer_size);
+
+    void Flush() override;
+    [[nodiscard]] size_t BytesWritten() const override;
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int sync() override;
+
+private:
+    int fd_;
+    std::vector<char> buffer_;
+    size_t flushed_ = 0;
+};
+
+// Буфер с двумя половинами: пока программа заполняет одну, отдельный поток записывает
+// в файл другую. Программа ждёт записи, только если поток не успел освободить вторую половину.
+// Ошибка записи выбрасывается из следующей операции, которая передаёт данные потоку записи
+class AsyncOutputBuffer : public OutputBuffer
+{
+public:
+    // Каждая из двух половин буфера имеет размер buffer_size
+    AsyncOutputBuffer(int fd, size_t buffer_size);
+
+    AsyncOutputBuffer(const AsyncOutputBuffer&) = delete;
+    AsyncOutputBuffer& operator=(const AsyncOutputBuffer&) = delete;
+
+    // Дописывает оставшийся вывод и останавливает поток записи
+    ~AsyncOutputBuffer() override;
+
+    // Передаёт потоку записи накопленный вывод и дожидается, пока он будет записан
+    void Flush() override;
+    [[nodiscard]] size_t BytesWritten() const override;
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int sync() override;
+
+private:
+    // Передаёт заполненную половину буфера потоку записи и начинает заполнять другую
+    void Submit();
+    // Дожидается, пока поток записи запишет переданные ему данные.
+    // Выбрасывает ошибку записи, если она произошла
+    void WaitWriter(std::unique_lock<std::mutex>& lock);
+    void Write();
+
+    int fd_;
+    std::array<std::vector<char>, 2> buffers_;
+    // Номер половины буфера, которую заполняет программа
+    size_t filling_ = 0;
+    // Количество байт, переданных потоку записи
+    size_t submitted_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    // Данные, которые поток записи должен записать. Пусто, если поток свободен
+    const char* pending_data_ = nullptr;
+    size_t pending_size_ = 0;
+    bool stopped_ = false;
+    std::exception_ptr error_;
+    std::thread writer_;
+};
+
+// Буфер, который пишет вывод прямо в отображённую в память область файла.
+// При нехватке места файл и отображение увеличиваются, а при завершении вывода
+// файл обрезается до фактического размера вывода. Место на диске выделяется при увеличении
+// файла, и его нехватка выбрасывается как ошибка записи. Если процесс завершился аварийно
+// и деструктор не выполнился, файл остаётся дополненным нулями до размера отображения
+class MappedOutputBuffer : public OutputBuffer
+{
+public:
+    // Файл fd должен быть обычным файлом, открытым на чтение и запись
+    MappedOutputBuffer(int fd, size_t initial_size);
+
+    MappedOutputBuffer(const MappedOutputBuffer&) = delete;
+    MappedOutputBuffer& operator=(const MappedOutputBuffer&) = delete;
+
+    ~MappedOutputBuffer() override;
+
+    void Flush() override;
+    [[nodiscard]] size_t BytesWritten() const override;
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+private:
+    // Увеличивает отображение так, чтобы в нём помещалось ещё не меньше min_free байт
+    void Grow(size_t min_free);
+
+    int fd_;
+    char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Контекст, который выводит результат программы в файл через большой буфер,
+// минуя форматирование и буферизацию стандартных потоков
+class FileOutputContext : public Context
+{
+public:
+    // Создаёт файл path или очищает существующий. Выбрасывает std::system_error,
+    // если файл не удалось открыть
+    explicit FileOutputContext(const std::filesystem::path& path, OutputOptions options = {});
+    // Выводит в уже открытый дескриптор fd, не закрывая его
+    explicit FileOutputContext(int fd, OutputOptions options = {});
+
+    FileOutputContext(const FileOutputContext&) = delete;
+    FileOutputContext& operator=(const FileOutputContext&) = delete;
+
+    // Записывает оставшийся вывод. Ошибки записи при этом не сообщаются,
+    // поэтому перед разрушением следует вызвать Flush
+    ~FileOutputContext();
+
+    std::ostream& GetOutputStream() override;
+
+    // Передаёт операционной системе весь накопленный вывод.
+    // Выбрасывает std::system_error при ошибке записи
+    void Flush();
+
+    // Возвращает количество байт, выведенных программой
+    [[nodiscard]] size_t BytesWritten() const;
+
+private:
+    FileOutputContext(int fd, bool owns_fd, OutputOptions options);
+
+    int fd_;
+    bool owns_fd_;
+    std::unique_ptr<OutputBuffer> buffer_;
+    std::ostream output_;
+};
+
+// Кэш вывода программ в каталоге на диске. Вывод программы, которая не выводит адреса
+// объектов, зависит только от её текста, поэтому его можно не вычислять повторно.
+// Имя записи кэша - хеш текста программы и версии интерпретатора. Запись хранит и сам текст,
+// поэтому при совпадении хешей разных программ чужой вывод не выдаётся
+class OutputCache
+{
+public:
+    // Создаёт каталог directory, если его нет. Записи с разными variant не смешиваются:
+    // так разделяются запуски с настройками, которые влияют на результат программы
+    explicit OutputCache(std::filesystem::path directory, std::string_view variant = {});
+
+    // Если в кэше есть вывод программы source, копирует его в файл output и возвращает true.
+    // Выбрасывает std::system_error, если не удалось записать файл output
+    bool Load(std::string_view source, const std::filesystem::path& output) const;
+
+    // Сохраняет содержимое файла output как вывод программы source. Возвращает false,
+    // если output не обычный файл или запись не удалось сохранить. Запись появляется
+    // в кэше целиком, поэтому кэш можно одновременно использовать из нескольких процессов
+    bool Store(std::string_view source, const std::filesystem::path& output) const;
+
+private:
+    // Возвращает начало записи для программы source: всё, что предшествует выводу
+    [[nodiscard]] std::string MakeHeader(std::string_view source) const;
+    [[nodiscard]] std::filesystem::path EntryPath(std::string_view header,
+                                                  std::string_view source) const;
+
+    std::filesystem::path directory_;
+    std::string variant_;
+};
+
+}  // namespace runtime
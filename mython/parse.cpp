@@ -2,6 +2,17 @@
 
 #include "lexer.h"
 #include "statement.h"
+#include "thread_pool.h"
+
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <istream>
+#include <limits>
+#include <mutex>
+#include <streambuf>
+#include <unordered_map>
+#include <utility>
 
 using namespace std;
 
@@ -17,35 +28,610 @@ bool operator!=(const parse::Token& token, char c) {
     return !(token == c);
 }
 
+// Приоритеты операций выражения, от низшего к высшему
+enum Precedence : int {
+    LOWEST,
+    OR,
+    AND,
+    NOT,
+    COMPARISON,
+    SUM,
+    PRODUCT,
+    UNARY,
+};
+
+// Бинарная операция выражения
+struct BinaryOperator {
+    int precedence;
+    // Можно ли записывать операции этого приоритета цепочкой: a + b - c
+    bool chainable;
+    unique_ptr<ast::Statement> (*make)(unique_ptr<ast::Statement>, unique_ptr<ast::Statement>);
+};
+
+template <typename Operation>
+unique_ptr<ast::Statement> MakeBinary(unique_ptr<ast::Statement> lhs,
+                                      unique_ptr<ast::Statement> rhs) {
+    return make_unique<Operation>(std::move(lhs), std::move(rhs));
+}
+
+template <bool (*Comparator)(const runtime::ObjectHolder&, const runtime::ObjectHolder&,
+                             runtime::Context&)>
+unique_ptr<ast::Statement> MakeComparison(unique_ptr<ast::Statement> lhs,
+                                          unique_ptr<ast::Statement> rhs) {
+    return make_unique<ast::Comparison>(Comparator, std::move(lhs), std::move(rhs));
+}
+
+// Таблица бинарных операций. Операции-символы ищутся по коду символа,
+// остальные - по типу лексемы
+class BinaryOperatorTable {
+public:
+    BinaryOperatorTable() {
+        Add(TokenType::Or{}, {Precedence::OR, true, MakeBinary<ast::Or>});
+        Add(TokenType::And{}, {Precedence::AND, true, MakeBinary<ast::And>});
+        Add('<', {Precedence::COMPARISON, false, MakeComparison<runtime::Less>});
+        Add('>', {Precedence::COMPARISON, false, MakeComparison<runtime::Greater>});
+        Add(TokenType::Eq{}, {Precedence::COMPARISON, false, MakeComparison<runtime::Equal>});
+        Add(TokenType::NotEq{},
+            {Precedence::COMPARISON, false, MakeComparison<runtime::NotEqual>});
+        Add(TokenType::LessOrEq{},
+            {Precedence::COMPARISON, false, MakeComparison<runtime::LessOrEqual>});
+        Add(TokenType::GreaterOrEq{},
+            {Precedence::COMPARISON, false, MakeComparison<runtime::GreaterOrEqual>});
+        Add('+', {Precedence::SUM, true, MakeBinary<ast::Add>});
+        Add('-', {Precedence::SUM, true, MakeBinary<ast::Sub>});
+        Add('*', {Precedence::PRODUCT, true, MakeBinary<ast::Mult>});
+        Add('/', {Precedence::PRODUCT, true, MakeBinary<ast::Div>});
+    }
+
+    // Возвращает описание бинарной операции, которой соответствует лексема token,
+    // или nullptr, если лексема не является бинарной операцией
+    [[nodiscard]] const BinaryOperator* Find(const parse::Token& token) const {
+        const BinaryOperator* op = nullptr;
+        if (const auto* c = token.TryAs<TokenType::Char>()) {
+            op = &by_char_[static_cast<unsigned char>(c->value)];
+        } else {
+            op = &by_token_type_[token.index()];
+        }
+        return op->make != nullptr ? op : nullptr;
+    }
+
+private:
+    void Add(const parse::Token& token, BinaryOperator op) {
+        by_token_type_[token.index()] = op;
+    }
+
+    void Add(char c, BinaryOperator op) {
+        by_char_[static_cast<unsigned char>(c)] = op;
+    }
+
+    array<BinaryOperator, variant_size_v<parse::TokenBase>> by_token_type_{};
+    array<BinaryOperator, 256> by_char_{};
+};
+
+const BinaryOperatorTable BINARY_OPERATORS;
+
+const BinaryOperator* FindBinaryOperator(const parse::Token& token) {
+    return BINARY_OPERATORS.Find(token);
+}
+
+// Классы, объявленные в части программы, в порядке объявления.
+// Классы предыдущих частей программы доступны через область previous
+class ClassScope {
+public:
+    // Запоминает класс cls. Выбрасывает ParseError, если класс с таким именем уже объявлен
+    void Declare(const runtime::Class& cls) {
+        if (!indices_.emplace(cls.GetName(), classes_.size()).second) {
+            throw ParseError("Class "s + cls.GetName() + " already exists"s);
+        }
+        classes_.push_back(&cls);
+    }
+
+    // Возвращает класс с именем name, если он был среди первых visible классов этой области
+    // либо объявлен в предыдущих частях программы. Иначе возвращает nullptr
+    [[nodiscard]] const runtime::Class* Find(const string& name, size_t visible) const {
+        if (auto it = indices_.find(name); it != indices_.end() && it->second < visible) {
+            return classes_[it->second];
+        }
+        return previous_ ? previous_->Find(name, previous_visible_) : nullptr;
+    }
+
+    [[nodiscard]] size_t Size() const {
+        return classes_.size();
+    }
+
+    [[nodiscard]] const vector<const runtime::Class*>& Classes() const {
+        return classes_;
+    }
+
+    // Присоединяет область к классам предыдущих частей программы: к первым previous_visible
+    // классам области previous. Выбрасывает ParseError, если какой-то класс уже объявлен
+    // в предыдущих частях
+    void Link(shared_ptr<const ClassScope> previous,
+              size_t previous_visible = numeric_limits<size_t>::max()) {
+        if (previous) {
+            for (const runtime::Class* cls : classes_) {
+                if (previous->Find(cls->GetName(), previous_visible)) {
+                    throw ParseError("Class "s + cls->GetName() + " already exists"s);
+                }
+            }
+        }
+        previous_ = std::move(previous);
+        previous_visible_ = previous_visible;
+    }
+
+private:
+    unordered_map<string, size_t> indices_;
+    vector<const runtime::Class*> classes_;
+    shared_ptr<const ClassScope> previous_;
+    size_t previous_visible_ = numeric_limits<size_t>::max();
+};
+
+// Проверяет, что name - встроенная функция, которая принимает arg_count аргументов.
+// Иначе выбрасывает ParseError
+void CheckFunctionCall(const string& name, size_t arg_count) {
+    if (name == "str"sv) {
+        if (arg_count != 1) {
+            throw ParseError("Function str takes exactly one argument"s);
+        }
+        return;
+    }
+    throw ParseError("Unknown call to "s + name + "()"s);
+}
+
+// Создаёт вызов встроенной функции name. Выбрасывает ParseError, если такой функции нет
+unique_ptr<ast::Statement> MakeFunctionCall(const string& name,
+                                            vector<unique_ptr<ast::Statement>> args) {
+    CheckFunctionCall(name, args.size());
+    return make_unique<ast::Stringify>(std::move(args.front()));
+}
+
+// Ссылка на инструкцию, которой владеет другой узел дерева
+class StatementRef : public runtime::Executable {
+public:
+    explicit StatementRef(runtime::Executable& statement)
+        : statement_(statement) {
+    }
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override {
+        return statement_.Execute(closure, context);
+    }
+
+private:
+    runtime::Executable& statement_;
+};
+
+// Вызов name(args), где name не объявлен в разбираемой части программы.
+// После разбора всех частей становится созданием экземпляра класса name,
+// объявленного в предыдущих частях, либо вызовом встроенной функции
+class DeferredCall : public runtime::Executable {
+public:
+    DeferredCall(string name, vector<unique_ptr<ast::Statement>> args)
+        : name_(std::move(name))
+        , args_(std::move(args)) {
+    }
+
+    // Выбирает, что вызывать, по первым visible классам предыдущих частей программы previous.
+    // Вызов можно разрешить повторно, если предыдущие части программы изменились.
+    // Выбрасывает ParseError, если вызов не удалось разрешить
+    void Resolve(const ClassScope* previous, size_t visible = numeric_limits<size_t>::max()) {
+        vector<unique_ptr<ast::Statement>> args;
+        args.reserve(args_.size());
+        for (const auto& arg : args_) {
+            args.push_back(make_unique<StatementRef>(*arg));
+        }
+
+        const runtime::Class* cls = previous ? previous->Find(name_, visible) : nullptr;
+        if (cls) {
+            resolved_ = make_unique<ast::NewInstance>(*cls, std::move(args));
+        } else {
+            resolved_ = MakeFunctionCall(name_, std::move(args));
+        }
+    }
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override {
+        return resolved_->Execute(closure, context);
+    }
+
+private:
+    string name_;
+    vector<unique_ptr<ast::Statement>> args_;
+    unique_ptr<ast::Statement> resolved_;
+};
+
+class LazyMethodBody;
+
+// Ссылки на классы из предыдущих частей программы, которые разрешаются после разбора
+struct DeferredReferences {
+    // Классы, базовый класс которых объявлен в предыдущих частях, и имена базовых классов
+    vector<pair<runtime::Class*, string>> bases;
+    // Классы, базовый класс которых объявлен в этой же части. Их специальные методы
+    // определяются заново, когда базовые классы получат родителей из предыдущих частей
+    vector<pair<runtime::Class*, const runtime::Class*>> local_bases;
+    vector<DeferredCall*> calls;
+    // Отложенные тела методов. Они ищут классы в предыдущих частях при разборе,
+    // поэтому после изменения этих частей их нужно разобрать заново
+    vector<LazyMethodBody*> lazy_bodies;
+    // Вызовы name(...) в отложенных телах методов, где name не объявлен в разбираемой части,
+    // и число их аргументов. После разбора всех частей проверяется, что name - класс
+    // из предыдущих частей или встроенная функция
+    vector<pair<string, size_t>> lazy_calls;
+};
+
+// Строит для Parser узлы синтаксического дерева
+struct TreeBuilder {
+    using Node = unique_ptr<ast::Statement>;
+    using NodeList = vector<Node>;
+    using Body = unique_ptr<runtime::Executable>;
+    // Имена DottedIds
+    using Names = vector<string>;
+
+    static unique_ptr<ast::Compound> MakeCompound() {
+        return make_unique<ast::Compound>();
+    }
+
+    static void AddStatement(unique_ptr<ast::Compound>& compound, Node statement) {
+        compound->AddStatement(std::move(statement));
+    }
+
+    static void Append(NodeList& list, Node node) {
+        list.push_back(std::move(node));
+    }
+
+    static void AddName(Names& names, const string& name) {
+        names.push_back(name);
+    }
+
+    static size_t Count(const Names& names) {
+        return names.size();
+    }
+
+    static const string& Last(const Names& names) {
+        return names.back();
+    }
+
+    static Body MethodBody(Node body) {
+        return make_unique<ast::MethodBody>(std::move(body));
+    }
+
+    static Node Assignment(Names names, Node value) {
+        string last_name = std::move(names.back());
+        names.pop_back();
+        if (names.empty()) {
+            return make_unique<ast::Assignment>(std::move(last_name), std::move(value));
+        }
+        return make_unique<ast::FieldAssignment>(ast::VariableValue{std::move(names)},
+                                                 std::move(last_name), std::move(value));
+    }
+
+    static Node MethodCall(Names names, NodeList args) {
+        string method_name = std::move(names.back());
+        names.pop_back();
+        return make_unique<ast::MethodCall>(make_unique<ast::VariableValue>(std::move(names)),
+                                            std::move(method_name), std::move(args));
+    }
+
+    static Node NewInstance(const runtime::Class& cls, NodeList args) {
+        return make_unique<ast::NewInstance>(cls, std::move(args));
+    }
+
+    // Вызов name(args), где name - не класс. Если задан deferred, вызов разрешается
+    // после разбора всех частей программы
+    static Node FunctionCall(const string& name, NodeList args, DeferredReferences* deferred) {
+        if (deferred) {
+            auto call = make_unique<DeferredCall>(name, std::move(args));
+            deferred->calls.push_back(call.get());
+            return call;
+        }
+        return MakeFunctionCall(name, std::move(args));
+    }
+
+    static Node Variable(Names names) {
+        return make_unique<ast::VariableValue>(std::move(names));
+    }
+
+    static Node Number(int value) {
+        return make_unique<ast::NumericConst>(value);
+    }
+
+    static Node String(const string& value) {
+        return make_unique<ast::StringConst>(value);
+    }
+
+    static Node Bool(bool value) {
+        return make_unique<ast::BoolConst>(runtime::Bool(value));
+    }
+
+    static Node None() {
+        return make_unique<ast::None>();
+    }
+
+    static Node Not(Node operand) {
+        return make_unique<ast::Not>(std::move(operand));
+    }
+
+    static Node Negate(Node operand) {
+        return make_unique<ast::Mult>(std::move(operand), make_unique<ast::NumericConst>(-1));
+    }
+
+    static Node Binary(const BinaryOperator& op, Node lhs, Node rhs) {
+        return op.make(std::move(lhs), std::move(rhs));
+    }
+
+    static Node IfElse(Node condition, Node if_body, Node else_body) {
+        return make_unique<ast::IfElse>(std::move(condition), std::move(if_body),
+                                        std::move(else_body));
+    }
+
+    static Node Return(Node value) {
+        return make_unique<ast::Return>(std::move(value));
+    }
+
+    static Node Print(NodeList args) {
+        return make_unique<ast::Print>(std::move(args));
+    }
+};
+
+// Ничего не строит: Parser с ним только проверяет синтаксис и находит те же ошибки,
+// что и при построении дерева. Объявления классов с ним не разбираются
+struct SyntaxChecker {
+    struct Node {};
+    // Количество узлов
+    using NodeList = size_t;
+    using Body = Node;
+
+    struct Names {
+        size_t count = 0;
+        string last;
+    };
+
+    static Node MakeCompound() {
+        return {};
+    }
+
+    static void AddStatement(Node&, Node) {
+    }
+
+    static void Append(NodeList& list, Node) {
+        ++list;
+    }
+
+    static void AddName(Names& names, const string& name) {
+        ++names.count;
+        names.last = name;
+    }
+
+    static size_t Count(const Names& names) {
+        return names.count;
+    }
+
+    static const string& Last(const Names& names) {
+        return names.last;
+    }
+
+    static Body MethodBody(Node) {
+        return {};
+    }
+
+    static Node Assignment(const Names&, Node) {
+        return {};
+    }
+
+    static Node MethodCall(const Names&, NodeList) {
+        return {};
+    }
+
+    static Node NewInstance(const runtime::Class&, NodeList) {
+        return {};
+    }
+
+    // Если задан deferred, вызов проверяется после разбора всех частей программы
+    static Node FunctionCall(const string& name, NodeList args, DeferredReferences* deferred) {
+        if (deferred) {
+            deferred->lazy_calls.emplace_back(name, args);
+        } else {
+            CheckFunctionCall(name, args);
+        }
+        return {};
+    }
+
+    static Node Variable(const Names&) {
+        return {};
+    }
+
+    static Node Number(int) {
+        return {};
+    }
+
+    static Node String(const string&) {
+        return {};
+    }
+
+    static Node Bool(bool) {
+        return {};
+    }
+
+    static Node None() {
+        return {};
+    }
+
+    static Node Not(Node) {
+        return {};
+    }
+
+    static Node Negate(Node) {
+        return {};
+    }
+
+    static Node Binary(const BinaryOperator&, Node, Node) {
+        return {};
+    }
+
+    static Node IfElse(Node, Node, Node) {
+        return {};
+    }
+
+    static Node Return(Node) {
+        return {};
+    }
+
+    static Node Print(NodeList) {
+        return {};
+    }
+};
+
+// Поток лексем, воспроизводящий запомненную последовательность без её копирования.
+// Последовательность должна существовать, пока поток используется
+class RecordedTokens : public parse::TokenStream {
+public:
+    explicit RecordedTokens(const vector<parse::Token>& tokens)
+        : tokens_(tokens) {
+        ParseNextToken();
+    }
+
+private:
+    void ParseNextToken() override {
+        if (next_token_ < tokens_.size()) {
+            current_token_ = tokens_[next_token_++];
+        } else {
+            current_token_ = TokenType::Eof();
+        }
+    }
+
+    const vector<parse::Token>& tokens_;
+    size_t next_token_ = 0;
+};
+
+// Тело метода, синтаксическое дерево которого строится при первом вызове метода.
+// Имена классов в теле ищутся только среди классов, объявленных до метода.
+// Метод можно вызывать одновременно из нескольких потоков: дерево строит первый из них
+class LazyMethodBody : public runtime::Executable {
+public:
+    // Если reparsable равен true, лексемы тела сохраняются и после разбора, чтобы тело
+    // можно было разобрать заново методом Reset
+    LazyMethodBody(vector<parse::Token> tokens, ParseOptions options,
+                   shared_ptr<ClassScope> classes, size_t visible_classes, bool reparsable)
+        : tokens_(std::move(tokens))
+        , options_(options)
+        , classes_(std::move(classes))
+        , visible_classes_(visible_classes)
+        , reparsable_(reparsable) {
+    }
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+    // Отбрасывает построенное дерево тела, при следующем вызове тело будет разобрано заново.
+    // Нельзя вызывать одновременно с выполнением тела
+    void Reset() {
+        parsed_body_.store(nullptr, memory_order_relaxed);
+        body_.reset();
+    }
+
+private:
+    runtime::Executable& GetBody();
+
+    vector<parse::Token> tokens_;
+    ParseOptions options_;
+    shared_ptr<ClassScope> classes_;
+    size_t visible_classes_;
+    bool reparsable_;
+    mutex parse_mutex_;
+    unique_ptr<runtime::Executable> body_;
+    // Построенное дерево тела. Позволяет не захватывать мьютекс после разбора
+    atomic<runtime::Executable*> parsed_body_ = nullptr;
+};
+
+// Разбирает программу и строит её узлы с помощью Builder: TreeBuilder строит
+// синтаксическое дерево, а SyntaxChecker только проверяет синтаксис
+template <typename Builder>
 class Parser {
+    using Node = typename Builder::Node;
+    using NodeList = typename Builder::NodeList;
+    using Names = typename Builder::Names;
+
 public:
-    explicit Parser(parse::Lexer& lexer)
-        : lexer_(lexer) {
+    // Если задан deferred, имена классов, не найденные в classes, не считаются ошибкой:
+    // ссылки на них запоминаются в deferred и разрешаются после разбора всех частей программы
+    Parser(parse::TokenStream& lexer, ParseOptions options,
+           shared_ptr<ClassScope> classes = make_shared<ClassScope>(),
+           size_t visible_classes = numeric_limits<size_t>::max(),
+           DeferredReferences* deferred = nullptr)
+        : lexer_(lexer)
+        , options_(options)
+        , classes_(std::move(classes))
+        , visible_classes_(visible_classes)
+        , deferred_(deferred) {
     }
 
     // Program -> eps
     //          | Statement \n Program
-    unique_ptr<ast::Statement> ParseProgram() {
-        auto result = make_unique<ast::Compound>();
+    Node ParseProgram() {
+        auto result = Builder::MakeCompound();
         while (!lexer_.CurrentToken().Is<TokenType::Eof>()) {
-            result->AddStatement(ParseStatement());
+            Builder::AddStatement(result, ParseStatement());
         }
 
         return result;
     }
 
+    // MethodBody -> Suite
+    typename Builder::Body ParseMethodBody() {
+        return Builder::MethodBody(ParseSuite());
+    }
+
 private:
+    // Лексемы блока Suite, запомненные без разбора
+    struct RecordedSuite {
+        vector<parse::Token> tokens;
+        // Содержит ли блок объявление класса
+        bool has_class = false;
+    };
+
     // Suite -> NEWLINE INDENT (Statement)+ DEDENT
-    unique_ptr<ast::Statement> ParseSuite()  // NOLINT
+    // Запоминает лексемы блока, проверяя баланс отступов и скобок. Синтаксис блока
+    // проверяет разбор с SyntaxChecker
+    RecordedSuite RecordSuite() {
+        lexer_.Expect<TokenType::Newline>();
+        RecordedSuite result;
+        result.tokens.push_back(lexer_.CurrentToken());
+        lexer_.ExpectNext<TokenType::Indent>();
+
+        int indent = 0;
+        int parentheses = 0;
+        do {
+            const auto& tok = lexer_.CurrentToken();
+            if (tok.Is<TokenType::Indent>()) {
+                ++indent;
+            } else if (tok.Is<TokenType::Dedent>()) {
+                --indent;
+            } else if (tok.Is<TokenType::Class>()) {
+                result.has_class = true;
+            } else if (tok == '(') {
+                ++parentheses;
+            } else if (tok == ')' && --parentheses < 0) {
+                throw ParseError("Unbalanced parentheses in method body"s);
+            } else if (tok.Is<TokenType::Newline>() && parentheses != 0) {
+                throw ParseError("Unbalanced parentheses in method body"s);
+            } else if (tok.Is<TokenType::Eof>()) {
+                throw ParseError("Unexpected end of method body"s);
+            }
+            result.tokens.push_back(tok);
+            lexer_.NextToken();
+        } while (indent > 0);
+
+        return result;
+    }
+
+    // Suite -> NEWLINE INDENT (Statement)+ DEDENT
+    Node ParseSuite()  // NOLINT
     {
         lexer_.Expect<TokenType::Newline>();
         lexer_.ExpectNext<TokenType::Indent>();
 
         lexer_.NextToken();
 
-        auto result = make_unique<ast::Compound>();
+        auto result = Builder::MakeCompound();
         while (!lexer_.CurrentToken().Is<TokenType::Dedent>()) {
-            result->AddStatement(ParseStatement());  // NOLINT
+            Builder::AddStatement(result, ParseStatement());  // NOLINT
         }
 
         lexer_.Expect<TokenType::Dedent>();
@@ -76,13 +662,44 @@ private:
             lexer_.ExpectNext<TokenType::Char>(':');
             lexer_.NextToken();
 
-            m.body = std::make_unique<ast::MethodBody>(ParseSuite());  // NOLINT
+            if (options_.lazy_method_bodies) {
+                m.body = ParseLazyMethodBody();
+            } else {
+                m.body = ParseMethodBody();  // NOLINT
+            }
 
             result.push_back(std::move(m));
         }
         return result;
     }
 
+    // Синтаксис тела проверяется сразу, а дерево тела строится при первом вызове.
+    // Если в теле объявляется класс, тело разбирается сразу, чтобы класс был объявлен
+    // в том же порядке, что и без отложенного разбора
+    unique_ptr<runtime::Executable> ParseLazyMethodBody() {
+        RecordedSuite suite = RecordSuite();
+        if (suite.has_class) {
+            parse::TokenReplay tokens(std::move(suite.tokens));
+            return Parser(tokens, options_, classes_, visible_classes_, deferred_)
+                .ParseMethodBody();
+        }
+        RecordedTokens tokens(suite.tokens);
+        Parser<SyntaxChecker>(tokens, options_, classes_, visible_classes_, deferred_)
+            .ParseMethodBody();
+        auto body = make_unique<LazyMethodBody>(std::move(suite.tokens), options_, classes_,
+                                                min(visible_classes_, classes_->Size()),
+                                                deferred_ != nullptr);
+        if (deferred_) {
+            deferred_->lazy_bodies.push_back(body.get());
+        }
+        return body;
+    }
+
+    // Возвращает класс с именем name, объявленный до текущей инструкции, или nullptr
+    [[nodiscard]] const runtime::Class* FindClass(const string& name) const {
+        return classes_->Find(name, visible_classes_);
+    }
+
     // ClassDefinition -> Id ['(' Id ')'] : new_line indent MethodList dedent
     unique_ptr<ast::Statement> ParseClassDefinition()  // NOLINT
     {
@@ -91,16 +708,20 @@ private:
         lexer_.NextToken();
 
         const runtime::Class* base_class = nullptr;
+        string deferred_base_name;
         if (lexer_.CurrentToken() == '(') {
             auto name = lexer_.ExpectNext<TokenType::Id>().value;
             lexer_.ExpectNext<TokenType::Char>(')');
             lexer_.NextToken();
 
-            auto it = declared_classes_.find(name);
-            if (it == declared_classes_.end()) {
-                throw ParseError("Base class "s + name + " not found for class "s + class_name);
+            base_class = FindClass(name);
+            if (base_class == nullptr) {
+                if (!deferred_) {
+                    throw ParseError("Base class "s + name + " not found for class "s +
+                                     class_name);
+                }
+                deferred_base_name = std::move(name);
             }
-            base_class = static_cast<const runtime::Class*>(it->second.Get());  // NOLINT
         }
 
         lexer_.Expect<TokenType::Char>(':');
@@ -112,23 +733,25 @@ private:
         lexer_.Expect<TokenType::Dedent>();
         lexer_.NextToken();
 
-        auto [it, inserted] = declared_classes_.insert({
-            class_name,
-            runtime::ObjectHolder::Own(runtime::Class(class_name, std::move(methods), base_class)),
-        });
-
-        if (!inserted) {
-            throw ParseError("Class "s + class_name + " already exists"s);
+        auto cls =
+            runtime::ObjectHolder::Own(runtime::Class(class_name, std::move(methods), base_class));
+        auto& declared = static_cast<runtime::Class&>(*cls);  // NOLINT
+        classes_->Declare(declared);
+        if (!deferred_base_name.empty()) {
+            deferred_->bases.emplace_back(&declared, std::move(deferred_base_name));
+        } else if (base_class && deferred_) {
+            deferred_->local_bases.emplace_back(&declared, base_class);
         }
 
-        return make_unique<ast::ClassDefinition>(it->second);
+        return make_unique<ast::ClassDefinition>(std::move(cls));
     }
 
-    vector<string> ParseDottedIds() {
-        vector<string> result(1, lexer_.Expect<TokenType::Id>().value);
+    Names ParseDottedIds() {
+        Names result;
+        Builder::AddName(result, lexer_.Expect<TokenType::Id>().value);
 
         while (lexer_.NextToken() == '.') {
-            result.push_back(lexer_.ExpectNext<TokenType::Id>().value);
+            Builder::AddName(result, lexer_.ExpectNext<TokenType::Id>().value);
         }
 
         return result;
@@ -136,171 +759,125 @@ private:
 
     //  AssgnOrCall -> DottedIds = Expr
     //               | DottedIds '(' ExprList ')'
-    unique_ptr<ast::Statement> ParseAssignmentOrCall() {
+    Node ParseAssignmentOrCall() {
         lexer_.Expect<TokenType::Id>();
 
-        vector<string> id_list = ParseDottedIds();
-        string last_name = id_list.back();
-        id_list.pop_back();
+        Names id_list = ParseDottedIds();
 
         if (lexer_.CurrentToken() == '=') {
             lexer_.NextToken();
-
-            if (id_list.empty()) {
-                return make_unique<ast::Assignment>(std::move(last_name), ParseTest());
-            }
-            return make_unique<ast::FieldAssignment>(ast::VariableValue{std::move(id_list)},
-                                                     std::move(last_name), ParseTest());
+            return Builder::Assignment(std::move(id_list), ParseTest());
         }
         lexer_.Expect<TokenType::Char>('(');
         lexer_.NextToken();
 
-        if (id_list.empty()) {
-            throw ParseError("Mython doesn't support functions, only methods: "s + last_name);
+        if (Builder::Count(id_list) == 1) {
+            throw ParseError("Mython doesn't support functions, only methods: "s +
+                             Builder::Last(id_list));
         }
 
-        vector<unique_ptr<ast::Statement>> args;
+        NodeList args{};
         if (lexer_.CurrentToken() != ')') {
             args = ParseTestList();
         }
         lexer_.Expect<TokenType::Char>(')');
         lexer_.NextToken();
 
-        return make_unique<ast::MethodCall>(make_unique<ast::VariableValue>(std::move(id_list)),
-                                            std::move(last_name), std::move(args));
+        return Builder::MethodCall(std::move(id_list), std::move(args));
     }
 
-    // Expr -> Adder ['+'/'-' Adder]*
-    unique_ptr<ast::Statement> ParseExpression()  // NOLINT
+    // Operand -> '(' Test ')'
+    //          | NOT Test         (если допустим в текущем контексте)
+    //          | '-' Operand
+    //          | NUMBER
+    //          | STRING
+    //          | NONE
+    //          | TRUE
+    //          | FALSE
+    //          | DottedIds '(' ExprList ')'
+    //          | DottedIds
+    Node ParseOperand(int min_precedence)  // NOLINT
     {
-        unique_ptr<ast::Statement> result = ParseAdder();
-        while (lexer_.CurrentToken() == '+' || lexer_.CurrentToken() == '-') {
-            char op = lexer_.CurrentToken().As<TokenType::Char>().value;
-            lexer_.NextToken();
-
-            if (op == '+') {
-                result = make_unique<ast::Add>(std::move(result), ParseAdder());
-            } else {
-                result = make_unique<ast::Sub>(std::move(result), ParseAdder());
-            }
-        }
-        return result;
-    }
-
-    // Adder -> Mult ['*'/'/' Mult]*
-    unique_ptr<ast::Statement> ParseAdder()  // NOLINT
-    {
-        unique_ptr<ast::Statement> result = ParseMult();
-        while (lexer_.CurrentToken() == '*' || lexer_.CurrentToken() == '/') {
-            char op = lexer_.CurrentToken().As<TokenType::Char>().value;
-            lexer_.NextToken();
-
-            if (op == '*') {
-                result = make_unique<ast::Mult>(std::move(result), ParseMult());
-            } else {
-                result = make_unique<ast::Div>(std::move(result), ParseMult());
-            }
-        }
-        return result;
-    }
+        const auto& tok = lexer_.CurrentToken();
 
-    // Mult -> '(' Expr ')'
-    //       | NUMBER
-    //       | '-' Mult
-    //       | STRING
-    //       | NONE
-    //       | TRUE
-    //       | FALSE
-    //       | DottedIds '(' ExprList ')'
-    //       | DottedIds
-    unique_ptr<ast::Statement> ParseMult()  // NOLINT
-    {
-        if (lexer_.CurrentToken() == '(') {
+        if (tok == '(') {
             lexer_.NextToken();
             auto result = ParseTest();
             lexer_.Expect<TokenType::Char>(')');
             lexer_.NextToken();
             return result;
         }
-        if (lexer_.CurrentToken() == '-') {
+        if (tok.Is<TokenType::Not>() && min_precedence <= Precedence::NOT) {
+            lexer_.NextToken();
+            return Builder::Not(ParseTest(Precedence::NOT));  // NOLINT
+        }
+        if (tok == '-') {
             lexer_.NextToken();
-            return make_unique<ast::Mult>(ParseMult(), make_unique<ast::NumericConst>(-1));
+            return Builder::Negate(ParseOperand(Precedence::UNARY));
         }
-        if (const auto* num = lexer_.CurrentToken().TryAs<TokenType::Number>()) {
-            int result = num->value;
+        if (const auto* num = tok.TryAs<TokenType::Number>()) {
+            auto result = Builder::Number(num->value);
             lexer_.NextToken();
-            return make_unique<ast::NumericConst>(result);
+            return result;
         }
-        if (const auto* str = lexer_.CurrentToken().TryAs<TokenType::String>()) {
-            string result = str->value;
+        if (const auto* str = tok.TryAs<TokenType::String>()) {
+            auto result = Builder::String(str->value);
             lexer_.NextToken();
-            return make_unique<ast::StringConst>(std::move(result));
+            return result;
         }
-        if (lexer_.CurrentToken().Is<TokenType::True>()) {
+        if (tok.Is<TokenType::True>()) {
             lexer_.NextToken();
-            return make_unique<ast::BoolConst>(runtime::Bool(true));
+            return Builder::Bool(true);
         }
-        if (lexer_.CurrentToken().Is<TokenType::False>()) {
+        if (tok.Is<TokenType::False>()) {
             lexer_.NextToken();
-            return make_unique<ast::BoolConst>(runtime::Bool(false));
+            return Builder::Bool(false);
         }
-        if (lexer_.CurrentToken().Is<TokenType::None>()) {
+        if (tok.Is<TokenType::None>()) {
             lexer_.NextToken();
-            return make_unique<ast::None>();
+            return Builder::None();
         }
 
         return ParseDottedIdsInMultExpr();
     }
 
-    std::unique_ptr<ast::Statement> ParseDottedIdsInMultExpr() {
-        vector<string> names = ParseDottedIds();
+    Node ParseDottedIdsInMultExpr() {
+        Names names = ParseDottedIds();
 
         if (lexer_.CurrentToken() == '(') {
             // various calls
-            vector<unique_ptr<ast::Statement>> args;
+            NodeList args{};
             if (lexer_.NextToken() != ')') {
                 args = ParseTestList();
             }
             lexer_.Expect<TokenType::Char>(')');
             lexer_.NextToken();
 
-            auto method_name = names.back();
-            names.pop_back();
-
-            if (!names.empty()) {
-                return make_unique<ast::MethodCall>(
-                    make_unique<ast::VariableValue>(std::move(names)), std::move(method_name),
-                    std::move(args));
-            }
-            if (auto it = declared_classes_.find(method_name); it != declared_classes_.end()) {
-                return make_unique<ast::NewInstance>(
-                    static_cast<const runtime::Class&>(*it->second), std::move(args));  // NOLINT
+            if (Builder::Count(names) > 1) {
+                return Builder::MethodCall(std::move(names), std::move(args));
             }
-            if (method_name == "str"sv) {
-                if (args.size() != 1) {
-                    throw ParseError("Function str takes exactly one argument"s);
-                }
-                return make_unique<ast::Stringify>(std::move(args.front()));
+            if (const runtime::Class* cls = FindClass(Builder::Last(names))) {
+                return Builder::NewInstance(*cls, std::move(args));
             }
-            throw ParseError("Unknown call to "s + method_name + "()"s);
+            return Builder::FunctionCall(Builder::Last(names), std::move(args), deferred_);
         }
-        return make_unique<ast::VariableValue>(std::move(names));
+        return Builder::Variable(std::move(names));
     }
 
-    vector<unique_ptr<ast::Statement>> ParseTestList()  // NOLINT
+    NodeList ParseTestList()  // NOLINT
     {
-        vector<unique_ptr<ast::Statement>> result;
-        result.push_back(ParseTest());
+        NodeList result{};
+        Builder::Append(result, ParseTest());
 
         while (lexer_.CurrentToken() == ',') {
             lexer_.NextToken();
-            result.push_back(ParseTest());
+            Builder::Append(result, ParseTest());
         }
         return result;
     }
 
     // Condition -> if LogicalExpr: Suite [else: Suite]
-    unique_ptr<ast::Statement> ParseCondition()  // NOLINT
+    Node ParseCondition()  // NOLINT
     {
         lexer_.Expect<TokenType::If>();
         lexer_.NextToken();
@@ -312,86 +889,35 @@ private:
 
         auto if_body = ParseSuite();
 
-        unique_ptr<ast::Statement> else_body;
+        Node else_body{};
         if (lexer_.CurrentToken().Is<TokenType::Else>()) {
             lexer_.ExpectNext<TokenType::Char>(':');
             lexer_.NextToken();
             else_body = ParseSuite();
         }
 
-        return make_unique<ast::IfElse>(std::move(condition), std::move(if_body),
-                                        std::move(else_body));
+        return Builder::IfElse(std::move(condition), std::move(if_body), std::move(else_body));
     }
 
-    // LogicalExpr -> AndTest [OR AndTest]
-    // AndTest -> NotTest [AND NotTest]
-    // NotTest -> [NOT] NotTest
-    //          | Comparison
-    unique_ptr<ast::Statement> ParseTest()  // NOLINT
+    // Test -> Operand [BinaryOp Test]*
+    // Разбирает выражение, в которое входят только бинарные операции с приоритетом выше
+    // min_precedence. Приоритеты и ассоциативность операций задаёт таблица BINARY_OPERATORS
+    Node ParseTest(int min_precedence = Precedence::LOWEST)  // NOLINT
     {
-        auto result = ParseAndTest();
-        while (lexer_.CurrentToken().Is<TokenType::Or>()) {
-            lexer_.NextToken();
-            result = make_unique<ast::Or>(std::move(result), ParseAndTest());
-        }
-        return result;
-    }
-
-    unique_ptr<ast::Statement> ParseAndTest()  // NOLINT
-    {
-        auto result = ParseNotTest();
-        while (lexer_.CurrentToken().Is<TokenType::And>()) {
-            lexer_.NextToken();
-            result = make_unique<ast::And>(std::move(result), ParseNotTest());
-        }
-        return result;
-    }
-
-    unique_ptr<ast::Statement> ParseNotTest()  // NOLINT
-    {
-        if (lexer_.CurrentToken().Is<TokenType::Not>()) {
+        auto result = ParseOperand(min_precedence);
+        while (const BinaryOperator* op = FindBinaryOperator(lexer_.CurrentToken())) {
+            if (op->precedence <= min_precedence) {
+                break;
+            }
             lexer_.NextToken();
-            return make_unique<ast::Not>(ParseNotTest());  // NOLINT
-        }
-        return ParseComparison();
-    }
-
-    // Comparison -> Expr [COMP_OP Expr]
-    unique_ptr<ast::Statement> ParseComparison()  // NOLINT
-    {
-        auto result = ParseExpression();
-
-        const auto tok = lexer_.CurrentToken();
+            result = Builder::Binary(*op, std::move(result), ParseTest(op->precedence));
 
-        if (tok == '<') {
-            lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::Less, std::move(result),
-                                                ParseExpression());
-        }
-        if (tok == '>') {
-            lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::Greater, std::move(result),
-                                                ParseExpression());
-        }
-        if (tok.Is<TokenType::Eq>()) {
-            lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::Equal, std::move(result),
-                                                ParseExpression());
-        }
-        if (tok.Is<TokenType::NotEq>()) {
-            lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::NotEqual, std::move(result),
-                                                ParseExpression());
-        }
-        if (tok.Is<TokenType::LessOrEq>()) {
-            lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::LessOrEqual, std::move(result),
-                                                ParseExpression());
-        }
-        if (tok.Is<TokenType::GreaterOrEq>()) {
-            lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::GreaterOrEqual, std::move(result),
-                                                ParseExpression());
+            if (!op->chainable) {
+                const BinaryOperator* next = FindBinaryOperator(lexer_.CurrentToken());
+                if (next && next->precedence == op->precedence) {
+                    throw ParseError("Comparison operators can't be chained"s);
+                }
+            }
         }
         return result;
     }
@@ -399,13 +925,18 @@ private:
     // Statement -> SimpleStatement Newline
     //           | class ClassDefinition
     //           | if Condition
-    unique_ptr<ast::Statement> ParseStatement()  // NOLINT
+    Node ParseStatement()  // NOLINT
     {
         const auto& tok = lexer_.CurrentToken();
 
         if (tok.Is<TokenType::Class>()) {
-            lexer_.NextToken();
-            return ParseClassDefinition();  // NOLINT
+            if constexpr (is_same_v<Builder, TreeBuilder>) {
+                lexer_.NextToken();
+                return ParseClassDefinition();  // NOLINT
+            } else {
+                // Блоки с объявлениями классов всегда разбираются с построением дерева
+                throw logic_error("Class definitions are not checked without building a tree"s);
+            }
         }
         if (tok.Is<TokenType::If>()) {
             return ParseCondition();
@@ -419,30 +950,331 @@ private:
     // StatementBody -> return Expression
     //               | print ExpressionList
     //               | AssignmentOrCall
-    unique_ptr<ast::Statement> ParseSimpleStatement() {
+    Node ParseSimpleStatement() {
         const auto& tok = lexer_.CurrentToken();
 
         if (tok.Is<TokenType::Return>()) {
             lexer_.NextToken();
-            return make_unique<ast::Return>(ParseTest());
+            return Builder::Return(ParseTest());
         }
         if (tok.Is<TokenType::Print>()) {
             lexer_.NextToken();
-            vector<unique_ptr<ast::Statement>> args;
+            NodeList args{};
             if (!lexer_.CurrentToken().Is<TokenType::Newline>()) {
                 args = ParseTestList();
             }
-            return make_unique<ast::Print>(std::move(args));
+            return Builder::Print(std::move(args));
         }
         return ParseAssignmentOrCall();
     }
 
-    parse::Lexer& lexer_;
-    runtime::Closure declared_classes_;
+    parse::TokenStream& lexer_;
+    ParseOptions options_;
+    shared_ptr<ClassScope> classes_;
+    // Количество объявленных классов, доступных разбираемому коду
+    size_t visible_classes_;
+    DeferredReferences* deferred_;
+};
+
+runtime::ObjectHolder LazyMethodBody::Execute(runtime::Closure& closure,
+                                              runtime::Context& context) {
+    return GetBody().Execute(closure, context);
+}
+
+runtime::Executable& LazyMethodBody::GetBody() {
+    if (auto* body = parsed_body_.load(memory_order_acquire)) {
+        return *body;
+    }
+
+    lock_guard lock(parse_mutex_);
+    if (!body_) {
+        RecordedTokens tokens(tokens_);
+        body_ = Parser<TreeBuilder>(tokens, options_, classes_, visible_classes_)
+                    .ParseMethodBody();
+        if (!reparsable_) {
+            vector<parse::Token>().swap(tokens_);
+        }
+        parsed_body_.store(body_.get(), memory_order_release);
+    }
+    return *body_;
+}
+
+// Буфер потока ввода, читающий символы прямо из строки, без копирования
+class StringViewBuffer : public streambuf {
+public:
+    explicit StringViewBuffer(string_view text) {
+        // Буфер используется только для чтения
+        char* begin = const_cast<char*>(text.data());  // NOLINT
+        setg(begin, begin, begin + text.size());
+    }
+};
+
+bool IsIdChar(char c) {
+    return c == '_' || isalnum(static_cast<unsigned char>(c));
+}
+
+// Возвращает позиции, с которых начинаются инструкции верхнего уровня: строки, которые
+// начинаются не с пробела, не пустые, не комментарии и не ветка else инструкции if.
+// Переводы строк внутри строковых констант и комментариев не считаются началом строки
+vector<size_t> FindTopLevelStatements(string_view source) {
+    vector<size_t> result;
+    bool line_start = true;
+    bool comment = false;
+    char quote = 0;
+    for (size_t i = 0; i < source.size(); ++i) {
+        const char c = source[i];
+        if (quote != 0) {
+            if (c == '\\') {
+                ++i;
+            } else if (c == quote) {
+                quote = 0;
+            }
+            continue;
+        }
+        if (c == '\n') {
+            line_start = true;
+            comment = false;
+            continue;
+        }
+        if (comment) {
+            continue;
+        }
+        if (line_start && c != ' ' && c != '#'
+            && !(source.substr(i, 4) == "else"sv
+                 && (i + 4 == source.size() || !IsIdChar(source[i + 4])))) {
+            result.push_back(i);
+        }
+        line_start = false;
+        if (c == '#') {
+            comment = true;
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        }
+    }
+    return result;
+}
+
+// Делит исходный текст на не более чем max_chunks частей размером не меньше min_chunk_size
+// по границам инструкций верхнего уровня
+vector<string_view> SplitIntoChunks(string_view source, size_t max_chunks,
+                                    size_t min_chunk_size) {
+    const size_t chunk_size = max(source.size() / max(max_chunks, size_t{1}), min_chunk_size);
+    vector<string_view> result;
+    size_t chunk_start = 0;
+    for (size_t statement : FindTopLevelStatements(source)) {
+        if (statement - chunk_start >= chunk_size) {
+            result.push_back(source.substr(chunk_start, statement - chunk_start));
+            chunk_start = statement;
+        }
+    }
+    result.push_back(source.substr(chunk_start));
+    return result;
+}
+
+// Результат разбора части программы
+struct ParsedChunk {
+    unique_ptr<runtime::Executable> program;
+    shared_ptr<ClassScope> classes = make_shared<ClassScope>();
+    DeferredReferences deferred;
+};
+
+// Разбирает часть программы chunk. Если deferred равен false, то chunk - первая часть
+// программы, и все имена классов должны быть объявлены в ней самой
+ParsedChunk ParseChunk(string_view chunk, ParseOptions options, bool deferred) {
+    StringViewBuffer buffer(chunk);
+    istream input(&buffer);
+    parse::Lexer lexer(input);
+
+    ParsedChunk result;
+    result.program = Parser<TreeBuilder>(lexer, options, result.classes,
+                                         numeric_limits<size_t>::max(),
+                                         deferred ? &result.deferred : nullptr)
+                         .ParseProgram();
+    return result;
+}
+
+// Присоединяет часть программы к предыдущим частям - первым previous_visible классам
+// области previous - и разрешает её ссылки на классы из этих частей
+void LinkChunk(ParsedChunk& chunk, const shared_ptr<const ClassScope>& previous,
+               size_t previous_visible = numeric_limits<size_t>::max()) {
+    chunk.classes->Link(previous, previous_visible);
+    for (auto& [cls, base_name] : chunk.deferred.bases) {
+        const runtime::Class* base = previous ? previous->Find(base_name, previous_visible) : nullptr;
+        if (!base) {
+            throw ParseError("Base class "s + base_name + " not found for class "s +
+                             cls->GetName());
+        }
+        cls->SetParent(base);
+    }
+    // Классы перечислены в порядке объявления, поэтому базовый класс обновляется раньше
+    // наследников
+    for (auto& [cls, base] : chunk.deferred.local_bases) {
+        cls->SetParent(base);
+    }
+    for (DeferredCall* call : chunk.deferred.calls) {
+        call->Resolve(previous.get(), previous_visible);
+    }
+    for (const auto& [name, arg_count] : chunk.deferred.lazy_calls) {
+        if (!previous || !previous->Find(name, previous_visible)) {
+            CheckFunctionCall(name, arg_count);
+        }
+    }
+}
+
+// Делит исходный текст на блоки - инструкции верхнего уровня вместе с вложенными в них
+// строками. Пустые строки и комментарии в начале текста относятся к первому блоку
+vector<string_view> SplitIntoBlocks(string_view source) {
+    vector<size_t> starts = FindTopLevelStatements(source);
+    if (starts.empty()) {
+        return source.empty() ? vector<string_view>{} : vector<string_view>{source};
+    }
+    starts.front() = 0;
+    starts.push_back(source.size());
+
+    vector<string_view> result;
+    result.reserve(starts.size() - 1);
+    for (size_t i = 0; i + 1 < starts.size(); ++i) {
+        result.push_back(source.substr(starts[i], starts[i + 1] - starts[i]));
+    }
+    return result;
+}
+
+// Инструкция, дерево которой разделяют несколько программ
+class SharedStatement : public runtime::Executable {
+public:
+    explicit SharedStatement(shared_ptr<runtime::Executable> statement)
+        : statement_(std::move(statement)) {
+    }
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override {
+        return statement_->Execute(closure, context);
+    }
+
+private:
+    shared_ptr<runtime::Executable> statement_;
 };
 
 }  // namespace
 
-unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer) {
-    return Parser{lexer}.ParseProgram();
+// Блок верхнего уровня программы и результат его разбора
+struct IncrementalParser::Block {
+    string text;
+    ParsedChunk chunk;
+    // Количество классов, объявленных в предыдущих блоках, при последнем связывании
+    size_t previous_classes = 0;
+};
+
+unique_ptr<runtime::Executable> ParseProgram(parse::TokenStream& lexer, ParseOptions options) {
+    return Parser<TreeBuilder>{lexer, options}.ParseProgram();
+}
+
+unique_ptr<runtime::Executable> ParseProgramParallel(string_view source, ParseOptions options,
+                                                     ParallelParseOptions parallel_options) {
+    util::ThreadPool pool(parallel_options.thread_count);
+    vector<string_view> chunks =
+        SplitIntoChunks(source, pool.Size(), parallel_options.min_chunk_size);
+
+    vector<future<ParsedChunk>> parsed_chunks;
+    parsed_chunks.reserve(chunks.size());
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        parsed_chunks.push_back(pool.Submit([chunk = chunks[i], options, deferred = i > 0] {
+            return ParseChunk(chunk, options, deferred);
+        }));
+    }
+
+    // Части присоединяются по порядку, поэтому ошибки сообщаются в том же порядке,
+    // что и при последовательном разборе
+    auto program = make_unique<ast::Compound>();
+    shared_ptr<const ClassScope> previous;
+    for (auto& parsed_chunk : parsed_chunks) {
+        ParsedChunk chunk = parsed_chunk.get();
+        LinkChunk(chunk, previous);
+        program->AddStatement(std::move(chunk.program));
+        previous = std::move(chunk.classes);
+    }
+    return program;
+}
+
+ProgramWithPrologue ParseProgramWithPrologue(string_view prologue, string_view main,
+                                             ParseOptions options) {
+    ParsedChunk prologue_chunk = ParseChunk(prologue, options, false);
+    ParsedChunk main_chunk = ParseChunk(main, options, true);
+    LinkChunk(main_chunk, prologue_chunk.classes);
+    return {std::move(prologue_chunk.program), prologue_chunk.classes->Classes(),
+            std::move(main_chunk.program)};
+}
+
+IncrementalParser::IncrementalParser(ParseOptions options)
+    : options_(options) {
+}
+
+IncrementalParser::~IncrementalParser() = default;
+
+unique_ptr<runtime::Executable> IncrementalParser::Update(string_view source) {
+    // Одинаковых блоков в программе может быть несколько, каждый из них используется один раз
+    unordered_multimap<string_view, shared_ptr<Block>> previous_blocks;
+    for (const auto& block : blocks_) {
+        previous_blocks.emplace(block->text, block);
+    }
+
+    IncrementalParseStats stats;
+    vector<shared_ptr<Block>> blocks;
+    for (string_view text : SplitIntoBlocks(source)) {
+        if (auto it = previous_blocks.find(text); it != previous_blocks.end()) {
+            blocks.push_back(std::move(it->second));
+            previous_blocks.erase(it);
+            ++stats.reused_blocks;
+        } else {
+            auto block = make_shared<Block>();
+            block->text = text;
+            block->chunk = ParseChunk(block->text, options_, true);
+            blocks.push_back(std::move(block));
+            ++stats.parsed_blocks;
+        }
+    }
+
+    try {
+        Link(blocks);
+    } catch (...) {
+        // Связи неизменных блоков восстанавливаются, и прежняя версия программы остаётся рабочей
+        Link(blocks_);
+        throw;
+    }
+    blocks_ = std::move(blocks);
+    stats_ = stats;
+
+    auto program = make_unique<ast::Compound>();
+    for (const auto& block : blocks_) {
+        program->AddStatement(make_unique<SharedStatement>(
+            shared_ptr<runtime::Executable>(block, block->chunk.program.get())));
+    }
+    return program;
+}
+
+IncrementalParseStats IncrementalParser::LastUpdateStats() const {
+    return stats_;
+}
+
+void IncrementalParser::Link(const vector<shared_ptr<Block>>& blocks) {
+    auto classes = make_shared<ClassScope>();
+    // Пока классы объявляются в том же порядке, что и при прошлом связывании, блоки видят
+    // те же классы, и уже разобранные тела их методов остаются верными
+    bool classes_changed = false;
+    for (const auto& block : blocks) {
+        LinkChunk(block->chunk, classes, classes->Size());
+        if (classes_changed || block->previous_classes != classes->Size()) {
+            for (LazyMethodBody* body : block->chunk.deferred.lazy_bodies) {
+                body->Reset();
+            }
+        }
+        block->previous_classes = classes->Size();
+
+        for (const runtime::Class* cls : block->chunk.classes->Classes()) {
+            const size_t index = classes->Size();
+            classes_changed = classes_changed || index >= linked_classes_.size()
+                              || linked_classes_[index] != cls;
+            classes->Declare(*cls);
+        }
+    }
+    linked_classes_ = classes->Classes();
 }
@@ -1,18 +1,103 @@
 #pragma once
 
+#include <cstddef>
 #include <memory>
 #include <stdexcept>
+#include <string_view>
+#include <vector>
 
 namespace parse {
-class Lexer;
+class TokenStream;
 }
 
 namespace runtime {
 class Executable;
+class Class;
 }
 
 struct ParseError : std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
-std::unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer);
+// Настройки разбора программы
+struct ParseOptions {
+    // При отложенном разборе синтаксис тел методов проверяется сразу, а синтаксическое
+    // дерево тела строится при первом вызове метода. В обоих режимах все синтаксические
+    // ошибки обнаруживаются до начала выполнения программы.
+    // Если false, деревья тел всех методов строятся сразу
+    bool lazy_method_bodies = true;
+};
+
+// Разбирает программу. Дерево программы не хранит состояния выполнения, поэтому его можно
+// выполнять многократно, в том числе одновременно в нескольких потоках, если у каждого
+// выполнения свои Closure и Context
+std::unique_ptr<runtime::Executable> ParseProgram(parse::TokenStream& lexer,
+                                                  ParseOptions options = {});
+
+// Настройки параллельного разбора
+struct ParallelParseOptions {
+    // Количество потоков разбора. Если 0, выбирается по числу ядер процессора
+    size_t thread_count = 0;
+    // Минимальный размер части программы, которую разбирает один поток
+    size_t min_chunk_size = 64 * 1024;
+};
+
+// Разбирает программу source в несколько потоков. Текст программы делится на части по
+// границам инструкций верхнего уровня, части разбираются параллельно, а затем объединяются,
+// и ссылки на классы из предыдущих частей разрешаются. Результат совпадает с ParseProgram
+std::unique_ptr<runtime::Executable> ParseProgramParallel(
+    std::string_view source, ParseOptions options = {},
+    ParallelParseOptions parallel_options = {});
+
+// Программа, разобранная в виде двух частей: пролога и основной части
+struct ProgramWithPrologue {
+    std::unique_ptr<runtime::Executable> prologue;
+    // Классы, объявленные в прологе, в порядке объявления. Ими владеет дерево пролога
+    std::vector<const runtime::Class*> prologue_classes;
+    std::unique_ptr<runtime::Executable> main;
+};
+
+// Разбирает программу, текст которой разделён на пролог prologue и основную часть main
+// по границе инструкций верхнего уровня. Основная часть видит классы пролога, поэтому её
+// можно выполнить вместо всей программы, если переменные пролога получены другим способом
+ProgramWithPrologue ParseProgramWithPrologue(std::string_view prologue, std::string_view main,
+                                             ParseOptions options = {});
+
+// Статистика последнего обновления программы в IncrementalParser
+struct IncrementalParseStats {
+    // Количество блоков, взятых из предыдущей версии программы без разбора
+    size_t reused_blocks = 0;
+    // Количество блоков, разобранных заново
+    size_t parsed_blocks = 0;
+};
+
+// Разбор программы, которую многократно правят и запускают заново в одном процессе.
+// Программа делится на блоки - инструкции верхнего уровня вместе с вложенными в них строками.
+// Для каждого блока хранятся его текст и дерево, поэтому при обновлении программы заново
+// разбираются только изменённые блоки, а классы из неизменных блоков остаются теми же
+// объектами runtime::Class. Ссылки блоков на классы других блоков связываются заново
+class IncrementalParser {
+public:
+    explicit IncrementalParser(ParseOptions options = {});
+    ~IncrementalParser();
+
+    // Разбирает новую версию программы source. Результат совпадает с ParseProgram.
+    // Дерево, которое вернул предыдущий вызов, больше выполнять нельзя, так как оно разделяет
+    // блоки с новым деревом. При ошибке разбора выбрасывает исключение, а предыдущая
+    // версия программы остаётся в силе
+    std::unique_ptr<runtime::Executable> Update(std::string_view source);
+
+    [[nodiscard]] IncrementalParseStats LastUpdateStats() const;
+
+private:
+    struct Block;
+
+    // Связывает блоки друг с другом в порядке следования
+    void Link(const std::vector<std::shared_ptr<Block>>& blocks);
+
+    ParseOptions options_;
+    std::vector<std::shared_ptr<Block>> blocks_;
+    // Классы программы в порядке объявления при последнем связывании
+    std::vector<const runtime::Class*> linked_classes_;
+    IncrementalParseStats stats_;
+};
@@ -1,17 +1,27 @@
 #include "lexer.h"
 #include "parse.h"
+#include "snapshot.h"
 #include "statement.h"
+#include "thread_pool.h"
+#include "watchdog.h"
 
 #include "test_runner_p.h"
 
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <thread>
+
 using namespace std;
 
 namespace parse {
 
-unique_ptr<ast::Statement> ParseProgramFromString(const string& program) {
+unique_ptr<ast::Statement> ParseProgramFromString(const string& program,
+                                                  ParseOptions options = {}) {
     istringstream is(program);
     parse::Lexer lexer(is);
-    return ParseProgram(lexer);
+    return ParseProgram(lexer, options);
 }
 
 void TestSimpleProgram() {
@@ -245,6 +255,721 @@ print r, c, t1, t2
                  "Rect(10x20) Circle(52) Triangle(3, 4, 5) Wrong triangle\n"s);
 }
 
+void TestPrintWithNestedOutput() {
+    const string program = R"--(
+class Noisy:
+  def __init__(name):
+    self.name = name
+
+  def __str__():
+    print "formatting", self.name
+    return "Noisy(" + self.name + ")"
+
+class Wrapper:
+  def __init__(inner):
+    self.inner = inner
+
+  def __str__():
+    return "[" + str(self.inner) + "]"
+
+a = Noisy("a")
+print 1, a, str(Wrapper(Noisy("b"))), -2147483647 - 1, True, None
+print
+print str(a) + str(10)
+)--"s;
+
+    runtime::DummyContext context;
+
+    runtime::Closure closure;
+    auto tree = ParseProgramFromString(program);
+    tree->Execute(closure, context);
+
+    ASSERT_EQUAL(context.output.str(),
+                 "1 formatting a\nNoisy(a) formatting b\n[Noisy(b)] -2147483648 True None\n"
+                 "\nformatting a\nNoisy(a)10\n"s);
+}
+
+void TestOperatorPrecedence() {
+    const string program = R"(
+print 2 + 3 * 4 - 10 / 5, 20 - 5 - 3, 36 / 4 / 3, -2 * -3 + -(4 - 6)
+print 1 + 2 < 4, not 1 == 2, not 1 < 2 or 3 > 2 and not False
+print 1 > 2 or 2 > 3 or 3 > 2, 1 < 2 and 2 < 3 and 3 < 2
+)"s + "print "s + string(1000, '(') + "1 + 2"s + string(1000, ')') + "\n"s;
+
+    runtime::DummyContext context;
+
+    runtime::Closure closure;
+    auto tree = ParseProgramFromString(program);
+    tree->Execute(closure, context);
+
+    ASSERT_EQUAL(context.output.str(), "12 12 3 8\nTrue True True\nTrue False\n3\n"s);
+
+    ASSERT_THROWS(ParseProgramFromString("x = 1 < 2 < 3\n"s), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("x = 1 + not 2\n"s), parse::LexerError);
+}
+
+void TestLazyMethodBodies() {
+    const string program = R"(
+class Counter:
+  def __init__():
+    self.value = 0
+
+  def add(x):
+    if x > 0:
+      self.value = self.value + x
+    else:
+      print "skip", x
+
+  def unused(x):
+    return str(-x) == "1" and not x.y.z(1, (2))
+
+class Wrapper:
+  def __init__(counter):
+    self.counter = counter
+
+c = Counter()
+c.add(2)
+c.add(3)
+c.add(0)
+print c.value
+)"s;
+
+    for (bool lazy : {true, false}) {
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        ParseProgramFromString(program, ParseOptions{lazy})->Execute(closure, context);
+        ASSERT_EQUAL(context.output.str(), "skip 0\n5\n"s);
+    }
+
+    // Ошибки в телах методов, которые не вызываются, обнаруживаются до выполнения
+    // и при отложенном разборе, так же как при полном
+    const auto method = [](const string& body) {
+        return "class A:\n  def f(x):\n"s + body + "\nprint 1\n"s;
+    };
+    for (bool lazy : {true, false}) {
+        const ParseOptions options{lazy};
+        ASSERT_THROWS(ParseProgramFromString(method("    return 1 +"), options),
+                      parse::LexerError);
+        ASSERT_THROWS(ParseProgramFromString(method("    if x\n      return 1"), options),
+                      parse::LexerError);
+        ASSERT_THROWS(ParseProgramFromString(method("    x = 1 2"), options), parse::LexerError);
+        // Незакрытую скобку отложенный разбор находит раньше, при проверке баланса скобок
+        ASSERT_THROWS(ParseProgramFromString(method("    return (1"), options), runtime_error);
+        ASSERT_THROWS(ParseProgramFromString(method("    f(x)"), options), ParseError);
+        ASSERT_THROWS(ParseProgramFromString(method("    return 1 < 2 < 3"), options),
+                      ParseError);
+        ASSERT_THROWS(ParseProgramFromString(method("    return str(1, 2)"), options),
+                      ParseError);
+        // Класс A ещё не объявлен внутри собственных методов
+        ASSERT_THROWS(ParseProgramFromString(method("    return A()"), options), ParseError);
+        ASSERT_THROWS(ParseProgramParallel(program + "class B:\n  def g():\n    return C()\n"s,
+                                           options, ParallelParseOptions{4, 1}),
+                      ParseError);
+    }
+
+    // Отложенный разбор проверяет тело тем же разбором, что и полный, поэтому принимает
+    // те же программы и сообщает о тех же ошибках. Отличаются только сообщения о незакрытых
+    // скобках: их отложенный разбор находит раньше
+    const auto outcome = [&method](const string& body, bool lazy) {
+        try {
+            (void)ParseProgramFromString(method(body), ParseOptions{lazy});
+            return "accepted"s;
+        } catch (const exception& e) {
+            return string(e.what());
+        }
+    };
+    for (const char* body : {"    return 1 +", "    if x\n      return 1", "    x = 1 2",
+                             "    f(x)", "    return 1 < 2 < 3", "    return str(1, 2)",
+                             "    return A()", "    return x.y", "    print 1,",
+                             "    return not", "    return -", "    self.x = 1\n   return 2",
+                             "    if x:\n      return 1\n    else\n      return 2",
+                             "    return str(x) + 'a' * -x", "    print", "    self.f(1, x.y)",
+                             "    if not x == 1 or 2 <= x:\n      print x\n    else:\n      x = 2",
+                             "    return x.y.z", "    return None"}) {
+        ASSERT_EQUAL(outcome(body, true), outcome(body, false));
+    }
+}
+
+void TestParallelParse() {
+    const string program = R"(
+class Shape:
+  def __str__():
+    return "Shape"
+
+# Строка ниже начинается с пробела
+x = 'multi
+line string'
+
+class Rect(Shape):
+  def __init__(w, h):
+    self.w = w
+    self.h = h
+
+  def __str__():
+    return "Rect(" + str(self.w) + 'x' + str(self.h) + ')'
+
+if x:
+  r = Rect(1, 2)
+else:
+  r = Shape()
+
+class Square(Rect):
+  def __init__(a):
+    self.w = a
+    self.h = a
+
+class Cube(Square):
+  def __str__():
+    return "Cube of " + str(Square(self.w))
+
+print Rect(10, 20), Shape(), r, Square(3), Cube(4), str(5)
+)"s;
+
+    auto run = [](runtime::Executable& tree) {
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        tree.Execute(closure, context);
+        return context.output.str();
+    };
+
+    const string expected = "Rect(10x20) Shape Rect(1x2) Rect(3x3) Cube of Rect(4x4) 5\n"s;
+    for (bool lazy : {true, false}) {
+        ParseOptions options{lazy};
+        ASSERT_EQUAL(run(*ParseProgramFromString(program, options)), expected);
+        for (size_t threads : {1, 2, 8}) {
+            auto tree = ParseProgramParallel(program, options, ParallelParseOptions{threads, 1});
+            ASSERT_EQUAL(run(*tree), expected);
+        }
+    }
+
+    // Наследники получают специальные методы базового класса из предыдущей части,
+    // даже если их собственный базовый класс объявлен в той же части
+    const string inherited = R"(
+class Base:
+  def __str__():
+    return "Base"
+
+  def __eq__(other):
+    return True
+
+x = 1
+class Middle(Base):
+  def f():
+    return 1
+
+class Leaf(Middle):
+  def g():
+    return 2
+
+print Leaf(), Leaf() == 1
+)"s;
+    for (size_t threads : {1, 2, 3, 4, 8}) {
+        auto tree = ParseProgramParallel(inherited, {}, ParallelParseOptions{threads, 1});
+        ASSERT_EQUAL(run(*tree), "Base True\n"s);
+    }
+
+    ParallelParseOptions small_chunks{4, 1};
+    ASSERT_THROWS(ParseProgramParallel("x = A()\nclass A:\n  def f():\n    return 1\n"s, {},
+                                       small_chunks),
+                  ParseError);
+    ASSERT_THROWS(ParseProgramParallel("class A:\n  def f():\n    return 1\n"
+                                       "x = 1\nclass A:\n  def g():\n    return 2\n"s,
+                                       {}, small_chunks),
+                  ParseError);
+    ASSERT_THROWS(ParseProgramParallel("x = 1\nclass B(A):\n  def f():\n    return 1\n"s,
+                                       {}, small_chunks),
+                  ParseError);
+}
+
+void TestThreadPoolStealing() {
+    util::ThreadPool pool(3);
+    // Задача занимает свой поток, пока не выполнятся задачи, которые она поставила в свою
+    // очередь. Выполнить их могут только другие потоки, забрав из чужой очереди
+    constexpr size_t TASKS = 8;
+    auto root = pool.Submit([&pool] {
+        const auto owner = this_thread::get_id();
+        atomic<size_t> done = 0;
+        vector<future<bool>> tasks;
+        for (size_t i = 0; i < TASKS; ++i) {
+            tasks.push_back(pool.Submit([owner, &done] {
+                ++done;
+                return this_thread::get_id() != owner;
+            }));
+        }
+        const auto deadline = chrono::steady_clock::now() + 10s;
+        while (done < TASKS && chrono::steady_clock::now() < deadline) {
+            this_thread::sleep_for(1ms);
+        }
+        if (done < TASKS) {
+            return false;
+        }
+        bool all_elsewhere = true;
+        for (auto& task : tasks) {
+            all_elsewhere = task.get() && all_elsewhere;
+        }
+        return all_elsewhere;
+    });
+    ASSERT(root.get());
+    ASSERT_EQUAL(pool.StolenTasks(), TASKS);
+}
+
+void TestIncrementalParse() {
+    const string base = R"(
+class Base:
+  def name():
+    return "Base"
+
+)"s;
+    const string rest = R"(
+class Derived(Base):
+  def make():
+    return Base()
+
+  def describe():
+    made = self.make()
+    return "Derived of " + self.name() + ", makes " + made.name()
+
+d = Derived()
+print d.describe()
+)"s;
+
+    auto run = [](runtime::Executable& tree) {
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        tree.Execute(closure, context);
+        return context.output.str();
+    };
+
+    IncrementalParser parser;
+    auto tree = parser.Update(base + rest);
+    ASSERT_EQUAL(run(*tree), "Derived of Base, makes Base\n"s);
+    ASSERT_EQUAL(parser.LastUpdateStats().parsed_blocks, 4U);
+    ASSERT_EQUAL(parser.LastUpdateStats().reused_blocks, 0U);
+
+    tree = parser.Update(base + rest);
+    ASSERT_EQUAL(run(*tree), "Derived of Base, makes Base\n"s);
+    ASSERT_EQUAL(parser.LastUpdateStats().parsed_blocks, 0U);
+    ASSERT_EQUAL(parser.LastUpdateStats().reused_blocks, 4U);
+
+    // Изменился только базовый класс, производный класс и его разобранные методы
+    // должны увидеть новую версию
+    const string edited_base = R"(
+class Base:
+  def name():
+    return "Edited"
+
+)"s;
+    tree = parser.Update(edited_base + rest);
+    ASSERT_EQUAL(run(*tree), "Derived of Edited, makes Edited\n"s);
+    ASSERT_EQUAL(parser.LastUpdateStats().parsed_blocks, 1U);
+    ASSERT_EQUAL(parser.LastUpdateStats().reused_blocks, 3U);
+
+    // Ошибки не портят предыдущую версию программы
+    ASSERT_THROWS(parser.Update(edited_base + "x = 1 +\n"s + rest), parse::LexerError);
+    ASSERT_THROWS(parser.Update(edited_base + rest + edited_base), ParseError);
+    ASSERT_THROWS(parser.Update(rest), ParseError);
+    ASSERT_EQUAL(run(*tree), "Derived of Edited, makes Edited\n"s);
+
+    // Пустая строка в начале программы теперь относится к первому блоку, поэтому блок
+    // с классом Base тоже разбирается заново
+    tree = parser.Update("print 1\n"s + edited_base + "print 1\n"s + rest);
+    ASSERT_EQUAL(run(*tree), "1\n1\nDerived of Edited, makes Edited\n"s);
+    ASSERT_EQUAL(parser.LastUpdateStats().parsed_blocks, 3U);
+
+    for (bool lazy : {true, false}) {
+        IncrementalParser eager_parser(ParseOptions{lazy});
+        ASSERT_EQUAL(run(*eager_parser.Update(base + rest)), "Derived of Base, makes Base\n"s);
+        ASSERT_EQUAL(run(*eager_parser.Update(edited_base + rest)),
+                     "Derived of Edited, makes Edited\n"s);
+    }
+}
+
+void TestProgramWithPrologue() {
+    const string prologue = R"(
+class Shape:
+  def area():
+    return 0
+
+class Square(Shape):
+  def __init__(side):
+    self.side = side
+
+  def area():
+    return self.side * self.side
+
+unit = Square(1)
+print 'prologue'
+)"s;
+    const string main_part = R"(
+big = Square(unit.side + 2)
+print big.area(), unit.area()
+)"s;
+
+    auto program = ParseProgramWithPrologue(prologue, main_part);
+    ASSERT_EQUAL(program.prologue_classes.size(), 2U);
+    ASSERT_EQUAL(program.prologue_classes[1]->GetName(), "Square"s);
+
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    program.prologue->Execute(closure, context);
+    program.main->Execute(closure, context);
+    ASSERT_EQUAL(context.output.str(), "prologue\n9 1\n"s);
+
+    // Основная часть не может объявить класс пролога ещё раз
+    ASSERT_THROWS(ParseProgramWithPrologue(prologue, "class Shape:\n  def f():\n    return 1\n"s),
+                  ParseError);
+}
+
+void TestReentrantProgram() {
+    const string program = R"--(
+class Counter:
+  def __init__():
+    self.value = 0
+
+  def add(x):
+    self.value = self.value + x
+    return self
+
+  def __str__():
+    return "Counter(" + str(self.value) + ")"
+
+class Factory:
+  def make():
+    return Counter()
+
+f = Factory()
+a = f.make()
+b = f.make()
+a.add(1)
+c = b.add(2)
+c.add(3)
+print a, b, c
+)--"s;
+
+    const string expected = "Counter(1) Counter(5) Counter(5)\n"s;
+    auto run = [](runtime::Executable& tree) {
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        tree.Execute(closure, context);
+        return context.output.str();
+    };
+
+    for (bool lazy : {true, false}) {
+        auto tree = ParseProgramFromString(program, ParseOptions{lazy});
+        ASSERT_EQUAL(run(*tree), expected);
+        ASSERT_EQUAL(run(*tree), expected);
+
+        vector<string> outputs(4);
+        vector<thread> threads;
+        for (auto& output : outputs) {
+            threads.emplace_back([&tree, &output, &run] {
+                for (int i = 0; i < 20; ++i) {
+                    output += run(*tree);
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        string repeated;
+        for (int i = 0; i < 20; ++i) {
+            repeated += expected;
+        }
+        for (const auto& output : outputs) {
+            ASSERT_EQUAL(output, repeated);
+        }
+    }
+}
+
+void TestExecutionFuel() {
+    const string program = R"(
+class Loop:
+  def run(n):
+    print n
+    self.run(n + 1)
+
+loop = Loop()
+loop.run(0)
+)"s;
+    auto tree = ParseProgramFromString(program);
+
+    // Бесконечная рекурсия останавливается, когда заканчивается топливо
+    runtime::DummyContext context;
+    context.SetLimits(runtime::ExecutionLimits{20});
+    runtime::Closure closure;
+    ASSERT_THROWS(tree->Execute(closure, context), runtime::FuelExhausted);
+    ASSERT_EQUAL(context.GetFuelLeft(), 0U);
+    ASSERT(!context.output.str().empty());
+
+    const string finite = R"(
+class ArithmeticProgression:
+  def calc(n):
+    if n > 0:
+      return n + self.calc(n - 1)
+    return 0
+
+x = ArithmeticProgression()
+print x.calc(10)
+)"s;
+    auto finite_tree = ParseProgramFromString(finite);
+    auto run = [&finite_tree](uint64_t fuel) {
+        runtime::DummyContext context;
+        context.SetLimits(runtime::ExecutionLimits{fuel});
+        runtime::Closure closure;
+        finite_tree->Execute(closure, context);
+        ASSERT_EQUAL(context.output.str(), "55\n"s);
+        return context.GetFuelLeft();
+    };
+
+    // Расход топлива не зависит от запуска, и ровно отмеренного запаса хватает
+    const uint64_t budget = 1000;
+    const uint64_t spent = budget - run(budget);
+    ASSERT_EQUAL(budget - run(budget), spent);
+    ASSERT_EQUAL(run(spent), 0U);
+    ASSERT_THROWS(run(spent - 1), runtime::FuelExhausted);
+    // 0 - без ограничения
+    run(0);
+}
+
+void TestCancellation() {
+    const string program = R"(
+class Fibonacci:
+  def calc(n):
+    if n < 2:
+      return n
+    return self.calc(n - 1) + self.calc(n - 2)
+
+f = Fibonacci()
+print 'start'
+print f.calc(60)
+)"s;
+    auto tree = ParseProgramFromString(program);
+
+    // Программа, отменённая до запуска, не выполняет ни одной инструкции
+    {
+        runtime::CancellationToken cancellation;
+        cancellation.Cancel();
+        runtime::DummyContext context;
+        context.SetCancellationToken(&cancellation);
+        runtime::Closure closure;
+        ASSERT_THROWS(tree->Execute(closure, context), runtime::ExecutionCancelled);
+        ASSERT(context.output.str().empty());
+    }
+    // Отмена из другого потока останавливает программу на ближайшей инструкции
+    {
+        runtime::CancellationToken cancellation;
+        runtime::DummyContext context;
+        context.SetCancellationToken(&cancellation);
+        runtime::Closure closure;
+        chrono::steady_clock::time_point cancelled_at;
+        thread canceller([&cancellation, &cancelled_at] {
+            this_thread::sleep_for(20ms);
+            cancelled_at = chrono::steady_clock::now();
+            cancellation.Cancel();
+        });
+        ASSERT_THROWS(tree->Execute(closure, context), runtime::ExecutionCancelled);
+        const auto stopped_at = chrono::steady_clock::now();
+        canceller.join();
+        ASSERT(stopped_at - cancelled_at < 100ms);
+        ASSERT_EQUAL(context.output.str(), "start\n"s);
+    }
+    // Watchdog отменяет выполнение по истечении времени
+    {
+        runtime::CancellationToken cancellation;
+        runtime::DummyContext context;
+        context.SetCancellationToken(&cancellation);
+        runtime::Closure closure;
+        const auto start = chrono::steady_clock::now();
+        {
+            runtime::Watchdog watchdog(cancellation, 30ms);
+            ASSERT_THROWS(tree->Execute(closure, context), runtime::ExecutionCancelled);
+        }
+        const auto elapsed = chrono::steady_clock::now() - start;
+        ASSERT(elapsed >= 30ms && elapsed < 1s);
+    }
+    // Watchdog, разрушенный до срока, выполнение не отменяет
+    {
+        runtime::CancellationToken cancellation;
+        {
+            runtime::Watchdog watchdog(cancellation, 1h);
+        }
+        ASSERT(!cancellation.IsCancelled());
+    }
+}
+
+void TestMemoryLimit() {
+    // Каждый вызов добавляет в список новый узел, пока не кончится память
+    const string program = R"(
+class Node:
+  def __init__(value, next):
+    self.value = value
+    self.next = next
+
+class Builder:
+  def build(n, tail):
+    if n == 0:
+      return tail
+    return self.build(n - 1, Node(n, tail))
+
+b = Builder()
+list = b.build(100, None)
+print list.value
+)"s;
+    auto tree = ParseProgramFromString(program);
+    auto run = [&tree](size_t memory) {
+        runtime::DummyContext context;
+        context.SetLimits(runtime::ExecutionLimits{0, memory});
+        runtime::Closure closure = runtime::MakeClosure(context);
+        tree->Execute(closure, context);
+        ASSERT_EQUAL(context.output.str(), "1\n"s);
+        return context.GetMemoryAccount();
+    };
+
+    const auto account = run(1 << 20);
+    // После выполнения вся память программы освобождена
+    ASSERT_EQUAL(account->GetUsed(), 0U);
+    const size_t peak = account->GetPeak();
+    ASSERT(peak > 100 * sizeof(runtime::ClassInstance));
+    // Пиковый расход одинаков при каждом запуске, и ровно такого лимита хватает
+    ASSERT_EQUAL(run(peak)->GetPeak(), peak);
+    ASSERT_THROWS(run(peak / 2), runtime::MemoryLimitExceeded);
+}
+
+void TestCycleCollection() {
+    // Каждый вызов pair создаёт пару узлов, которые ссылаются друг на друга
+    const string program = R"(
+class Node:
+  def __init__():
+    self.other = None
+
+  def link(other):
+    self.other = other
+
+class Maker:
+  def pair():
+    a = Node()
+    b = Node()
+    a.link(b)
+    b.link(a)
+
+  def make(n):
+    if n > 0:
+      self.pair()
+      self.make(n - 1)
+
+m = Maker()
+m.make(200)
+print 'done'
+)"s;
+    auto tree = ParseProgramFromString(program);
+    // Возвращает пиковый расход памяти и память, занятую после выполнения программы
+    // до разрушения контекста. После разрушения контекста память должна освободиться
+    auto run = [&tree](size_t threshold) {
+        shared_ptr<runtime::MemoryAccount> account;
+        size_t left = 0;
+        {
+            runtime::DummyContext context;
+            context.SetLimits(runtime::ExecutionLimits{0, 1 << 24});
+            context.SetCollectorOptions(runtime::CollectorOptions{threshold, 1.0});
+            account = context.GetMemoryAccount();
+            {
+                runtime::Closure closure = runtime::MakeClosure(context);
+                tree->Execute(closure, context);
+                ASSERT_EQUAL(context.output.str(), "done\n"s);
+            }
+            left = account->GetUsed();
+        }
+        ASSERT_EQUAL(account->GetUsed(), 0U);
+        return pair{account->GetPeak(), left};
+    };
+
+    // С большим порогом циклы освобождаются только вместе с контекстом
+    const auto [late_peak, late_left] = run(100000);
+    ASSERT(late_left > 0U);
+    // С малым порогом циклы освобождаются во время выполнения
+    const auto [early_peak, early_left] = run(16);
+    ASSERT(early_left < late_left);
+    // Пиковый расход остаётся большим из-за переменных 200 вложенных вызовов make
+    ASSERT(early_peak * 2 < late_peak);
+
+    // Цикл создан прологом, который выполняется в своём контексте, а основная часть удаляет
+    // последние ссылки на него. Цикл освобождает сборщик основной части - и тогда, когда
+    // переменные пролога восстановлены из снимка
+    const string prologue = R"(
+class Node:
+  def __init__():
+    self.other = None
+
+  def link(other):
+    self.other = other
+
+a = Node()
+b = Node()
+a.link(b)
+b.link(a)
+)"s;
+    auto split = ParseProgramWithPrologue(prologue, "a = None\nb = None\n"s);
+    const auto snapshot_path = filesystem::temp_directory_path() / "mython_cycle_test.bin"s;
+    auto run_main = [&split](runtime::Closure& closure, runtime::Context& context) {
+        runtime::CycleCollector& collector = *context.GetCollector();
+        collector.TrackReachable(closure);
+        ASSERT_EQUAL(collector.GetStats().tracked, 2U);
+        const size_t used = context.GetMemoryAccount()->GetUsed();
+        split.main->Execute(closure, context);
+        ASSERT_EQUAL(collector.Collect(), 2U);
+        ASSERT(context.GetMemoryAccount()->GetUsed() < used);
+    };
+    {
+        runtime::DummyContext context;
+        context.SetLimits(runtime::ExecutionLimits{0, 1 << 20});
+        runtime::Closure closure = runtime::MakeClosure(context);
+        {
+            runtime::DummyContext prologue_context;
+            prologue_context.SetMemoryAccount(context.GetMemoryAccount());
+            split.prologue->Execute(closure, prologue_context);
+            runtime::SaveSnapshot(snapshot_path, prologue, {}, true, closure,
+                                  split.prologue_classes);
+        }
+        run_main(closure, context);
+    }
+    {
+        runtime::DummyContext context;
+        context.SetLimits(runtime::ExecutionLimits{0, 1 << 20});
+        runtime::Closure closure = runtime::MakeClosure(context);
+        runtime::Snapshot(snapshot_path).Restore(closure, split.prologue_classes, context);
+        run_main(closure, context);
+    }
+    filesystem::remove(snapshot_path);
+}
+
+void TestReceiverOutlivesArguments() {
+    // Вычисление аргумента удаляет последнюю ссылку на экземпляр, у которого вызывается метод
+    const string program = R"(
+class Inner:
+  def __init__():
+    self.value = "inner"
+
+  def get(unused):
+    return self.value
+
+class Outer:
+  def __init__():
+    self.inner = Inner()
+
+  def clear():
+    self.inner = None
+    return 0
+
+outer = Outer()
+print outer.inner.get(outer.clear()), outer.inner
+)"s;
+
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    ParseProgramFromString(program)->Execute(closure, context);
+    ASSERT_EQUAL(context.output.str(), "inner None\n"s);
+}
+
 }  // namespace parse
 
 void TestParseProgram(TestRunner& tr) {
@@ -256,4 +981,17 @@ void TestParseProgram(TestRunner& tr) {
     RUN_TEST(tr, parse::TestRecursion2);
     RUN_TEST(tr, parse::TestComplexLogicalExpression);
     RUN_TEST(tr, parse::TestClassicalPolymorphism);
+    RUN_TEST(tr, parse::TestPrintWithNestedOutput);
+    RUN_TEST(tr, parse::TestOperatorPrecedence);
+    RUN_TEST(tr, parse::TestLazyMethodBodies);
+    RUN_TEST(tr, parse::TestParallelParse);
+    RUN_TEST(tr, parse::TestThreadPoolStealing);
+    RUN_TEST(tr, parse::TestIncrementalParse);
+    RUN_TEST(tr, parse::TestProgramWithPrologue);
+    RUN_TEST(tr, parse::TestReentrantProgram);
+    RUN_TEST(tr, parse::TestExecutionFuel);
+    RUN_TEST(tr, parse::TestCancellation);
+    RUN_TEST(tr, parse::TestMemoryLimit);
+    RUN_TEST(tr, parse::TestCycleCollection);
+    RUN_TEST(tr, parse::TestReceiverOutlivesArguments);
 }
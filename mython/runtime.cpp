@@ -2,8 +2,12 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <mutex>
 #include <optional>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace std;
 
@@ -36,6 +40,155 @@ bool Compare(const runtime::ObjectHolder& lhs, const runtime::ObjectHolder& rhs,
 namespace runtime
 {
 
+namespace
+{
+
+const Symbol SELF = "self"sv;
+// Имена специальных методов в порядке SpecialMethod
+const array<Symbol, static_cast<size_t>(SpecialMethod::COUNT)> SPECIAL_METHOD_NAMES = {
+    "__str__"sv, "__eq__"sv, "__lt__"sv, "__add__"sv, "__init__"sv,
+};
+
+[[noreturn]] void ThrowMissingMethod(const Class& cls, Symbol method, size_t argument_count)
+{
+    throw std::runtime_error("Class "s + cls.GetName() + " don't have method "s +
+                             std::string(method.GetName()) +
+                             " with "s + std::to_string(argument_count) +
+                             " argemets."s);
+}
+
+// Deleter невладеющего ObjectHolder
+struct NonOwningDeleter
+{
+    void operator()(Object* /*object*/) const noexcept
+    {
+    }
+};
+
+// Ключ таблицы интернированных строк: текст строки и его заранее вычисленный хэш
+struct InternKey
+{
+    std::string_view text;
+    size_t hash;
+
+    bool operator==(const InternKey& other) const
+    {
+        return text == other.text;
+    }
+};
+
+struct InternKeyHash
+{
+    size_t operator()(const InternKey& key) const
+    {
+        return key.hash;
+    }
+};
+
+// Интернированная строка. Ключ ссылается на её текст, а строка удаляет себя из таблицы
+// при разрушении
+struct InternEntry
+{
+    const String* string;
+    std::weak_ptr<String> weak;
+};
+
+struct InternTable
+{
+    std::mutex mutex;
+    std::unordered_map<InternKey, InternEntry, InternKeyHash> strings;
+};
+
+InternTable& GetInternTable()
+{
+    // Таблица не разрушается, чтобы её пережили строки, которые освобождаются при выходе
+    static auto* table = new InternTable();
+    return *table;
+}
+
+}  // namespace
+
+void Context::ThrowFuelExhausted()
+{
+    throw FuelExhausted("Execution fuel exhausted"s);
+}
+
+void Context::ThrowCancelled()
+{
+    throw ExecutionCancelled("Execution cancelled"s);
+}
+
+void MemoryAccount::ThrowLimitExceeded() const
+{
+    throw MemoryLimitExceeded("Memory limit of "s + std::to_string(limit_) + " bytes exceeded"s);
+}
+
+Context::~Context() = default;
+
+CycleCollector* Context::GetCollector()
+{
+    if (!collector_ && collector_options_.threshold > 0)
+    {
+        collector_ = std::make_unique<CycleCollector>(collector_options_);
+    }
+    return collector_.get();
+}
+
+String::String(const String& other)
+    : ValueObject<std::string>(other)
+{
+}
+
+String::String(String&& other) noexcept
+    : ValueObject<std::string>(std::move(other))
+{
+}
+
+String::~String()
+{
+    if (interned_)
+    {
+        InternTable& table = GetInternTable();
+        std::lock_guard lock(table.mutex);
+        // Пока строка разрушалась, её место в таблице могла занять новая строка с тем же текстом
+        if (auto it = table.strings.find(InternKey{GetValue(), hash_});
+            it != table.strings.end() && it->second.string == this)
+        {
+            table.strings.erase(it);
+        }
+    }
+}
+
+size_t String::GetHash() const
+{
+    return interned_ ? hash_ : std::hash<std::string_view>()(GetValue());
+}
+
+std::shared_ptr<String> InternString(std::string text)
+{
+    const size_t hash = std::hash<std::string_view>()(text);
+    InternTable& table = GetInternTable();
+    std::lock_guard lock(table.mutex);
+    if (auto it = table.strings.find(InternKey{text, hash}); it != table.strings.end())
+    {
+        if (auto existing = it->second.weak.lock())
+        {
+            return existing;
+        }
+        table.strings.erase(it);
+    }
+    auto result = std::make_shared<String>(std::move(text));
+    result->interned_ = true;
+    result->hash_ = hash;
+    table.strings.emplace(InternKey{result->GetValue(), hash}, InternEntry{result.get(), result});
+    return result;
+}
+
+Closure MakeClosure(const Context& context)
+{
+    return Closure(Closure::allocator_type(context.GetMemoryAccount()));
+}
+
 ObjectHolder::ObjectHolder(std::shared_ptr<Object> data)
     : data_(std::move(data))
 {
@@ -46,10 +199,41 @@ void ObjectHolder::AssertIsValid() const
     assert(data_ != nullptr);
 }
 
+ObjectHolder ObjectHolder::FromShared(std::shared_ptr<Object> data)
+{
+    return ObjectHolder(std::move(data));
+}
+
+bool ObjectHolder::IsUniquelyOwned() const
+{
+    // У невладеющего shared_ptr свой счётчик ссылок, который ничего не говорит о владельце
+    return data_.use_count() == 1 && !std::get_deleter<NonOwningDeleter>(data_);
+}
+
 ObjectHolder ObjectHolder::Share(Object& object)
 {
     // Возвращаем невладеющий shared_ptr (его deleter ничего не делает)
-    return ObjectHolder(std::shared_ptr<Object>(&object, [](auto* /*p*/) { /* do nothing */ }));
+    return ObjectHolder(std::shared_ptr<Object>(&object, NonOwningDeleter{}));
+}
+
+void Object::Format(std::string& out, Context& context)
+{
+    ostringstream os;
+    Print(os, context);
+    out += os.str();
+}
+
+void FormatScope::WriteTo(std::ostream& os)
+{
+    os.write(buffer_.data() + start_, static_cast<streamsize>(buffer_.size() - start_));
+    buffer_.resize(start_);
+}
+
+std::string FormatScope::Take()
+{
+    std::string result(buffer_, start_);
+    buffer_.resize(start_);
+    return result;
 }
 
 ObjectHolder ObjectHolder::None()
@@ -98,17 +282,38 @@ bool IsTrue(const ObjectHolder& object)
 
 void ClassInstance::Print(std::ostream& os, Context& context)
 {
-    if (HasMethod("__str__"s, 0))
+    if (const Method* str = cls_.GetSpecialMethod(SpecialMethod::STR);
+        str && str->formal_params.empty())
     {
-        Call("__str__"s, {}, context)->Print(os, context);
+        Call(*str, {}, context)->Print(os, context);
     }
     else
     {
+        context.MarkOutputNondeterministic();
         os << this;
     }
 }
 
-bool ClassInstance::HasMethod(const std::string& method, size_t argument_count) const
+void ClassInstance::Format(std::string& out, Context& context)
+{
+    if (const Method* str = cls_.GetSpecialMethod(SpecialMethod::STR);
+        str && str->formal_params.empty())
+    {
+        Call(*str, {}, context)->Format(out, context);
+    }
+    else
+    {
+        context.MarkOutputNondeterministic();
+        // Так же, как адрес выводит поток вывода
+        out += "0x"sv;
+        array<char, sizeof(uintptr_t) * 2> buffer;
+        const auto result = to_chars(buffer.data(), buffer.data() + buffer.size(),
+                                     reinterpret_cast<uintptr_t>(this), 16);
+        out.append(buffer.data(), result.ptr);
+    }
+}
+
+bool ClassInstance::HasMethod(Symbol method, size_t argument_count) const
 {
     if (const Method* mtd = cls_.GetMethod(method))
     {
@@ -127,43 +332,100 @@ const Closure& ClassInstance::Fields() const
     return closure_;
 }
 
+const Class& ClassInstance::GetClass() const
+{
+    return cls_;
+}
+
 ClassInstance::ClassInstance(const Class& cls)
     : cls_(cls)
 {
 }
 
-ObjectHolder ClassInstance::Call(const std::string& method,
-                                 const std::vector<ObjectHolder>& actual_args,
-                                 Context& context)
+ClassInstance::ClassInstance(const Class& cls, const Closure::allocator_type& allocator)
+    : cls_(cls), closure_(allocator)
+{
+}
+
+ClassInstance::ClassInstance(const ClassInstance& other)
+    : Object(other), enable_shared_from_this(other), cls_(other.cls_), closure_(other.closure_)
+{
+}
+
+ClassInstance::ClassInstance(ClassInstance&& other)
+    : Object(other), enable_shared_from_this(other), cls_(other.cls_),
+      closure_(std::move(other.closure_))
 {
-    if (!HasMethod(method, actual_args.size()))
+}
+
+ClassInstance::~ClassInstance()
+{
+    if (collector_)
     {
-        throw std::runtime_error("Class "s + cls_.GetName() + " don't have method "s + method +
-                                 " with "s + std::to_string(actual_args.size()) +
-                                 " argemets."s);
+        collector_->Untrack(*this);
     }
+}
 
+ObjectHolder ClassInstance::Call(Symbol method, const std::vector<ObjectHolder>& actual_args,
+                                 Context& context)
+{
     const Method* mtd = cls_.GetMethod(method);
-    Closure closure;
-    closure["self"s] = ObjectHolder::Share(*this);
+    if (!mtd)
+    {
+        ThrowMissingMethod(cls_, method, actual_args.size());
+    }
+    return Call(*mtd, actual_args, context);
+}
+
+ObjectHolder ClassInstance::Call(SpecialMethod method, const std::vector<ObjectHolder>& actual_args,
+                                 Context& context)
+{
+    const Method* mtd = cls_.GetSpecialMethod(method);
+    if (!mtd)
+    {
+        ThrowMissingMethod(cls_, SPECIAL_METHOD_NAMES[static_cast<size_t>(method)],
+                           actual_args.size());
+    }
+    return Call(*mtd, actual_args, context);
+}
+
+ObjectHolder ClassInstance::Call(const Method& method, const std::vector<ObjectHolder>& actual_args,
+                                 Context& context)
+{
+    if (method.formal_params.size() != actual_args.size())
+    {
+        ThrowMissingMethod(cls_, method.name, actual_args.size());
+    }
+
+    Closure closure = MakeClosure(context);
+    if (auto self = weak_from_this().lock())
+    {
+        closure[SELF] = ObjectHolder::FromShared(std::move(self));
+    }
+    else
+    {
+        closure[SELF] = ObjectHolder::Share(*this);
+    }
 
     size_t index = 0;
-    for (const string& param : mtd->formal_params)
+    for (Symbol param : method.formal_params)
     {
-        closure[param] = actual_args.at(index++);
+        closure[param] = actual_args[index++];
     }
 
-    return mtd->body->Execute(closure, context);
+    context.Step();
+    return method.body->Execute(closure, context);
 }
 
 Class::Class(std::string name, std::vector<Method> methods, const Class* parent)
     : name_(move(name)), methods_(move(methods)), parent_(parent)
 {
+    ResolveSpecialMethods();
 }
 
-const Method* Class::GetMethod(const std::string& name) const
+const Method* Class::GetMethod(Symbol name) const
 {
-    auto method = find_if(methods_.begin(), methods_.end(), [&name](const Method& mtd)
+    auto method = find_if(methods_.begin(), methods_.end(), [name](const Method& mtd)
         {
             return mtd.name == name;
         });
@@ -183,27 +445,86 @@ const std::string& Class::GetName() const
     return name_;
 }
 
+void Class::SetParent(const Class* parent)
+{
+    parent_ = parent;
+    ResolveSpecialMethods();
+}
+
+void Class::ResolveSpecialMethods()
+{
+    for (size_t i = 0; i < special_methods_.size(); ++i)
+    {
+        const Symbol name = SPECIAL_METHOD_NAMES[i];
+        auto method = find_if(methods_.begin(), methods_.end(), [name](const Method& mtd)
+            {
+                return mtd.name == name;
+            });
+        if (method != methods_.end())
+        {
+            special_methods_[i] = &*method;
+        }
+        else
+        {
+            // Специальные методы родителя уже найдены
+            special_methods_[i] = parent_ ? parent_->special_methods_[i] : nullptr;
+        }
+    }
+}
+
+ObjectHolder Class::CreateInstance(Context& context) const
+{
+    const auto& account = context.GetMemoryAccount();
+    return ObjectHolder::FromShared(std::allocate_shared<ClassInstance>(
+        SlabAllocator<ClassInstance>(instance_pool_, account), *this,
+        Closure::allocator_type(account)));
+}
+
+const util::SlabPool& Class::GetInstancePool() const
+{
+    return *instance_pool_;
+}
+
 void Class::Print(ostream& os, [[maybe_unused]] Context& context)
 {
     os << "Class "s << name_;
 }
 
+void Class::Format(std::string& out, [[maybe_unused]] Context& context)
+{
+    out += "Class "sv;
+    out += name_;
+}
+
 void Bool::Print(std::ostream& os, [[maybe_unused]] Context& context)
 {
     os << (GetValue() ? "True"sv : "False"sv);
 }
 
+void Bool::Format(std::string& out, [[maybe_unused]] Context& context)
+{
+    out += GetValue() ? "True"sv : "False"sv;
+}
+
 bool Equal(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context)
 {
     ClassInstance* cls_inst = lhs.TryAs<ClassInstance>();
     if (cls_inst)
     {
-        return IsTrue(cls_inst->Call("__eq__"s, {rhs}, context));
+        return IsTrue(cls_inst->Call(SpecialMethod::EQ, {rhs}, context));
     }
     else if (!lhs && !rhs)
     {
         return true;
     }
+    // Одинаковые интернированные строки - один и тот же объект
+    if (const String* lhs_string = lhs.TryAs<String>(); lhs_string && lhs_string->IsInterned())
+    {
+        if (const String* rhs_string = rhs.TryAs<String>(); rhs_string && rhs_string->IsInterned())
+        {
+            return lhs_string == rhs_string;
+        }
+    }
     return Compare(lhs, rhs, equal_to());
 }
 
@@ -212,7 +533,7 @@ bool Less(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context)
     ClassInstance* cls_inst = lhs.TryAs<ClassInstance>();
     if (cls_inst)
     {
-        return IsTrue(cls_inst->Call("__lt__"s, {rhs}, context));
+        return IsTrue(cls_inst->Call(SpecialMethod::LT, {rhs}, context));
     }
     return Compare(lhs, rhs, less());
 }
@@ -237,4 +558,166 @@ bool GreaterOrEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& c
     return !Less(lhs, rhs, context);
 }
 
+CycleCollector::CycleCollector(const CollectorOptions& options)
+    : options_(options), next_collection_(options.threshold)
+{
+}
+
+CycleCollector::~CycleCollector()
+{
+    Collect();
+    for (ClassInstance* instance : tracked_)
+    {
+        instance->collector_ = nullptr;
+    }
+}
+
+void CycleCollector::Track(ClassInstance& instance)
+{
+    instance.collector_ = this;
+    instance.collector_index_ = tracked_.size();
+    tracked_.push_back(&instance);
+    if (tracked_.size() >= next_collection_)
+    {
+        Collect();
+    }
+}
+
+void CycleCollector::TrackReachable(const Closure& roots)
+{
+    // Экземпляры сначала находятся, а затем добавляются в список все сразу:
+    // сборка, начатая посреди обхода, считала бы ещё не добавленные экземпляры внешними
+    vector<ClassInstance*> found;
+    unordered_set<const ClassInstance*> visited;
+    vector<const Closure*> pending{&roots};
+    while (!pending.empty())
+    {
+        const Closure* closure = pending.back();
+        pending.pop_back();
+        for (const auto& [name, value] : *closure)
+        {
+            auto* instance = value.TryAs<ClassInstance>();
+            if (!instance || !visited.insert(instance).second)
+            {
+                continue;
+            }
+            if (!instance->collector_ && !instance->weak_from_this().expired())
+            {
+                found.push_back(instance);
+            }
+            pending.push_back(&instance->closure_);
+        }
+    }
+    for (ClassInstance* instance : found)
+    {
+        instance->collector_ = this;
+        instance->collector_index_ = tracked_.size();
+        tracked_.push_back(instance);
+    }
+    if (tracked_.size() >= next_collection_)
+    {
+        Collect();
+    }
+}
+
+void CycleCollector::Untrack(ClassInstance& instance) noexcept
+{
+    ClassInstance* last = tracked_.back();
+    last->collector_index_ = instance.collector_index_;
+    tracked_[instance.collector_index_] = last;
+    tracked_.pop_back();
+    instance.collector_ = nullptr;
+}
+
+size_t CycleCollector::Collect()
+{
+    ++stats_.collections;
+
+    // Число ссылок на каждый экземпляр, которые не объясняются полями других отслеживаемых
+    // экземпляров. Такие ссылки приходят из переменных, вызовов методов и временных значений
+    // интерпретатора и делают экземпляр достижимым
+    vector<long> external(tracked_.size());
+    for (size_t i = 0; i < tracked_.size(); ++i)
+    {
+        external[i] = tracked_[i]->weak_from_this().use_count();
+    }
+    auto tracked_target = [this](const ObjectHolder& value) -> ClassInstance* {
+        auto* target = value.TryAs<ClassInstance>();
+        return target && target->collector_ == this ? target : nullptr;
+    };
+    for (ClassInstance* instance : tracked_)
+    {
+        for (const auto& [name, value] : instance->closure_)
+        {
+            // Невладеющая ссылка не входит в счётчик ссылок
+            if (ClassInstance* target = tracked_target(value);
+                target && value.SharesOwnershipWith(target->weak_from_this()))
+            {
+                --external[target->collector_index_];
+            }
+        }
+    }
+
+    // Всё, что достижимо через поля из экземпляров со ссылками извне, тоже достижимо
+    vector<bool> reachable(tracked_.size());
+    vector<ClassInstance*> pending;
+    for (size_t i = 0; i < tracked_.size(); ++i)
+    {
+        if (external[i] > 0)
+        {
+            reachable[i] = true;
+            pending.push_back(tracked_[i]);
+        }
+    }
+    while (!pending.empty())
+    {
+        ClassInstance* instance = pending.back();
+        pending.pop_back();
+        for (const auto& [name, value] : instance->closure_)
+        {
+            if (ClassInstance* target = tracked_target(value);
+                target && !reachable[target->collector_index_])
+            {
+                reachable[target->collector_index_] = true;
+                pending.push_back(target);
+            }
+        }
+    }
+
+    // Недостижимые экземпляры удерживаются, пока очищаются их поля, чтобы список
+    // отслеживаемых экземпляров не менялся во время обхода
+    vector<shared_ptr<ClassInstance>> garbage;
+    for (size_t i = 0; i < tracked_.size(); ++i)
+    {
+        if (!reachable[i])
+        {
+            garbage.push_back(tracked_[i]->shared_from_this());
+        }
+    }
+    vector<Closure> fields;
+    fields.reserve(garbage.size());
+    for (const auto& instance : garbage)
+    {
+        fields.push_back(std::move(instance->closure_));
+        instance->closure_.clear();
+    }
+    fields.clear();
+    const size_t collected = garbage.size();
+    garbage.clear();
+
+    stats_.collected += collected;
+    next_collection_ = tracked_.size()
+                       + max(options_.threshold,
+                             static_cast<size_t>(static_cast<double>(tracked_.size())
+                                                 * options_.growth));
+    return collected;
+}
+
+CollectorStats CycleCollector::GetStats() const
+{
+    CollectorStats stats = stats_;
+    stats.tracked = tracked_.size();
+    return stats;
+}
+
 }  // namespace runtime
@@ -1,14 +1,289 @@
 #pragma once
 
+#include "flat_map.h"
+#include "slab_pool.h"
+#include "symbol.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 namespace runtime
 {
 
+// Ограничения на выполнение программы. Нулевое значение означает, что ограничения нет
+struct ExecutionLimits
+{
+    // Сколько единиц топлива может израсходовать программа. Каждая выполненная инструкция
+    // блока и каждый вызов метода стоят одну единицу, поэтому расход не зависит
+    // от скорости машины и одинаков при каждом запуске
+    uint64_t fuel = 0;
+    // Сколько байт могут занимать объекты программы, их поля и переменные вызовов
+    size_t memory = 0;
+};
+
+// Программа израсходовала всё топливо, отведённое ей ExecutionLimits
+struct FuelExhausted : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// Программе не хватило памяти, отведённой ей ExecutionLimits
+struct MemoryLimitExceeded : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// Счётчик памяти, которую занимают объекты одной программы, их поля и переменные вызовов.
+// Счётчик не синхронизирован: объекты программы создаются и освобождаются в одном потоке
+class MemoryAccount
+{
+public:
+    // limit - сколько байт может занимать программа, 0 - без ограничения
+    explicit MemoryAccount(size_t limit = 0) noexcept
+        : limit_(limit)
+    {
+    }
+
+    // Учитывает size байт. Выбрасывает MemoryLimitExceeded, если они не помещаются в лимит
+    void Allocate(size_t size)
+    {
+        if (limit_ != 0 && size > limit_ - used_)
+        {
+            ThrowLimitExceeded();
+        }
+        used_ += size;
+        peak_ = std::max(peak_, used_);
+    }
+
+    void Release(size_t size) noexcept
+    {
+        used_ -= size;
+    }
+
+    // Возвращает, сколько байт занято сейчас
+    [[nodiscard]] size_t GetUsed() const noexcept
+    {
+        return used_;
+    }
+
+    // Возвращает наибольшее количество байт, занятых одновременно
+    [[nodiscard]] size_t GetPeak() const noexcept
+    {
+        return peak_;
+    }
+
+private:
+    [[noreturn]] void ThrowLimitExceeded() const;
+
+    size_t limit_;
+    size_t used_ = 0;
+    size_t peak_ = 0;
+};
+
+// Распределитель памяти, который учитывает выделенные байты в счётчике. Без счётчика
+// работает как std::allocator. Вместе с каждым выделением учитывается ещё extra байт -
+// память, которую объект занимает сам, например текст строки.
+// Распределитель владеет счётчиком, поэтому объект может пережить выполнение программы
+template <typename T>
+class AccountedAllocator
+{
+public:
+    using value_type = T;
+
+    AccountedAllocator() noexcept = default;
+
+    explicit AccountedAllocator(std::shared_ptr<MemoryAccount> account, size_t extra = 0) noexcept
+        : account_(std::move(account)), extra_(extra)
+    {
+    }
+
+    template <typename U>
+    AccountedAllocator(const AccountedAllocator<U>& other) noexcept  // NOLINT(google-explicit-constructor)
+        : account_(other.account_), extra_(other.extra_)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        if (!account_)
+        {
+            return std::allocator<T>().allocate(n);
+        }
+        account_->Allocate(n * sizeof(T) + extra_);
+        try
+        {
+            return std::allocator<T>().allocate(n);
+        }
+        catch (...)
+        {
+            account_->Release(n * sizeof(T) + extra_);
+            throw;
+        }
+    }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        std::allocator<T>().deallocate(p, n);
+        if (account_)
+        {
+            account_->Release(n * sizeof(T) + extra_);
+        }
+    }
+
+    [[nodiscard]] const std::shared_ptr<MemoryAccount>& GetAccount() const noexcept
+    {
+        return account_;
+    }
+
+    template <typename U>
+    bool operator==(const AccountedAllocator<U>& other) const noexcept
+    {
+        return account_ == other.account_;
+    }
+
+    template <typename U>
+    bool operator!=(const AccountedAllocator<U>& other) const noexcept
+    {
+        return account_ != other.account_;
+    }
+
+private:
+    template <typename U>
+    friend class AccountedAllocator;
+
+    std::shared_ptr<MemoryAccount> account_;
+    size_t extra_ = 0;
+};
+
+// Распределитель памяти, который выделяет объекты по одному из ячеек пула, а остальные
+// запросы передаёт std::allocator. Выделенные байты, как и в AccountedAllocator, учитываются
+// в счётчике, если он задан. Распределитель владеет пулом, поэтому объект может пережить
+// владельца пула
+template <typename T>
+class SlabAllocator
+{
+public:
+    using value_type = T;
+
+    SlabAllocator(std::shared_ptr<util::SlabPool> pool,
+                  std::shared_ptr<MemoryAccount> account) noexcept
+        : pool_(std::move(pool)), account_(std::move(account))
+    {
+    }
+
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U>& other) noexcept  // NOLINT(google-explicit-constructor)
+        : pool_(other.pool_), account_(other.account_)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        static_assert(alignof(T) <= alignof(std::max_align_t));
+        if (account_)
+        {
+            account_->Allocate(n * sizeof(T));
+        }
+        try
+        {
+            if (void* slot = n == 1 ? pool_->Allocate(sizeof(T)) : nullptr)
+            {
+                return static_cast<T*>(slot);
+            }
+            return std::allocator<T>().allocate(n);
+        }
+        catch (...)
+        {
+            if (account_)
+            {
+                account_->Release(n * sizeof(T));
+            }
+            throw;
+        }
+    }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        if (n != 1 || !pool_->Deallocate(p, sizeof(T)))
+        {
+            std::allocator<T>().deallocate(p, n);
+        }
+        if (account_)
+        {
+            account_->Release(n * sizeof(T));
+        }
+    }
+
+    template <typename U>
+    bool operator==(const SlabAllocator<U>& other) const noexcept
+    {
+        return pool_ == other.pool_ && account_ == other.account_;
+    }
+
+    template <typename U>
+    bool operator!=(const SlabAllocator<U>& other) const noexcept
+    {
+        return !(*this == other);
+    }
+
+private:
+    template <typename U>
+    friend class SlabAllocator;
+
+    std::shared_ptr<util::SlabPool> pool_;
+    std::shared_ptr<MemoryAccount> account_;
+};
+
+// Выполнение программы отменено через CancellationToken
+struct ExecutionCancelled : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// Флаг отмены выполнения. Его может взвести любой поток или обработчик сигнала,
+// а программа заметит отмену на ближайшей инструкции блока или вызове метода
+class CancellationToken
+{
+public:
+    void Cancel() noexcept
+    {
+        cancelled_.store(true, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool IsCancelled() const noexcept
+    {
+        return cancelled_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<bool> cancelled_ = false;
+};
+
+class CycleCollector;
+
+// Настройки сборщика циклов
+struct CollectorOptions
+{
+    // Сколько экземпляров классов должно появиться после сборки, чтобы началась следующая.
+    // 0 - сборщик выключен, и экземпляры, которые ссылаются друг на друга, не освобождаются
+    size_t threshold = 1000;
+    // Во сколько раз по отношению к числу экземпляров, переживших сборку, должно вырасти
+    // их число до следующей сборки. Порог при этом не опускается ниже threshold
+    double growth = 1.0;
+};
+
 // Контекст исполнения инструкций Mython
 class Context
 {
@@ -16,10 +291,164 @@ public:
     // Возвращает поток вывода для команд print
     virtual std::ostream& GetOutputStream() = 0;
 
+    // Возвращает буфер, в котором инструкции контекста форматируют значения.
+    // Буфер занимают через FormatScope, чтобы вложенные вызовы не портили текст друг друга
+    std::string& GetFormatBuffer()
+    {
+        return format_buffer_;
+    }
+
+    // Отмечает, что программа вывела адрес объекта. Такой вывод может отличаться
+    // от запуска к запуску
+    void MarkOutputNondeterministic()
+    {
+        output_deterministic_ = false;
+    }
+
+    // Возвращает true, если вывод программы зависит только от её текста
+    [[nodiscard]] bool IsOutputDeterministic() const
+    {
+        return output_deterministic_;
+    }
+
+    // Устанавливает ограничения на дальнейшее выполнение программы. Если ограничена память,
+    // создаётся новый счётчик памяти
+    void SetLimits(const ExecutionLimits& limits)
+    {
+        fuel_ = limits.fuel == 0 ? std::numeric_limits<uint64_t>::max() : limits.fuel;
+        memory_ = limits.memory == 0 ? nullptr : std::make_shared<MemoryAccount>(limits.memory);
+    }
+
+    // Списывает amount единиц топлива. Выбрасывает FuelExhausted, если топлива не хватает.
+    // Без ограничения запас топлива настолько велик, что проверка не срабатывает,
+    // и её цена - одно сравнение
+    void ConsumeFuel(uint64_t amount = 1)
+    {
+        if (fuel_ < amount)
+        {
+            ThrowFuelExhausted();
+        }
+        fuel_ -= amount;
+    }
+
+    // Возвращает оставшийся запас топлива
+    [[nodiscard]] uint64_t GetFuelLeft() const
+    {
+        return fuel_;
+    }
+
+    // Устанавливает флаг, по которому другой поток может отменить выполнение.
+    // Флаг должен существовать, пока выполняется программа. nullptr - без отмены
+    void SetCancellationToken(const CancellationToken* token)
+    {
+        cancellation_ = token;
+    }
+
+    [[nodiscard]] const CancellationToken* GetCancellationToken() const
+    {
+        return cancellation_;
+    }
+
+    // Устанавливает счётчик, в котором учитывается память объектов, созданных инструкциями
+    // контекста. nullptr - память не учитывается
+    void SetMemoryAccount(std::shared_ptr<MemoryAccount> account)
+    {
+        memory_ = std::move(account);
+    }
+
+    [[nodiscard]] const std::shared_ptr<MemoryAccount>& GetMemoryAccount() const
+    {
+        return memory_;
+    }
+
+    // Задаёт настройки сборщика циклов. Вызывается до создания первого экземпляра класса
+    void SetCollectorOptions(const CollectorOptions& options)
+    {
+        collector_options_ = options;
+    }
+
+    // Возвращает сборщик циклов, который следит за экземплярами классов, созданными
+    // инструкциями контекста, или nullptr, если сборщик выключен
+    [[nodiscard]] CycleCollector* GetCollector();
+
+    // Отмечает шаг выполнения: списывает единицу топлива и проверяет, не отменено ли
+    // выполнение. Выбрасывает FuelExhausted или ExecutionCancelled
+    void Step()
+    {
+        ConsumeFuel();
+        if (cancellation_ != nullptr && cancellation_->IsCancelled())
+        {
+            ThrowCancelled();
+        }
+    }
+
 protected:
-    ~Context() = default;
+    // Освобождает циклы из экземпляров, которые создала программа и на которые больше
+    // нет ссылок. Экземпляры, которые ещё используются, перестают отслеживаться
+    ~Context();
+
+private:
+    [[noreturn]] static void ThrowFuelExhausted();
+    [[noreturn]] static void ThrowCancelled();
+
+    std::string format_buffer_;
+    bool output_deterministic_ = true;
+    uint64_t fuel_ = std::numeric_limits<uint64_t>::max();
+    const CancellationToken* cancellation_ = nullptr;
+    std::shared_ptr<MemoryAccount> memory_;
+    CollectorOptions collector_options_;
+    std::unique_ptr<CycleCollector> collector_;
+};
+
+// Участок в конце буфера форматирования контекста, который занимает одна инструкция.
+// Вложенные инструкции занимают участки после него и освобождают их до возврата управления.
+// При разрушении участок освобождается
+class FormatScope
+{
+public:
+    explicit FormatScope(Context& context)
+        : buffer_(context.GetFormatBuffer()), start_(buffer_.size())
+    {
+    }
+
+    FormatScope(const FormatScope&) = delete;
+    FormatScope& operator=(const FormatScope&) = delete;
+
+    ~FormatScope()
+    {
+        buffer_.resize(start_);
+    }
+
+    // Возвращает буфер, в конец которого нужно дописывать текст
+    std::string& Buffer()
+    {
+        return buffer_;
+    }
+
+    // Записывает текст участка в os и очищает участок
+    void WriteTo(std::ostream& os);
+
+    // Возвращает текст участка и очищает участок
+    std::string Take();
+
+private:
+    std::string& buffer_;
+    size_t start_;
 };
 
+// Дописывает в out десятичную запись целого числа value
+template <typename T>
+void AppendInteger(std::string& out, T value)
+{
+    std::array<char, std::numeric_limits<T>::digits10 + 2> buffer;
+    const auto result = std::to_chars(buffer.data(), buffer.data() + buffer.size(), value);
+    out.append(buffer.data(), result.ptr);
+}
+
+template <typename T>
+class ValueObject;
+class String;
+
 // Базовый класс для всех объектов языка Mython
 class Object
 {
@@ -27,6 +456,9 @@ public:
     virtual ~Object() = default;
     // выводит в os своё представление в виде строки
     virtual void Print(std::ostream& os, Context& context) = 0;
+    // Дописывает в out своё представление в виде строки, то же, что выводит Print.
+    // Реализация по умолчанию вызывает Print со строковым потоком
+    virtual void Format(std::string& out, Context& context);
 };
 
 // Специальный класс-обёртка, предназначенный для хранения объекта в Mython-программе
@@ -45,6 +477,46 @@ public:
         return ObjectHolder(std::make_shared<T>(std::forward<T>(object)));
     }
 
+    // То же, что Own(object), но память объекта учитывается в счётчике памяти context.
+    // Выбрасывает MemoryLimitExceeded, если объект не помещается в лимит
+    template <typename T>
+    [[nodiscard]] static ObjectHolder Own(T&& object, Context& context)
+    {
+        using Type = std::decay_t<T>;
+        const auto& account = context.GetMemoryAccount();
+        if (!account)
+        {
+            return Own(std::forward<T>(object));
+        }
+        size_t extra = 0;
+        if constexpr (std::is_same_v<Type, String>)
+        {
+            // Короткие строки хранятся внутри объекта и отдельной памяти не занимают
+            if (const std::string& value = object.GetValue();
+                value.capacity() > std::string().capacity())
+            {
+                extra = value.capacity() + 1;
+            }
+        }
+        return ObjectHolder(std::allocate_shared<Type>(AccountedAllocator<Type>(account, extra),
+                                                       std::forward<T>(object)));
+    }
+
+    // Создаёт ObjectHolder, разделяющий владение объектом с data
+    [[nodiscard]] static ObjectHolder FromShared(std::shared_ptr<Object> data);
+
+    // Возвращает true, если ObjectHolder разделяет владение с owner. Невладеющий
+    // ObjectHolder, созданный через Share, не разделяет владения ни с чем
+    template <typename T>
+    [[nodiscard]] bool SharesOwnershipWith(const std::weak_ptr<T>& owner) const
+    {
+        return !data_.owner_before(owner) && !owner.owner_before(data_);
+    }
+
+    // Возвращает true, если ObjectHolder владеет объектом и других ссылок на объект нет.
+    // Такой объект можно изменить на месте: изменение не увидит никто, кроме владельца
+    [[nodiscard]] bool IsUniquelyOwned() const;
+
     // Создаёт ObjectHolder, не владеющий объектом (аналог слабой ссылки)
     [[nodiscard]] static ObjectHolder Share(Object& object);
     // Создаёт пустой ObjectHolder, соответствующий значению None
@@ -82,13 +554,38 @@ class ValueObject : public Object
 {
 public:
     ValueObject(T v)  // NOLINT(google-explicit-constructor,hicpp-explicit-conversions)
-        : value_(v)
+        : value_(std::move(v))
     {
     }
 
     void Print(std::ostream& os, [[maybe_unused]] Context& context) override
     {
-        os << value_;
+        if constexpr (IS_INTEGER)
+        {
+            std::array<char, std::numeric_limits<T>::digits10 + 2> buffer;
+            const auto result = std::to_chars(buffer.data(), buffer.data() + buffer.size(), value_);
+            os.write(buffer.data(), result.ptr - buffer.data());
+        }
+        else
+        {
+            os << value_;
+        }
+    }
+
+    void Format(std::string& out, Context& context) override
+    {
+        if constexpr (IS_INTEGER)
+        {
+            AppendInteger(out, value_);
+        }
+        else if constexpr (std::is_same_v<T, std::string>)
+        {
+            out += value_;
+        }
+        else
+        {
+            Object::Format(out, context);
+        }
     }
 
     [[nodiscard]] const T& GetValue() const
@@ -96,12 +593,28 @@ public:
         return value_;
     }
 
+    // Возвращает значение для изменения на месте. Менять значение можно, только пока объект
+    // не виден программе через другие ссылки, см. ObjectHolder::IsUniquelyOwned
+    [[nodiscard]] T& GetMutableValue()
+    {
+        return value_;
+    }
+
 private:
+    static constexpr bool IS_INTEGER = std::is_integral_v<T> && !std::is_same_v<T, bool>;
+
     T value_;
 };
 
-// Таблица символов, связывающая имя объекта с его значением
-using Closure = std::unordered_map<std::string, ObjectHolder>;
+// Таблица символов, связывающая имя объекта с его значением. Таблица, созданная
+// с распределителем контекста, учитывает свою память в его счётчике.
+// Первые несколько имён таблица хранит внутри себя, не выделяя памяти, поэтому учитывается
+// только память больших таблиц. Добавление имени делает недействительными ссылки на значения
+using Closure = util::FlatMap<Symbol, ObjectHolder, std::hash<Symbol>, std::equal_to<Symbol>,
+                              AccountedAllocator<std::pair<const Symbol, ObjectHolder>>>;
+
+// Создаёт пустую таблицу символов, которая учитывает свою память в счётчике памяти context
+Closure MakeClosure(const Context& context);
 
 // Проверяет, содержится ли в object значение, приводимое к True
 // Для отличных от нуля чисел, True и непустых строк возвращается true. В остальных случаях - false.
@@ -117,8 +630,38 @@ public:
     virtual ObjectHolder Execute(Closure& closure, Context& context) = 0;
 };
 
-// Строковое значение
-using String = ValueObject<std::string>;
+// Строковое значение. Строку можно интернировать: InternString возвращает для одинакового
+// текста один общий объект, поэтому интернированные строки сравниваются по адресу.
+// Интернированная строка не изменяется
+class String : public ValueObject<std::string>
+{
+public:
+    using ValueObject<std::string>::ValueObject;
+
+    // Копия интернированной строки не интернирована
+    String(const String& other);
+    String(String&& other) noexcept;
+
+    ~String() override;
+
+    [[nodiscard]] bool IsInterned() const
+    {
+        return interned_;
+    }
+
+    // Возвращает хэш текста. У интернированной строки хэш вычислен заранее
+    [[nodiscard]] size_t GetHash() const;
+
+private:
+    friend std::shared_ptr<String> InternString(std::string text);
+
+    bool interned_ = false;
+    size_t hash_ = 0;
+};
+
+// Возвращает интернированную строку с текстом text. Пока строка существует, для того же
+// текста возвращается тот же объект. Можно вызывать из нескольких потоков
+std::shared_ptr<String> InternString(std::string text);
 // Числовое значение
 using Number = ValueObject<int>;
 
@@ -129,18 +672,31 @@ public:
     using ValueObject<bool>::ValueObject;
 
     void Print(std::ostream& os, Context& context) override;
+    void Format(std::string& out, Context& context) override;
 };
 
 // Метод класса
 struct Method {
     // Имя метода
-    std::string name;
+    Symbol name;
     // Имена формальных параметров метода
-    std::vector<std::string> formal_params;
+    std::vector<Symbol> formal_params;
     // Тело метода
     std::unique_ptr<Executable> body;
 };
 
+// Специальные методы, которые интерпретатор вызывает сам: при выводе объекта,
+// сравнении, сложении и создании экземпляра
+enum class SpecialMethod : uint8_t
+{
+    STR,  // __str__
+    EQ,  // __eq__
+    LT,  // __lt__
+    ADD,  // __add__
+    INIT,  // __init__
+    COUNT,
+};
+
 // Класс
 class Class : public Object
 {
@@ -150,30 +706,70 @@ public:
     explicit Class(std::string name, std::vector<Method> methods, const Class* parent);
 
     // Возвращает указатель на метод name или nullptr, если метод с таким именем отсутствует
-    [[nodiscard]] const Method* GetMethod(const std::string& name) const;
+    [[nodiscard]] const Method* GetMethod(Symbol name) const;
+
+    // Возвращает специальный метод класса или его родителей, найденный при создании класса
+    // и при смене родителя, либо nullptr, если метода нет
+    [[nodiscard]] const Method* GetSpecialMethod(SpecialMethod method) const noexcept
+    {
+        return special_methods_[static_cast<size_t>(method)];
+    }
 
     // Возвращает имя класса
     [[nodiscard]] const std::string& GetName() const;
 
+    // Задаёт родительский класс, если он стал известен уже после создания класса.
+    // Специальные методы наследников, созданных раньше, не меняются: для них SetParent
+    // нужно вызвать снова
+    void SetParent(const Class* parent);
+
+    // Создаёт экземпляр класса. Экземпляры одного класса размещаются рядом в ячейках пула
+    // класса, и ячейки освобождённых экземпляров используются снова. Память экземпляра
+    // и его полей учитывается в счётчике памяти context.
+    // Выбрасывает MemoryLimitExceeded, если экземпляр не помещается в лимит
+    [[nodiscard]] ObjectHolder CreateInstance(Context& context) const;
+
+    // Возвращает пул, в котором размещаются экземпляры класса
+    [[nodiscard]] const util::SlabPool& GetInstancePool() const;
+
     // Выводит в os строку "Class <имя класса>", например "Class cat"
     void Print(std::ostream& os, Context& context) override;
+    void Format(std::string& out, Context& context) override;
 private:
+    // Находит специальные методы среди методов класса и его родителей
+    void ResolveSpecialMethods();
+
     std::string name_;
     std::vector<Method> methods_;
     const Class* parent_;
+    // Указывают на элементы methods_ этого класса и родителей. Перемещение класса
+    // не меняет адресов элементов вектора
+    std::array<const Method*, static_cast<size_t>(SpecialMethod::COUNT)> special_methods_{};
+    // Пулом владеют и распределители экземпляров, поэтому экземпляр может пережить класс
+    std::shared_ptr<util::SlabPool> instance_pool_ = std::make_shared<util::SlabPool>();
 };
 
-// Экземпляр класса
-class ClassInstance : public Object
+// Экземпляр класса. Экземпляр, созданный через ObjectHolder::Own, передаётся своим методам
+// в параметре self во владение, поэтому метод может вернуть self или сохранить его
+class ClassInstance : public Object, public std::enable_shared_from_this<ClassInstance>
 {
 public:
     explicit ClassInstance(const Class& cls);
+    // Создаёт экземпляр, таблица полей которого учитывает память в счётчике allocator
+    ClassInstance(const Class& cls, const Closure::allocator_type& allocator);
+
+    // Копия экземпляра не отслеживается сборщиком циклов
+    ClassInstance(const ClassInstance& other);
+    ClassInstance(ClassInstance&& other);
+
+    ~ClassInstance() override;
 
     /*
      * Если у объекта есть метод __str__, выводит в os результат, возвращённый этим методом.
      * В противном случае в os выводится адрес объекта.
      */
     void Print(std::ostream& os, Context& context) override;
+    void Format(std::string& out, Context& context) override;
 
     /*
      * Вызывает у объекта метод method, передавая ему actual_args параметров.
@@ -181,20 +777,89 @@ public:
      * Если ни сам класс, ни его родители не содержат метод method, метод выбрасывает исключение
      * runtime_error
      */
-    ObjectHolder Call(const std::string& method, const std::vector<ObjectHolder>& actual_args,
+    ObjectHolder Call(Symbol method, const std::vector<ObjectHolder>& actual_args,
+                      Context& context);
+    // Вызывает метод method класса объекта или его родителей без поиска по имени.
+    // Если метод принимает другое число параметров, выбрасывает исключение runtime_error
+    ObjectHolder Call(const Method& method, const std::vector<ObjectHolder>& actual_args,
+                      Context& context);
+    // Вызывает специальный метод method, если он есть в классе или его родителях и принимает
+    // actual_args параметров. Иначе выбрасывает исключение runtime_error
+    ObjectHolder Call(SpecialMethod method, const std::vector<ObjectHolder>& actual_args,
                       Context& context);
 
     // Возвращает true, если объект имеет метод method, принимающий argument_count параметров
-    [[nodiscard]] bool HasMethod(const std::string& method, size_t argument_count) const;
+    [[nodiscard]] bool HasMethod(Symbol method, size_t argument_count) const;
 
     // Возвращает ссылку на Closure, содержащий поля объекта
     [[nodiscard]] Closure& Fields();
     // Возвращает константную ссылку на Closure, содержащую поля объекта
     [[nodiscard]] const Closure& Fields() const;
 
+    // Возвращает класс объекта
+    [[nodiscard]] const Class& GetClass() const;
+
 private:
+    friend class CycleCollector;
+
     const Class& cls_;
     Closure closure_;
+    // Сборщик циклов, который следит за экземпляром, и номер экземпляра в его списке
+    CycleCollector* collector_ = nullptr;
+    size_t collector_index_ = 0;
+};
+
+// Счётчики сборщика циклов
+struct CollectorStats
+{
+    size_t collections = 0;
+    // Сколько экземпляров освобождено
+    size_t collected = 0;
+    // За сколькими экземплярами сборщик следит сейчас
+    size_t tracked = 0;
+};
+
+// Сборщик циклических ссылок между экземплярами классов. Счётчики ссылок освобождают
+// объекты сразу, но не освобождают экземпляры, которые ссылаются друг на друга через поля.
+// Сборщик следит за экземплярами, созданными программой, и находит среди них группы,
+// на которые нет ссылок извне: из переменных, вызовов методов и временных значений.
+// Поля таких экземпляров очищаются, и экземпляры освобождаются счётчиками ссылок.
+// Сборщик работает в потоке программы
+class CycleCollector
+{
+public:
+    explicit CycleCollector(const CollectorOptions& options = {});
+
+    CycleCollector(const CycleCollector&) = delete;
+    CycleCollector& operator=(const CycleCollector&) = delete;
+
+    // Собирает циклы и перестаёт следить за оставшимися экземплярами
+    ~CycleCollector();
+
+    // Начинает следить за экземпляром instance, которым владеет shared_ptr. Если экземпляров
+    // стало больше порога, собирает циклы
+    void Track(ClassInstance& instance);
+
+    // Начинает следить за экземплярами, достижимыми из переменных roots, за которыми
+    // не следит ни один сборщик: созданными в другом контексте, сборщик которого
+    // уже разрушен, или без контекста
+    void TrackReachable(const Closure& roots);
+
+    // Освобождает недостижимые экземпляры. Возвращает, сколько экземпляров освобождено
+    size_t Collect();
+
+    [[nodiscard]] CollectorStats GetStats() const;
+
+private:
+    friend class ClassInstance;
+
+    void Untrack(ClassInstance& instance) noexcept;
+
+    CollectorOptions options_;
+    std::vector<ClassInstance*> tracked_;
+    // При каком числе отслеживаемых экземпляров начнётся следующая сборка
+    size_t next_collection_;
+    CollectorStats stats_;
 };
 
 /*
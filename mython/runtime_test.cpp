@@ -1,8 +1,14 @@
+#include "output.h"
 #include "runtime.h"
+#include "snapshot.h"
 #include "test_runner_p.h"
 
+#include <filesystem>
+#include <fstream>
 #include <functional>
 
+#include <sys/stat.h>
+
 using namespace std;
 
 namespace runtime {
@@ -71,6 +77,51 @@ void TestString() {
     ASSERT_EQUAL(word.GetValue(), "hello!"s);
 }
 
+void TestStringInterning() {
+    DummyContext context;
+    shared_ptr<String> ok = InternString("ok"s);
+    ASSERT(ok->IsInterned());
+    ASSERT_EQUAL(ok->GetValue(), "ok"s);
+    ASSERT_EQUAL(InternString("ok"s), ok);
+    ASSERT_EQUAL(ok->GetHash(), hash<string_view>()("ok"sv));
+
+    // Интернированные строки равны, только если это один объект
+    shared_ptr<String> failed = InternString("failed"s);
+    ASSERT(Equal(ObjectHolder::Share(*ok), ObjectHolder::Share(*InternString("ok"s)), context));
+    ASSERT(!Equal(ObjectHolder::Share(*ok), ObjectHolder::Share(*failed), context));
+    ASSERT(Less(ObjectHolder::Share(*failed), ObjectHolder::Share(*ok), context));
+
+    // Обычная строка сравнивается с интернированной по тексту
+    ObjectHolder plain = ObjectHolder::Own(String("ok"s));
+    ASSERT(!plain.TryAs<String>()->IsInterned());
+    ASSERT(Equal(plain, ObjectHolder::Share(*ok), context));
+    ASSERT(Equal(ObjectHolder::Share(*ok), plain, context));
+    ASSERT(!String(*ok).IsInterned());
+
+    // Освобождённая строка уходит из таблицы, и тот же текст интернируется заново
+    weak_ptr<String> weak = failed;
+    failed.reset();
+    ASSERT(weak.expired());
+    shared_ptr<String> again = InternString("failed"s);
+    ASSERT(again->IsInterned());
+    ASSERT_EQUAL(again->GetValue(), "failed"s);
+}
+
+void TestSymbol() {
+    const Symbol name("name"sv);
+    ASSERT_EQUAL(name, Symbol("name"s));
+    ASSERT_EQUAL(name.GetId(), Symbol("name").GetId());
+    ASSERT(name != Symbol("other"sv));
+    ASSERT_EQUAL(name.GetName(), "name"sv);
+    ASSERT_EQUAL(hash<Symbol>()(name), static_cast<size_t>(name.GetId()));
+    ASSERT_EQUAL(Symbol().GetName(), ""sv);
+    ASSERT_EQUAL(Symbol(""sv), Symbol());
+
+    ostringstream out;
+    out << name;
+    ASSERT_EQUAL(out.str(), "name"s);
+}
+
 void TestBool() {
     Bool t(true);
     ASSERT_EQUAL(t.GetValue(), true);
@@ -504,6 +555,43 @@ void TestClass() {
     ASSERT_EQUAL(out.str(), "Class Test"s);
 }
 
+void TestSpecialMethods() {
+    const auto returns = [](int value) {
+        return make_unique<TestMethodBody>([value](Closure&, Context&) {
+            return ObjectHolder::Own(Number{value});
+        });
+    };
+    vector<Method> base_methods;
+    base_methods.push_back({"__str__"s, {}, returns(1)});
+    base_methods.push_back({"__eq__"s, {"rhs"s}, returns(2)});
+    Class base{"Base"s, move(base_methods), nullptr};
+    ASSERT_EQUAL(base.GetSpecialMethod(SpecialMethod::STR), base.GetMethod("__str__"s));
+    ASSERT_EQUAL(base.GetSpecialMethod(SpecialMethod::EQ), base.GetMethod("__eq__"s));
+    ASSERT_EQUAL(base.GetSpecialMethod(SpecialMethod::ADD), nullptr);
+
+    // Наследник получает методы родителя, если не переопределяет их
+    vector<Method> child_methods;
+    child_methods.push_back({"__eq__"s, {"rhs"s}, returns(3)});
+    child_methods.push_back({"__add__"s, {"rhs"s}, returns(4)});
+    Class child{"Child"s, move(child_methods), nullptr};
+    ASSERT_EQUAL(child.GetSpecialMethod(SpecialMethod::STR), nullptr);
+    child.SetParent(&base);
+    ASSERT_EQUAL(child.GetSpecialMethod(SpecialMethod::STR), base.GetMethod("__str__"s));
+    ASSERT_EQUAL(child.GetSpecialMethod(SpecialMethod::EQ), child.GetMethod("__eq__"s));
+    ASSERT_EQUAL(child.GetSpecialMethod(SpecialMethod::INIT), nullptr);
+
+    DummyContext context;
+    ClassInstance instance{child};
+    const ObjectHolder rhs = ObjectHolder::Own(Number{0});
+    ASSERT_EQUAL(instance.Call(SpecialMethod::ADD, {rhs}, context).TryAs<Number>()->GetValue(), 4);
+    ASSERT(Equal(ObjectHolder::Share(instance), rhs, context));
+    ASSERT_THROWS((void)instance.Call(SpecialMethod::LT, {rhs}, context), runtime_error);
+    ASSERT_THROWS((void)instance.Call(SpecialMethod::ADD, {}, context), runtime_error);
+    ostringstream out;
+    instance.Print(out, context);
+    ASSERT_EQUAL(out.str(), "1"s);
+}
+
 void TestClassInstance() {
     vector<Method> methods;
 
@@ -525,21 +613,535 @@ void TestClassInstance() {
     DummyContext ctx;
     instance.Print(out, ctx);
     ASSERT_EQUAL(out.str(), "result"s);
+    ASSERT(ctx.IsOutputDeterministic());
+
+    // Экземпляр без __str__ выводится как адрес, который меняется от запуска к запуску
+    Class plain_cls{"Plain"s, {}, nullptr};
+    ClassInstance plain{plain_cls};
+    plain.Print(out, ctx);
+    ASSERT(!ctx.IsOutputDeterministic());
 
     ASSERT_THROWS(instance.Call("missing_method"s, {}, ctx), runtime_error);
 }
 
+void TestFormat() {
+    DummyContext ctx;
+    auto format = [&ctx](Object& object) {
+        ostringstream printed;
+        object.Print(printed, ctx);
+
+        string formatted = "prefix "s;
+        object.Format(formatted, ctx);
+        ASSERT_EQUAL(formatted, "prefix "s + printed.str());
+        return printed.str();
+    };
+
+    Number min_number(numeric_limits<int>::min());
+    ASSERT_EQUAL(format(min_number), to_string(numeric_limits<int>::min()));
+    Number zero(0);
+    ASSERT_EQUAL(format(zero), "0"s);
+    String word("hello"s);
+    ASSERT_EQUAL(format(word), "hello"s);
+    Bool t(true);
+    ASSERT_EQUAL(format(t), "True"s);
+    Logger logger(17);
+    ASSERT_EQUAL(format(logger), "17"s);
+
+    Class plain_cls{"Plain"s, {}, nullptr};
+    ASSERT_EQUAL(format(plain_cls), "Class Plain"s);
+    ClassInstance plain{plain_cls};
+    format(plain);
+
+    // Метод __str__ сам пользуется буфером форматирования контекста
+    vector<Method> methods;
+    methods.push_back({"__str__"s, {}, make_unique<TestMethodBody>([](Closure&, Context& context) {
+                           FormatScope scope(context);
+                           scope.Buffer() += "nested"s;
+                           return ObjectHolder::Own(String{scope.Take()});
+                       })});
+    Class cls{"Nested"s, move(methods), nullptr};
+    ClassInstance instance{cls};
+    {
+        FormatScope scope(ctx);
+        scope.Buffer() += "outer "s;
+        instance.Format(scope.Buffer(), ctx);
+        ASSERT_EQUAL(scope.Take(), "outer nested"s);
+    }
+    ASSERT(ctx.GetFormatBuffer().empty());
+    ASSERT(ctx.output.str().empty());
+}
+
+void TestFileOutputContext() {
+    const auto path = filesystem::temp_directory_path() / "mython_output_test.txt"s;
+    auto read_file = [&path] {
+        ifstream input(path, ios::binary);
+        return string(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+    };
+
+    const string long_line(100, 'x');
+    string expected;
+    for (int i = 0; i < 50; ++i) {
+        expected += to_string(i) + ' ' + long_line + '\n';
+    }
+
+    for (auto [memory_mapped, async] : {pair{false, false}, {false, true}, {true, false}}) {
+        OutputOptions options;
+        options.buffer_size = 16;
+        options.memory_mapped = memory_mapped;
+        options.mapped_size = 7;
+        options.async = async;
+        {
+            FileOutputContext context(path, options);
+            String line(long_line);
+            for (int i = 0; i < 50; ++i) {
+                auto& os = context.GetOutputStream();
+                Number(i).Print(os, context);
+                os.put(' ');
+                line.Print(os, context);
+                os.put('\n');
+            }
+            ASSERT_EQUAL(context.BytesWritten(), expected.size());
+            context.Flush();
+        }
+        ASSERT_EQUAL(read_file(), expected);
+    }
+
+#ifdef __linux__
+    {
+        // Место под отображение выделено на диске заранее, поэтому его нехватка
+        // обнаруживается при увеличении файла, а не при записи в память
+        OutputOptions options;
+        options.memory_mapped = true;
+        options.mapped_size = 1 << 20;
+        FileOutputContext context(path, options);
+        context.GetOutputStream() << "short"sv;
+        struct stat info{};
+        ASSERT(stat(path.c_str(), &info) == 0);
+        ASSERT_EQUAL(info.st_size, off_t{1 << 20});
+        ASSERT(info.st_blocks * 512 >= info.st_size);
+    }
+    ASSERT_EQUAL(read_file(), "short"s);
+#endif
+
+    filesystem::remove(path);
+    ASSERT_THROWS(FileOutputContext(path / "missing"s), system_error);
+
+    if (filesystem::exists("/dev/full"s)) {
+        for (bool async : {false, true}) {
+            OutputOptions options;
+            options.async = async;
+            FileOutputContext context("/dev/full"s, options);
+            context.GetOutputStream() << "lost"sv;
+            ASSERT_THROWS(context.Flush(), system_error);
+        }
+    }
+}
+
+void TestOutputCache() {
+    const auto dir = filesystem::temp_directory_path() / "mython_output_cache_test"s;
+    const auto path = filesystem::temp_directory_path() / "mython_output_cache_test.txt"s;
+    filesystem::remove_all(dir);
+    auto write_file = [&path](const string& content) {
+        ofstream(path, ios::binary) << content;
+    };
+    auto read_file = [&path] {
+        ifstream input(path, ios::binary);
+        return string(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+    };
+
+    const OutputCache cache(dir, "lazy"sv);
+    const string source = "print 1\n"s;
+    const string output(100000, 'x');
+    ASSERT(!cache.Load(source, path));
+
+    write_file(output);
+    ASSERT(cache.Store(source, path));
+    write_file("stale"s);
+    ASSERT(cache.Load(source, path));
+    ASSERT_EQUAL(read_file(), output);
+
+    // Запись не подходит другой программе и запускам с другими настройками
+    ASSERT(!cache.Load("print 2\n"s, path));
+    ASSERT(!OutputCache(dir, "eager"sv).Load(source, path));
+
+    // Пустой вывод тоже кэшируется
+    write_file({});
+    ASSERT(cache.Store("x = 1\n"s, path));
+    write_file("stale"s);
+    ASSERT(cache.Load("x = 1\n"s, path));
+    ASSERT_EQUAL(read_file(), ""s);
+
+    ASSERT(!cache.Store(source, dir));
+
+    filesystem::remove(path);
+    filesystem::remove_all(dir);
+}
+
+void TestSnapshot() {
+    const auto path = filesystem::temp_directory_path() / "mython_snapshot_test.bin"s;
+
+    Class base{"Base"s, {}, nullptr};
+    Class derived{"Derived"s, {}, &base};
+    const vector<const Class*> classes = {&base, &derived};
+
+    Closure closure;
+    closure["n"s] = ObjectHolder::Own(Number(-42));
+    closure["s"s] = ObjectHolder::Own(String("text"s));
+    closure["b"s] = ObjectHolder::Own(Bool(true));
+    closure["none"s] = ObjectHolder::None();
+    closure["cls"s] = ObjectHolder::Share(derived);
+    ObjectHolder shared = ObjectHolder::Own(ClassInstance(base));
+    shared.TryAs<ClassInstance>()->Fields()["value"s] = ObjectHolder::Own(Number(7));
+    ObjectHolder owner = ObjectHolder::Own(ClassInstance(derived));
+    owner.TryAs<ClassInstance>()->Fields()["child"s] = shared;
+    closure["owner"s] = owner;
+    closure["shared"s] = shared;
+
+    SaveSnapshot(path, "prologue\n"sv, "printed\n"sv, true, closure, classes);
+
+    Snapshot snapshot(path);
+    ASSERT_EQUAL(snapshot.Prologue(), "prologue\n"sv);
+    ASSERT_EQUAL(snapshot.Output(), "printed\n"sv);
+    ASSERT(snapshot.IsOutputDeterministic());
+
+    // Классы разобранного заново пролога - другие объекты с теми же именами
+    Class new_base{"Base"s, {}, nullptr};
+    Class new_derived{"Derived"s, {}, &new_base};
+    DummyContext context;
+    Closure restored;
+    snapshot.Restore(restored, {&new_base, &new_derived}, context);
+    ASSERT_EQUAL(restored.size(), closure.size());
+    ASSERT_EQUAL(restored.at("n"s).TryAs<Number>()->GetValue(), -42);
+    ASSERT_EQUAL(restored.at("s"s).TryAs<String>()->GetValue(), "text"s);
+    ASSERT(restored.at("b"s).TryAs<Bool>()->GetValue());
+    ASSERT(!restored.at("none"s));
+    ASSERT_EQUAL(restored.at("cls"s).TryAs<Class>(), &new_derived);
+
+    auto* restored_owner = restored.at("owner"s).TryAs<ClassInstance>();
+    auto* restored_shared = restored.at("shared"s).TryAs<ClassInstance>();
+    ASSERT_EQUAL(&restored_owner->GetClass(), static_cast<const Class*>(&new_derived));
+    ASSERT_EQUAL(&restored_shared->GetClass(), static_cast<const Class*>(&new_base));
+    // Общий экземпляр восстанавливается одним объектом
+    ASSERT_EQUAL(restored_owner->Fields().at("child"s).TryAs<ClassInstance>(), restored_shared);
+    ASSERT_EQUAL(restored_shared->Fields().at("value"s).TryAs<Number>()->GetValue(), 7);
+
+    Closure mismatched;
+    ASSERT_THROWS(snapshot.Restore(mismatched, {&new_base}, context), SnapshotError);
+
+    // Память восстановленных объектов учитывается в лимите контекста, как память объектов,
+    // созданных программой
+    {
+        DummyContext limited;
+        limited.SetLimits(ExecutionLimits{0, 1 << 20});
+        const auto account = limited.GetMemoryAccount();
+        {
+            Closure accounted = MakeClosure(limited);
+            snapshot.Restore(accounted, {&new_base, &new_derived}, limited);
+            ASSERT(account->GetUsed() > 2 * sizeof(ClassInstance));
+        }
+        ASSERT_EQUAL(account->GetUsed(), 0U);
+
+        DummyContext tight;
+        tight.SetLimits(ExecutionLimits{0, account->GetPeak() / 2});
+        Closure too_large = MakeClosure(tight);
+        ASSERT_THROWS(snapshot.Restore(too_large, {&new_base, &new_derived}, tight),
+                      MemoryLimitExceeded);
+    }
+
+    Class foreign{"Foreign"s, {}, nullptr};
+    closure["foreign"s] = ObjectHolder::Share(foreign);
+    ASSERT_THROWS(SaveSnapshot(path, {}, {}, true, closure, classes), runtime_error);
+
+    // Снимок другой версии интерпретатора и повреждённый снимок не загружаются
+    auto write_string = [](ostream& out, string_view value) {
+        const uint64_t size = value.size();
+        out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        out.write(value.data(), static_cast<streamsize>(value.size()));
+    };
+    {
+        ofstream out(path, ios::binary);
+        write_string(out, "Mython snapshot\n"sv);
+        write_string(out, "0.0.1"sv);
+    }
+    ASSERT_THROWS(Snapshot{path}, SnapshotError);
+    {
+        ofstream out(path, ios::binary);
+        write_string(out, "Mython snapshot\n"sv);
+    }
+    ASSERT_THROWS(Snapshot{path}, SnapshotError);
+
+    filesystem::remove(path);
+    ASSERT_THROWS(Snapshot{path}, system_error);
+
+    const string source = "class A:\n  def f():\n    return 1\n# @snapshot\nprint 1\n"s;
+    auto parts = SplitAtSnapshotMarker(source);
+    ASSERT(parts.has_value());
+    ASSERT_EQUAL(parts->first, "class A:\n  def f():\n    return 1\n"sv);
+    ASSERT_EQUAL(parts->second, "# @snapshot\nprint 1\n"sv);
+    ASSERT(!SplitAtSnapshotMarker("print 1\n  # @snapshot\n"sv).has_value());
+}
+
+void TestMemoryAccount() {
+    DummyContext context;
+    context.SetLimits(ExecutionLimits{0, 4096});
+    const auto account = context.GetMemoryAccount();
+    ASSERT(account);
+    ASSERT_EQUAL(account->GetUsed(), 0U);
+
+    {
+        ObjectHolder number = ObjectHolder::Own(Number(42), context);
+        const size_t number_size = account->GetUsed();
+        ASSERT(number_size >= sizeof(Number));
+
+        // Длинная строка учитывается вместе со своим текстом
+        ObjectHolder text = ObjectHolder::Own(String(string(1000, 'x')), context);
+        ASSERT(account->GetUsed() >= number_size + sizeof(String) + 1000);
+
+        // Поля экземпляра учитываются в том же счётчике: первые поля лежат внутри экземпляра,
+        // а таблица для остальных выделяется отдельно
+        Class cls("Point"s, {}, nullptr);
+        ObjectHolder point = ObjectHolder::Own(
+            ClassInstance(cls, Closure::allocator_type(context.GetMemoryAccount())), context);
+        const size_t before_fields = account->GetUsed();
+        Closure& fields = point.TryAs<ClassInstance>()->Fields();
+        fields["x"s] = number;
+        ASSERT_EQUAL(account->GetUsed(), before_fields);
+        for (int i = 0; i < 10; ++i) {
+            fields["field"s + to_string(i)] = number;
+        }
+        ASSERT(account->GetUsed() > before_fields);
+
+        // Объект, который не помещается в лимит, не создаётся
+        ASSERT_THROWS((void)ObjectHolder::Own(String(string(8192, 'y')), context),
+                      MemoryLimitExceeded);
+        text = ObjectHolder::None();
+        ASSERT(account->GetUsed() < before_fields);
+        ASSERT(account->GetPeak() >= before_fields);
+    }
+    // Освобождённая память возвращается в счётчик, даже если объект пережил контекст
+    ASSERT_EQUAL(account->GetUsed(), 0U);
+
+    // Без ограничения память не учитывается
+    context.SetLimits({});
+    ASSERT(!context.GetMemoryAccount());
+    ObjectHolder text = ObjectHolder::Own(String(string(8192, 'y')), context);
+    ASSERT_EQUAL(text.TryAs<String>()->GetValue().size(), 8192U);
+}
+
+void TestCycleCollector() {
+    Class node("Node"s, {}, nullptr);
+    CycleCollector collector(CollectorOptions{1000, 1.0});
+    auto make = [&node, &collector] {
+        ObjectHolder instance = ObjectHolder::Own(ClassInstance(node));
+        collector.Track(*instance.TryAs<ClassInstance>());
+        return instance;
+    };
+
+    ObjectHolder a = make();
+    ObjectHolder b = make();
+    a.TryAs<ClassInstance>()->Fields()["next"s] = b;
+    b.TryAs<ClassInstance>()->Fields()["prev"s] = a;
+    weak_ptr<ClassInstance> weak_a = a.TryAs<ClassInstance>()->weak_from_this();
+
+    // Цикл, на который есть ссылка извне, не освобождается
+    ASSERT_EQUAL(collector.Collect(), 0U);
+    b = ObjectHolder::None();
+    ASSERT_EQUAL(collector.Collect(), 0U);
+    ASSERT_EQUAL(collector.GetStats().tracked, 2U);
+
+    // Экземпляры, достижимые только друг из друга, освобождаются
+    a = ObjectHolder::None();
+    ASSERT(!weak_a.expired());
+    ASSERT_EQUAL(collector.Collect(), 2U);
+    ASSERT(weak_a.expired());
+    ASSERT_EQUAL(collector.GetStats().tracked, 0U);
+
+    // Цикл, достижимый из экземпляра со ссылкой извне, остаётся
+    ObjectHolder root = make();
+    {
+        ObjectHolder x = make();
+        ObjectHolder y = make();
+        x.TryAs<ClassInstance>()->Fields()["y"s] = y;
+        y.TryAs<ClassInstance>()->Fields()["x"s] = x;
+        root.TryAs<ClassInstance>()->Fields()["x"s] = x;
+    }
+    ASSERT_EQUAL(collector.Collect(), 0U);
+    ASSERT_EQUAL(collector.GetStats().tracked, 3U);
+    root.TryAs<ClassInstance>()->Fields().clear();
+    ASSERT_EQUAL(collector.Collect(), 2U);
+
+    // Невладеющая ссылка на себя не удерживает экземпляр
+    {
+        ObjectHolder self = make();
+        self.TryAs<ClassInstance>()->Fields()["self"s] = ObjectHolder::Share(*self);
+        ASSERT_EQUAL(collector.Collect(), 0U);
+    }
+    ASSERT_EQUAL(collector.GetStats().tracked, 1U);
+    ASSERT_EQUAL(collector.GetStats().collected, 4U);
+
+    // Сборка начинается сама, когда экземпляров становится больше порога
+    CycleCollector automatic(CollectorOptions{4, 1.0});
+    for (int i = 0; i < 10; ++i) {
+        ObjectHolder instance = ObjectHolder::Own(ClassInstance(node));
+        automatic.Track(*instance.TryAs<ClassInstance>());
+        instance.TryAs<ClassInstance>()->Fields()["self"s] = instance;
+    }
+    ASSERT(automatic.GetStats().collections >= 2U);
+    ASSERT(automatic.GetStats().tracked < 10U);
+}
+
+void TestInstancePool() {
+    DummyContext context;
+    Class point("Point"s, {}, nullptr);
+    const util::SlabPool& pool = point.GetInstancePool();
+
+    vector<ObjectHolder> instances;
+    for (int i = 0; i < 40; ++i) {
+        instances.push_back(point.CreateInstance(context));
+    }
+    ASSERT_EQUAL(pool.GetUsedSlots(), 40U);
+    ASSERT(pool.GetCapacity() >= 40U);
+    // Экземпляры, созданные подряд, лежат в одной странице друг за другом
+    const auto* first = instances[0].TryAs<ClassInstance>();
+    const auto* second = instances[1].TryAs<ClassInstance>();
+    ASSERT(first && second);
+    ASSERT(reinterpret_cast<const char*>(second) > reinterpret_cast<const char*>(first));
+    ASSERT(reinterpret_cast<const char*>(second) - reinterpret_cast<const char*>(first)
+           < static_cast<ptrdiff_t>(2 * sizeof(ClassInstance)));
+
+    // Ячейка освобождённого экземпляра достаётся следующему
+    const Object* freed = instances.back().Get();
+    const size_t capacity = pool.GetCapacity();
+    instances.pop_back();
+    ASSERT_EQUAL(pool.GetUsedSlots(), 39U);
+    instances.push_back(point.CreateInstance(context));
+    ASSERT_EQUAL(instances.back().Get(), freed);
+    ASSERT_EQUAL(pool.GetCapacity(), capacity);
+
+    // Память экземпляров из пула учитывается в счётчике
+    context.SetLimits(ExecutionLimits{0, 4096});
+    const auto account = context.GetMemoryAccount();
+    {
+        ObjectHolder instance = point.CreateInstance(context);
+        instance.TryAs<ClassInstance>()->Fields()["x"s] = ObjectHolder::Own(Number(1));
+        ASSERT(account->GetUsed() > sizeof(ClassInstance));
+        ASSERT_THROWS(
+            [&] {
+                vector<ObjectHolder> many;
+                for (int i = 0; i < 100; ++i) {
+                    many.push_back(point.CreateInstance(context));
+                }
+            }(),
+            MemoryLimitExceeded);
+    }
+    ASSERT_EQUAL(account->GetUsed(), 0U);
+
+    instances.clear();
+    ASSERT_EQUAL(pool.GetUsedSlots(), 0U);
+}
+
+void TestClosureMap() {
+    DummyContext context;
+    context.SetLimits(ExecutionLimits{0, 1 << 20});
+    const auto account = context.GetMemoryAccount();
+    const auto key = [](int i) {
+        return Symbol("closure_key_"s + to_string(i));
+    };
+    {
+        Closure closure = MakeClosure(context);
+        ASSERT(closure.empty());
+        // Пока имён мало, таблица не выделяет памяти
+        for (int i = 0; i < 8; ++i) {
+            closure[key(i)] = ObjectHolder::Own(Number(i));
+        }
+        ASSERT_EQUAL(closure.size(), 8U);
+        ASSERT_EQUAL(account->GetUsed(), 0U);
+        closure.erase(key(3));
+        ASSERT_EQUAL(closure.count(key(3)), 0U);
+        ASSERT_EQUAL(closure.at(key(7)).TryAs<Number>()->GetValue(), 7);
+
+        // Большая таблица учитывает свою память и переживает удаления и повторные добавления
+        for (int i = 0; i < 1000; ++i) {
+            closure[key(i)] = ObjectHolder::Own(Number(i));
+        }
+        ASSERT(account->GetUsed() > 1000 * sizeof(ObjectHolder));
+        for (int round = 0; round < 3; ++round) {
+            for (int i = 0; i < 1000; i += 2) {
+                ASSERT_EQUAL(closure.erase(key(i)), 1U);
+            }
+            for (int i = 0; i < 1000; i += 2) {
+                ASSERT(closure.emplace(key(i), ObjectHolder::Own(Number(-i))).second);
+            }
+        }
+        ASSERT_EQUAL(closure.size(), 1000U);
+        ASSERT(!closure.emplace(key(1), ObjectHolder::None()).second);
+        ASSERT_THROWS((void)closure.at(key(1000)), out_of_range);
+
+        int sum = 0;
+        size_t visited = 0;
+        for (const auto& [name, value] : closure) {
+            ASSERT(name == key(abs(value.TryAs<Number>()->GetValue())));
+            sum += value.TryAs<Number>()->GetValue();
+            ++visited;
+        }
+        ASSERT_EQUAL(visited, 1000U);
+        ASSERT_EQUAL(sum, -249500 + 250000);
+
+        // Копия независима от оригинала, перемещение забирает элементы
+        Closure copy = closure;
+        copy.erase(key(1));
+        ASSERT_EQUAL(closure.count(key(1)), 1U);
+        Closure moved = std::move(copy);
+        ASSERT_EQUAL(moved.size(), 999U);
+        ASSERT(copy.empty());
+        ASSERT(moved.get_allocator() == closure.get_allocator());
+
+        Closure small = MakeClosure(context);
+        small[key(0)] = closure.at(key(0));
+        Closure small_moved = std::move(small);
+        ASSERT(small.empty());
+        ASSERT_EQUAL(small_moved.find(key(0))->second.Get(), closure.at(key(0)).Get());
+
+        // Присваивание копирует элементы в память, которую учитывает счётчик получателя
+        DummyContext other_context;
+        other_context.SetLimits(ExecutionLimits{0, 1 << 20});
+        const auto other_account = other_context.GetMemoryAccount();
+        const size_t used = account->GetUsed();
+        {
+            Closure assigned = MakeClosure(other_context);
+            assigned = closure;
+            ASSERT_EQUAL(assigned.size(), closure.size());
+            ASSERT(assigned.get_allocator().GetAccount() == other_account);
+            ASSERT_EQUAL(account->GetUsed(), used);
+            ASSERT(other_account->GetUsed() > 1000 * sizeof(ObjectHolder));
+        }
+        ASSERT_EQUAL(other_account->GetUsed(), 0U);
+    }
+    ASSERT_EQUAL(account->GetUsed(), 0U);
+}
+
 }  // namespace
 
 void RunObjectsTests(TestRunner& tr) {
     RUN_TEST(tr, runtime::TestNumber);
     RUN_TEST(tr, runtime::TestString);
+    RUN_TEST(tr, runtime::TestStringInterning);
+    RUN_TEST(tr, runtime::TestSymbol);
     RUN_TEST(tr, runtime::TestBool);
     RUN_TEST(tr, runtime::TestMethodInvocation);
     RUN_TEST(tr, runtime::TestIsTrue);
     RUN_TEST(tr, runtime::TestComparison);
     RUN_TEST(tr, runtime::TestClass);
+    RUN_TEST(tr, runtime::TestSpecialMethods);
     RUN_TEST(tr, runtime::TestClassInstance);
+    RUN_TEST(tr, runtime::TestFormat);
+    RUN_TEST(tr, runtime::TestFileOutputContext);
+    RUN_TEST(tr, runtime::TestOutputCache);
+    RUN_TEST(tr, runtime::TestSnapshot);
+    RUN_TEST(tr, runtime::TestMemoryAccount);
+    RUN_TEST(tr, runtime::TestCycleCollector);
+    RUN_TEST(tr, runtime::TestInstancePool);
+    RUN_TEST(tr, runtime::TestClosureMap);
 }
 
 void RunObjectHolderTests(TestRunner& tr) {
@@ -0,0 +1,998 @@
+#include "server.h"
+
+#include "lexer.h"
+#include "watchdog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+namespace server
+{
+
+namespace
+{
+
+// Запросы длиннее этого считаются ошибкой протокола
+constexpr uint64_t MAX_REQUEST_SIZE = uint64_t{1} << 30;
+constexpr size_t HEADER_SIZE = 1 + sizeof(uint64_t);
+
+// Соединение с клиентом разорвано, отвечать на запрос некому
+struct ConnectionError : runtime_error
+{
+    using runtime_error::runtime_error;
+};
+
+[[noreturn]] void ThrowSystemError(const char* what)
+{
+    throw system_error(errno, generic_category(), what);
+}
+
+// Отправляет все части parts, повторяя sendmsg после частичной отправки.
+// Выбрасывает ConnectionError, если соединение разорвано
+void SendAll(int fd, iovec* parts, size_t count)
+{
+    while (count > 0)
+    {
+        msghdr message{};
+        message.msg_iov = parts;
+        message.msg_iovlen = count;
+        // MSG_NOSIGNAL: отключившийся клиент не должен завершать сервер сигналом SIGPIPE
+        ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw ConnectionError("Can't send: "s + strerror(errno));
+        }
+        auto rest = static_cast<size_t>(sent);
+        while (count > 0 && rest >= parts->iov_len)
+        {
+            rest -= parts->iov_len;
+            ++parts;
+            --count;
+        }
+        if (count > 0)
+        {
+            parts->iov_base = static_cast<char*>(parts->iov_base) + rest;
+            parts->iov_len -= rest;
+        }
+    }
+}
+
+// Читает ровно size байт. Возвращает false, если соединение закрыто до начала данных.
+// Выбрасывает ConnectionError, если соединение закрыто посередине или произошла ошибка
+bool ReceiveAll(int fd, void* data, size_t size)
+{
+    auto* bytes = static_cast<char*>(data);
+    size_t received = 0;
+    while (received < size)
+    {
+        ssize_t count = recv(fd, bytes + received, size - received, 0);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw ConnectionError("Can't receive: "s + strerror(errno));
+        }
+        if (count == 0)
+        {
+            if (received == 0)
+            {
+                return false;
+            }
+            throw ConnectionError("Connection closed");
+        }
+        received += static_cast<size_t>(count);
+    }
+    return true;
+}
+
+void EncodeHeader(char* header, MessageType type, uint64_t size)
+{
+    header[0] = static_cast<char>(type);
+    memcpy(header + 1, &size, sizeof(size));
+}
+
+void SendMessage(int fd, MessageType type, string_view data)
+{
+    char header[HEADER_SIZE];
+    EncodeHeader(header, type, data.size());
+    iovec parts[2] = {{header, HEADER_SIZE}, {const_cast<char*>(data.data()), data.size()}};  // NOLINT
+    SendAll(fd, parts, 2);
+}
+
+// Читает строку, перед которой записана её длина. Возвращает false, если соединение
+// закрыто до начала строки
+bool ReceiveString(int fd, string& value)
+{
+    uint64_t size = 0;
+    if (!ReceiveAll(fd, &size, sizeof(size)))
+    {
+        return false;
+    }
+    if (size > MAX_REQUEST_SIZE)
+    {
+        throw ConnectionError("Request is too large");
+    }
+    value.resize(size);
+    if (!ReceiveAll(fd, value.data(), value.size()))
+    {
+        throw ConnectionError("Connection closed");
+    }
+    return true;
+}
+
+sockaddr_un MakeAddress(const filesystem::path& socket_path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    const string& path = socket_path.native();
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        throw system_error(ENAMETOOLONG, generic_category(), "Can't use socket "s + path);
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+int Connect(const sockaddr_un& address)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        ThrowSystemError("Can't create socket");
+    }
+    while (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        if (errno != EINTR)
+        {
+            const int error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+    }
+    return fd;
+}
+
+// Буфер, который отправляет вывод программы клиенту сообщениями OUTPUT
+class MessageOutputBuffer : public runtime::OutputBuffer
+{
+public:
+    MessageOutputBuffer(int fd, size_t buffer_size)
+        : fd_(fd), buffer_(max(buffer_size, size_t{1}))
+    {
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+
+    void Flush() override
+    {
+        Send({});
+    }
+
+    [[nodiscard]] size_t BytesWritten() const override
+    {
+        return sent_ + static_cast<size_t>(pptr() - pbase());
+    }
+
+protected:
+    int_type overflow(int_type ch) override
+    {
+        Flush();
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        const auto size = static_cast<size_t>(n);
+        if (size <= static_cast<size_t>(epptr() - pptr()))
+        {
+            memcpy(pptr(), s, size);
+            Advance(size);
+        }
+        else
+        {
+            Send({s, size});
+        }
+        return n;
+    }
+
+    int sync() override
+    {
+        Flush();
+        return 0;
+    }
+
+private:
+    // Отправляет накопленный вывод и data одним сообщением
+    void Send(string_view data)
+    {
+        const auto buffered = static_cast<size_t>(pptr() - pbase());
+        if (buffered + data.size() == 0)
+        {
+            return;
+        }
+        char header[HEADER_SIZE];
+        EncodeHeader(header, MessageType::OUTPUT, buffered + data.size());
+        iovec parts[3] = {{header, HEADER_SIZE},
+                          {pbase(), buffered},
+                          {const_cast<char*>(data.data()), data.size()}};  // NOLINT
+        SendAll(fd_, parts, 3);
+        sent_ += buffered + data.size();
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+
+    int fd_;
+    std::vector<char> buffer_;
+    size_t sent_ = 0;
+};
+
+// Контекст, который отправляет вывод программы клиенту
+class MessageOutputContext : public runtime::Context
+{
+public:
+    MessageOutputContext(int fd, size_t buffer_size)
+        : buffer_(fd, buffer_size), output_(&buffer_)
+    {
+        output_.exceptions(ios::badbit);
+    }
+
+    MessageOutputContext(const MessageOutputContext&) = delete;
+    MessageOutputContext& operator=(const MessageOutputContext&) = delete;
+
+    // Отправляет вывод, сделанный программой до ошибки, перед сообщением об ошибке
+    ~MessageOutputContext()
+    {
+        try
+        {
+            buffer_.Flush();
+        }
+        catch (const ConnectionError&)
+        {
+        }
+    }
+
+    std::ostream& GetOutputStream() override
+    {
+        return output_;
+    }
+
+    void Flush()
+    {
+        buffer_.Flush();
+    }
+
+private:
+    MessageOutputBuffer buffer_;
+    std::ostream output_;
+};
+
+// Создаёт сокет socket_path и начинает принимать соединения. Файл сокета, к которому никто
+// не подключён, остался от остановленного сервера и заменяется. Файл другого типа не трогается
+int Listen(const filesystem::path& socket_path)
+{
+    const sockaddr_un address = MakeAddress(socket_path);
+    struct stat info;
+    if (lstat(socket_path.c_str(), &info) == 0)
+    {
+        if (!S_ISSOCK(info.st_mode))
+        {
+            throw system_error(ENOTSOCK, generic_category(), "Can't listen " + socket_path.string());
+        }
+        if (int fd = Connect(address); fd >= 0)
+        {
+            close(fd);
+            throw system_error(EADDRINUSE, generic_category(),
+                               "Can't listen " + socket_path.string());
+        }
+        else if (errno == ECONNREFUSED)
+        {
+            unlink(socket_path.c_str());
+        }
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        ThrowSystemError("Can't create socket");
+    }
+    if (bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        // Файл по этому пути создал кто-то другой, поэтому он не удаляется
+        const int error = errno;
+        close(fd);
+        throw system_error(error, generic_category(), "Can't listen " + socket_path.string());
+    }
+    if (listen(fd, SOMAXCONN) != 0)
+    {
+        const int error = errno;
+        close(fd);
+        unlink(socket_path.c_str());
+        throw system_error(error, generic_category(), "Can't listen " + socket_path.string());
+    }
+    return fd;
+}
+
+unique_ptr<runtime::Executable> ParseSource(const string& source, ParseOptions options)
+{
+    istringstream input(source);
+    parse::Lexer lexer(input);
+    return ParseProgram(lexer, options);
+}
+
+// Выделяет и освобождает size байт мелкими блоками. Освобождённая память остаётся в куче,
+// поэтому последующие выделения не обращаются к системе
+void ReserveHeap(size_t size)
+{
+#ifdef __GLIBC__
+    mallopt(M_TRIM_THRESHOLD, static_cast<int>(min(size * 2, size_t{INT_MAX})));
+#endif
+    // Блоки меньше порога, с которого malloc выделяет память через mmap
+    constexpr size_t BLOCK_SIZE = 64 << 10;
+    vector<unique_ptr<char[]>> blocks;
+    blocks.reserve(size / BLOCK_SIZE + 1);
+    for (size_t reserved = 0; reserved < size; reserved += BLOCK_SIZE)
+    {
+        // Блок заполняется нулями, поэтому его страницы сразу отображаются в память
+        blocks.push_back(make_unique<char[]>(BLOCK_SIZE));
+    }
+}
+
+// Выполняет программу program в контексте context с ограничениями и настройками сборщика
+// циклов из options - настроек Server или ForkServer
+template <typename Options>
+void ExecuteProgram(runtime::Executable& program, runtime::Context& context, const Options& options,
+                    const runtime::CancellationToken& cancellation)
+{
+    context.SetLimits(options.limits);
+    context.SetCollectorOptions(options.collector);
+    context.SetCancellationToken(&cancellation);
+    runtime::Closure closure = runtime::MakeClosure(context);
+    program.Execute(closure, context);
+}
+
+// Результат выполнения запроса
+enum class RequestStatus
+{
+    // Клиент закрыл соединение, не отправив запрос
+    CLOSED,
+    // Клиент отключился во время запроса, ответ отправить нельзя
+    DISCONNECTED,
+    SUCCEEDED,
+    // Программа завершилась ошибкой, клиент получил сообщение ERROR
+    FAILED,
+};
+
+// Читает из соединения fd один запрос и выполняет его с настройками options - настройками
+// Server или ForkServer. Функция compile возвращает разобранную программу по её тексту.
+// Выполнение прерывается, когда взведён cancellation
+template <typename Options, typename Compile>
+RequestStatus ServeRequest(int fd, const Options& options,
+                           const runtime::CancellationToken& cancellation, Compile&& compile)
+{
+    try
+    {
+        string source;
+        string output_path;
+        if (!ReceiveString(fd, source))
+        {
+            return RequestStatus::CLOSED;
+        }
+        if (!ReceiveString(fd, output_path))
+        {
+            return RequestStatus::DISCONNECTED;
+        }
+
+        try
+        {
+            shared_ptr<runtime::Executable> program = compile(move(source));
+            if (output_path.empty())
+            {
+                MessageOutputContext context(fd, options.send_buffer_size);
+                ExecuteProgram(*program, context, options, cancellation);
+                context.Flush();
+            }
+            else
+            {
+                runtime::FileOutputContext context(output_path, options.output);
+                ExecuteProgram(*program, context, options, cancellation);
+                context.Flush();
+            }
+        }
+        catch (const ConnectionError&)
+        {
+            throw;
+        }
+        catch (const std::exception& e)
+        {
+            SendMessage(fd, MessageType::ERROR, e.what());
+            return RequestStatus::FAILED;
+        }
+        SendMessage(fd, MessageType::DONE, {});
+        return RequestStatus::SUCCEEDED;
+    }
+    catch (const ConnectionError&)
+    {
+        return RequestStatus::DISCONNECTED;
+    }
+}
+
+}  // namespace
+
+Server::Server(filesystem::path socket_path, ServerOptions options)
+    : socket_path_(move(socket_path)), options_(options), listen_fd_(Listen(socket_path_))
+{
+    if (pipe2(wake_fds_, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        const int error = errno;
+        close(listen_fd_);
+        unlink(socket_path_.c_str());
+        throw system_error(error, generic_category(), "Can't listen " + socket_path_.string());
+    }
+    pool_ = make_unique<util::ThreadPool>(options_.thread_count);
+}
+
+Server::~Server()
+{
+    // Потоки пула возвращают соединения через канал, поэтому его закрывают после пула
+    pool_.reset();
+    for (auto [fd, open] : resumed_)
+    {
+        close(fd);
+    }
+    close(wake_fds_[0]);
+    close(wake_fds_[1]);
+    close(listen_fd_);
+    unlink(socket_path_.c_str());
+}
+
+void Server::Run()
+{
+    // Соединения, которые ждут следующего запроса. Соединение, запрос которого
+    // выполняется, переносится в executing, пока поток пула не вернёт его через Resume
+    vector<pollfd> waiting = {{wake_fds_[0], POLLIN, 0}, {listen_fd_, POLLIN, 0}};
+    constexpr size_t FIRST_CONNECTION = 2;
+
+    // Выполняемый запрос. Его соединение тоже проверяется в poll, чтобы отменить запрос,
+    // когда клиент отключится
+    struct Execution
+    {
+        int fd;
+        shared_ptr<runtime::CancellationToken> cancellation;
+        chrono::steady_clock::time_point deadline;
+    };
+    vector<Execution> executing;
+    constexpr auto NO_DEADLINE = chrono::steady_clock::time_point::max();
+
+    while (true)
+    {
+        const bool stopping = stopping_.load(memory_order_acquire);
+        if (stopping)
+        {
+            if (executing.empty())
+            {
+                break;
+            }
+            // Новые запросы не принимаются, цикл только дожидается начатых
+            for (size_t i = FIRST_CONNECTION; i < waiting.size(); ++i)
+            {
+                close(waiting[i].fd);
+            }
+            waiting.resize(FIRST_CONNECTION);
+            waiting[1].fd = -1;
+        }
+
+        // Соединения выполняемых запросов временно добавляются в конец waiting. События
+        // для них не запрашиваются: poll всё равно сообщает о закрытии через POLLHUP,
+        // а следующий запрос клиента не должен будить цикл
+        const size_t waiting_count = waiting.size();
+        vector<size_t> watched;
+        int timeout = -1;
+        const auto now = chrono::steady_clock::now();
+        for (size_t i = 0; i < executing.size(); ++i)
+        {
+            Execution& execution = executing[i];
+            if (execution.cancellation->IsCancelled())
+            {
+                continue;
+            }
+            if (execution.deadline != NO_DEADLINE)
+            {
+                const auto left = chrono::ceil<chrono::milliseconds>(execution.deadline - now);
+                const auto ms = static_cast<int>(clamp<chrono::milliseconds::rep>(left.count(), 0,
+                                                                                   INT_MAX));
+                timeout = timeout < 0 ? ms : min(timeout, ms);
+            }
+            waiting.push_back({execution.fd, 0, 0});
+            watched.push_back(i);
+        }
+
+        const int ready = poll(waiting.data(), waiting.size(), timeout);
+        if (ready < 0 && errno != EINTR)
+        {
+            ThrowSystemError("Can't wait for requests");
+        }
+
+        const auto woken = chrono::steady_clock::now();
+        for (size_t i = 0; i < watched.size(); ++i)
+        {
+            Execution& execution = executing[watched[i]];
+            if ((ready > 0 && waiting[waiting_count + i].revents != 0) || execution.deadline <= woken)
+            {
+                execution.cancellation->Cancel();
+            }
+        }
+        waiting.resize(waiting_count);
+        if (ready <= 0)
+        {
+            continue;
+        }
+
+        if (waiting[0].revents != 0)
+        {
+            char drain[256];
+            while (read(wake_fds_[0], drain, sizeof(drain)) > 0)
+            {
+            }
+            lock_guard lock(resumed_mutex_);
+            for (auto [fd, open] : resumed_)
+            {
+                auto it = find_if(executing.begin(), executing.end(),
+                                  [fd = fd](const Execution& execution) { return execution.fd == fd; });
+                *it = move(executing.back());
+                executing.pop_back();
+                if (open && !stopping)
+                {
+                    waiting.push_back({fd, POLLIN, 0});
+                }
+                else
+                {
+                    close(fd);
+                }
+            }
+            resumed_.clear();
+        }
+        if (waiting[1].revents != 0)
+        {
+            if (int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC); fd >= 0)
+            {
+                waiting.push_back({fd, POLLIN, 0});
+            }
+        }
+
+        for (size_t i = FIRST_CONNECTION; i < waiting.size();)
+        {
+            if (waiting[i].revents == 0)
+            {
+                ++i;
+                continue;
+            }
+            const int fd = waiting[i].fd;
+            waiting[i] = waiting.back();
+            waiting.pop_back();
+            auto cancellation = make_shared<runtime::CancellationToken>();
+            executing.push_back({fd, cancellation,
+                                 options_.timeout.count() > 0
+                                     ? chrono::steady_clock::now() + options_.timeout
+                                     : NO_DEADLINE});
+            (void)pool_->Submit([this, fd, cancellation] {
+                Resume(fd, Serve(fd, *cancellation));
+            });
+        }
+        for (pollfd& entry : waiting)
+        {
+            entry.revents = 0;
+        }
+    }
+
+    for (size_t i = FIRST_CONNECTION; i < waiting.size(); ++i)
+    {
+        close(waiting[i].fd);
+    }
+}
+
+void Server::Stop()
+{
+    stopping_.store(true, memory_order_release);
+    [[maybe_unused]] ssize_t result = write(wake_fds_[1], "", 1);
+}
+
+ServerStats Server::GetStats() const
+{
+    return {requests_.load(), cache_hits_.load(), failed_.load(), cancelled_.load()};
+}
+
+bool Server::Serve(int fd, const runtime::CancellationToken& cancellation)
+{
+    const RequestStatus status =
+        ServeRequest(fd, options_, cancellation,
+                     [this](string source) { return Compile(move(source)); });
+    if (status == RequestStatus::CLOSED)
+    {
+        return false;
+    }
+    ++requests_;
+    if (status == RequestStatus::SUCCEEDED)
+    {
+        return true;
+    }
+    ++failed_;
+    // Отмена, которая пришла после завершения программы, её не прервала
+    if (cancellation.IsCancelled())
+    {
+        ++cancelled_;
+    }
+    return status == RequestStatus::FAILED;
+}
+
+shared_ptr<runtime::Executable> Server::Compile(string source)
+{
+    {
+        lock_guard lock(cache_mutex_);
+        if (auto it = cache_.find(source); it != cache_.end())
+        {
+            ++cache_hits_;
+            return it->second->program;
+        }
+    }
+
+    // Программа разбирается без блокировки, поэтому одну и ту же новую программу
+    // могут одновременно разобрать несколько потоков. В кэше останется первая из них
+    auto cached = make_shared<CachedProgram>();
+    cached->program = ParseSource(source, options_.parse);
+    cached->source = move(source);
+
+    if (options_.cache_capacity == 0)
+    {
+        return cached->program;
+    }
+    lock_guard lock(cache_mutex_);
+    auto [it, inserted] = cache_.emplace(cached->source, cached);
+    if (!inserted)
+    {
+        return it->second->program;
+    }
+    cache_order_.push_back(cached);
+    if (cache_order_.size() > options_.cache_capacity)
+    {
+        cache_.erase(cache_order_.front()->source);
+        cache_order_.pop_front();
+    }
+    return cached->program;
+}
+
+void Server::Resume(int fd, bool open)
+{
+    {
+        lock_guard lock(resumed_mutex_);
+        resumed_.emplace_back(fd, open);
+    }
+    // Если канал переполнен, цикл ожидания и так проснётся и заберёт все соединения
+    [[maybe_unused]] ssize_t result = write(wake_fds_[1], "", 1);
+}
+
+ForkServer::ForkServer(filesystem::path socket_path, ForkServerOptions options)
+    : socket_path_(move(socket_path)), options_(move(options)), listen_fd_(Listen(socket_path_))
+{
+    if (pipe2(wake_fds_, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        const int error = errno;
+        close(listen_fd_);
+        unlink(socket_path_.c_str());
+        throw system_error(error, generic_category(), "Can't listen " + socket_path_.string());
+    }
+    if (options_.workers == 0)
+    {
+        options_.workers = max(thread::hardware_concurrency(), 1U);
+    }
+
+    try
+    {
+        // Выполнение разбирает тела вызванных методов, и дочерние процессы получают их готовыми
+        ostream discard(nullptr);
+        runtime::SimpleContext context(discard);
+        for (string& source : options_.preload)
+        {
+            shared_ptr<runtime::Executable> program = ParseSource(source, options_.parse);
+            runtime::Closure closure;
+            program->Execute(closure, context);
+            preloaded_.emplace(move(source), move(program));
+        }
+        options_.preload.clear();
+        ReserveHeap(options_.heap_reserve);
+    }
+    catch (...)
+    {
+        close(wake_fds_[0]);
+        close(wake_fds_[1]);
+        close(listen_fd_);
+        unlink(socket_path_.c_str());
+        throw;
+    }
+}
+
+ForkServer::~ForkServer()
+{
+    StopWorkers();
+    close(wake_fds_[0]);
+    close(wake_fds_[1]);
+    close(listen_fd_);
+    unlink(socket_path_.c_str());
+}
+
+void ForkServer::Run()
+{
+    vector<pollfd> waiting;
+    while (!stopping_.load(memory_order_acquire))
+    {
+        const auto idle = count_if(workers_.begin(), workers_.end(),
+                                   [](const Worker& worker) { return !worker.busy; });
+        for (size_t i = idle; i < options_.workers; ++i)
+        {
+            Spawn();
+        }
+
+        waiting.assign(1, {wake_fds_[0], POLLIN, 0});
+        for (const Worker& worker : workers_)
+        {
+            waiting.push_back({worker.fd, POLLIN, 0});
+        }
+        if (poll(waiting.data(), waiting.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ThrowSystemError("Can't wait for workers");
+        }
+
+        if (waiting[0].revents != 0)
+        {
+            char drain[256];
+            while (read(wake_fds_[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+        // Порядок процессов в workers_ совпадает с порядком их каналов в waiting
+        for (size_t i = 1, index = 0; i < waiting.size(); ++i)
+        {
+            Worker& worker = workers_[index];
+            char accepted = 0;
+            if (waiting[i].revents == 0)
+            {
+                ++index;
+            }
+            else if (!worker.busy && read(worker.fd, &accepted, 1) == 1)
+            {
+                // Процесс принял соединение, и на его место нужен новый свободный процесс
+                worker.busy = true;
+                ++jobs_started_;
+                ++index;
+            }
+            else
+            {
+                // Канал закрыт: процесс завершился
+                close(worker.fd);
+                while (waitpid(worker.pid, nullptr, 0) < 0 && errno == EINTR)
+                {
+                }
+                workers_.erase(workers_.begin() + static_cast<ptrdiff_t>(index));
+            }
+        }
+    }
+    StopWorkers();
+}
+
+void ForkServer::Stop()
+{
+    stopping_.store(true, memory_order_release);
+    [[maybe_unused]] ssize_t result = write(wake_fds_[1], "", 1);
+}
+
+size_t ForkServer::JobsStarted() const
+{
+    return jobs_started_.load();
+}
+
+void ForkServer::Spawn()
+{
+    int notify_fds[2];
+    if (pipe2(notify_fds, O_CLOEXEC) != 0)
+    {
+        ThrowSystemError("Can't create worker");
+    }
+    const pid_t pid = fork();
+    if (pid < 0)
+    {
+        const int error = errno;
+        close(notify_fds[0]);
+        close(notify_fds[1]);
+        throw system_error(error, generic_category(), "Can't create worker");
+    }
+    if (pid == 0)
+    {
+        close(notify_fds[0]);
+        Work(notify_fds[1]);
+    }
+    // Конец канала для записи есть только у дочернего процесса, поэтому канал
+    // закроется, когда процесс завершится
+    close(notify_fds[1]);
+    workers_.push_back({pid, notify_fds[0]});
+}
+
+void ForkServer::Work(int notify_fd)
+{
+    // Обработчики сигналов родительского процесса останавливают сервер, а дочерний
+    // процесс по сигналу должен просто завершиться
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    // Выход через _exit: деструкторы и обработчики atexit принадлежат родительскому процессу
+    try
+    {
+        int fd = -1;
+        while ((fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC)) < 0)
+        {
+            if (errno != EINTR)
+            {
+                _exit(1);
+            }
+        }
+        if (write(notify_fd, "", 1) != 1)
+        {
+            _exit(1);
+        }
+        runtime::CancellationToken cancellation;
+        runtime::Watchdog watchdog(cancellation, options_.timeout, fd);
+        const RequestStatus status =
+            ServeRequest(fd, options_, cancellation, [this](string source) {
+                if (auto it = preloaded_.find(source); it != preloaded_.end())
+                {
+                    return it->second;
+                }
+                return shared_ptr<runtime::Executable>(ParseSource(source, options_.parse));
+            });
+        _exit(status == RequestStatus::SUCCEEDED ? 0 : 1);
+    }
+    catch (...)
+    {
+        _exit(1);
+    }
+}
+
+void ForkServer::StopWorkers()
+{
+    // Свободные процессы ждут соединения в accept, который после shutdown завершается
+    // ошибкой. Занятые процессы доделывают свой запрос
+    shutdown(listen_fd_, SHUT_RDWR);
+    for (const Worker& worker : workers_)
+    {
+        char accepted = 0;
+        if (!worker.busy && read(worker.fd, &accepted, 1) == 1)
+        {
+            ++jobs_started_;
+        }
+        close(worker.fd);
+        while (waitpid(worker.pid, nullptr, 0) < 0 && errno == EINTR)
+        {
+        }
+    }
+    workers_.clear();
+}
+
+Client::Client(const filesystem::path& socket_path)
+    : fd_(Connect(MakeAddress(socket_path)))
+{
+    if (fd_ < 0)
+    {
+        throw system_error(errno, generic_category(), "Can't connect " + socket_path.string());
+    }
+}
+
+Client::~Client()
+{
+    close(fd_);
+}
+
+void Client::Execute(string_view source, ostream& output)
+{
+    Request(source, {}, &output);
+}
+
+void Client::Execute(string_view source, const filesystem::path& output_path)
+{
+    if (output_path.empty())
+    {
+        throw invalid_argument("Output path is empty");
+    }
+    Request(source, output_path.native(), nullptr);
+}
+
+void Client::Request(string_view source, string_view output_path, ostream* output)
+{
+    uint64_t source_size = source.size();
+    uint64_t path_size = output_path.size();
+    iovec parts[4] = {{&source_size, sizeof(source_size)},
+                      {const_cast<char*>(source.data()), source.size()},  // NOLINT
+                      {&path_size, sizeof(path_size)},
+                      {const_cast<char*>(output_path.data()), output_path.size()}};  // NOLINT
+    try
+    {
+        SendAll(fd_, parts, 4);
+
+        string data;
+        while (true)
+        {
+            char header[HEADER_SIZE];
+            if (!ReceiveAll(fd_, header, HEADER_SIZE))
+            {
+                throw ConnectionError("Connection closed");
+            }
+            uint64_t size = 0;
+            memcpy(&size, header + 1, sizeof(size));
+            if (size > MAX_REQUEST_SIZE)
+            {
+                throw ConnectionError("Response is too large");
+            }
+            data.resize(size);
+            if (size > 0 && !ReceiveAll(fd_, data.data(), data.size()))
+            {
+                throw ConnectionError("Connection closed");
+            }
+
+            switch (static_cast<MessageType>(header[0]))
+            {
+            case MessageType::OUTPUT:
+                if (output != nullptr)
+                {
+                    output->write(data.data(), static_cast<streamsize>(data.size()));
+                }
+                break;
+            case MessageType::DONE:
+                return;
+            case MessageType::ERROR:
+                throw runtime_error(data);
+            default:
+                throw ConnectionError("Unknown message from server");
+            }
+        }
+    }
+    catch (const ConnectionError& e)
+    {
+        // Для вызывающего кода обрыв соединения - обычная ошибка выполнения
+        throw runtime_error(e.what());
+    }
+}
+
+}  // namespace server
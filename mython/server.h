@@ -0,0 +1,241 @@
+#pragma once
+
+#include "output.h"
+#include "parse.h"
+#include "runtime.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+// Сервер, который выполняет программы, присланные через локальный сокет.
+//
+// Клиент отправляет запрос: длину текста программы (8 байт), текст программы, длину пути
+// к файлу вывода (8 байт) и сам путь. Длины записываются в порядке байт машины. Если путь
+// пуст, вывод программы передаётся клиенту, иначе сервер записывает его в указанный файл.
+// Сервер отвечает последовательностью сообщений: тип сообщения (1 байт), длина данных
+// (8 байт) и данные. Сообщения OUTPUT содержат очередную часть вывода программы,
+// ответ заканчивается сообщением DONE или сообщением ERROR с текстом ошибки.
+// Через одно соединение можно отправить несколько запросов подряд
+namespace server
+{
+
+enum class MessageType : char
+{
+    OUTPUT = 'O',
+    DONE = 'D',
+    ERROR = 'E',
+};
+
+// Настройки сервера
+struct ServerOptions
+{
+    ParseOptions parse;
+    // Настройки вывода в файл, указанный в запросе
+    runtime::OutputOptions output;
+    // Ограничения на выполнение каждой программы
+    runtime::ExecutionLimits limits;
+    // Сколько может выполняться один запрос, считая с его получения, 0 - без ограничения.
+    // Запрос также отменяется, если клиент закрыл соединение
+    std::chrono::milliseconds timeout{0};
+    runtime::CollectorOptions collector;
+    // Размер буфера, который накапливает вывод перед отправкой клиенту
+    size_t send_buffer_size = 64 << 10;
+    // Количество потоков, выполняющих запросы, 0 - по числу ядер
+    size_t thread_count = 0;
+    // Сколько разобранных программ хранить в кэше. При переполнении из кэша
+    // удаляется программа, которая попала в него раньше остальных
+    size_t cache_capacity = 1024;
+};
+
+// Счётчики запросов, выполненных сервером
+struct ServerStats
+{
+    size_t requests = 0;
+    // Запросы, программы которых уже были разобраны
+    size_t cache_hits = 0;
+    // Запросы, завершившиеся ошибкой
+    size_t failed = 0;
+    // Запросы, отменённые по истечении времени или из-за отключения клиента
+    size_t cancelled = 0;
+};
+
+class Server
+{
+public:
+    // Создаёт сокет socket_path и начинает принимать соединения. Файл сокета, оставшийся
+    // от остановленного сервера, заменяется. Выбрасывает std::system_error, если сокет
+    // не удалось создать
+    explicit Server(std::filesystem::path socket_path, ServerOptions options = {});
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Дожидается выполнения начатых запросов, закрывает соединения и удаляет файл сокета
+    ~Server();
+
+    // Обслуживает соединения, пока не будет вызван Stop. После Stop новые запросы
+    // не принимаются, а Run возвращает управление, когда выполнятся начатые
+    void Run();
+
+    // Останавливает Run. Может вызываться из другого потока и из обработчика сигнала
+    void Stop();
+
+    [[nodiscard]] ServerStats GetStats() const;
+
+private:
+    // Разобранная программа и её текст, на который ссылается ключ кэша
+    struct CachedProgram
+    {
+        std::string source;
+        std::shared_ptr<runtime::Executable> program;
+    };
+
+    // Выполняет один запрос соединения fd. Возвращает false, если соединение нужно закрыть
+    bool Serve(int fd, const runtime::CancellationToken& cancellation);
+    // Возвращает разобранную программу source из кэша или разбирает её и помещает в кэш
+    std::shared_ptr<runtime::Executable> Compile(std::string source);
+    // Возвращает соединение fd, запрос которого выполнен, в цикл ожидания запросов.
+    // Если open равен false, цикл закрывает соединение
+    void Resume(int fd, bool open);
+
+    std::filesystem::path socket_path_;
+    ServerOptions options_;
+    int listen_fd_ = -1;
+    // Канал, через который Stop и Resume будят цикл ожидания
+    int wake_fds_[2] = {-1, -1};
+    std::atomic<bool> stopping_ = false;
+
+    std::mutex resumed_mutex_;
+    // Соединения, возвращённые через Resume, и признак того, что их нужно оставить открытыми
+    std::vector<std::pair<int, bool>> resumed_;
+
+    std::mutex cache_mutex_;
+    // Ключи ссылаются на тексты программ из cache_order_
+    std::unordered_map<std::string_view, std::shared_ptr<const CachedProgram>> cache_;
+    std::deque<std::shared_ptr<const CachedProgram>> cache_order_;
+
+    std::atomic<size_t> requests_ = 0;
+    std::atomic<size_t> cache_hits_ = 0;
+    std::atomic<size_t> failed_ = 0;
+    std::atomic<size_t> cancelled_ = 0;
+
+    std::unique_ptr<util::ThreadPool> pool_;
+};
+
+// Настройки сервера, который выполняет каждый запрос в отдельном процессе
+struct ForkServerOptions
+{
+    ParseOptions parse;
+    runtime::OutputOptions output;
+    runtime::ExecutionLimits limits;
+    std::chrono::milliseconds timeout{0};
+    runtime::CollectorOptions collector;
+    size_t send_buffer_size = 64 << 10;
+    // Количество дочерних процессов, готовых принять запрос, 0 - по числу ядер
+    size_t workers = 0;
+    // Сколько памяти заранее выделить и оставить в куче родительского процесса.
+    // Дочерние процессы получают готовую кучу и не запрашивают память у системы
+    size_t heap_reserve = 32 << 20;
+    // Тексты программ, которые родительский процесс разбирает заранее и один раз выполняет,
+    // отбрасывая вывод. Дочерние процессы выполняют эти программы без разбора
+    std::vector<std::string> preload;
+};
+
+// Сервер, который изолирует программы друг от друга: каждый запрос выполняет отдельный
+// процесс. Родительский процесс один раз подготавливает общее состояние и заранее
+// порождает через fork дочерние процессы, которые разделяют его память до первой записи.
+// Дочерний процесс принимает одно соединение, выполняет один запрос и завершается,
+// а родительский процесс сразу порождает ему замену.
+// Протокол тот же, что у Server, но в одном соединении выполняется только один запрос
+class ForkServer
+{
+public:
+    // Создаёт сокет socket_path и подготавливает программы из options.preload.
+    // Выбрасывает std::system_error, если сокет не удалось создать, и исключение разбора
+    // или выполнения, если в подготавливаемой программе есть ошибка
+    explicit ForkServer(std::filesystem::path socket_path, ForkServerOptions options = {});
+
+    ForkServer(const ForkServer&) = delete;
+    ForkServer& operator=(const ForkServer&) = delete;
+
+    // Завершает свободные дочерние процессы, дожидается занятых и удаляет файл сокета
+    ~ForkServer();
+
+    // Поддерживает нужное число свободных дочерних процессов, пока не будет вызван Stop
+    void Run();
+
+    // Останавливает Run. Может вызываться из другого потока и из обработчика сигнала
+    void Stop();
+
+    // Возвращает количество соединений, принятых дочерними процессами
+    [[nodiscard]] size_t JobsStarted() const;
+
+private:
+    // Дочерний процесс и канал, через который он сообщает о принятом соединении.
+    // Когда процесс завершается, канал закрывается
+    struct Worker
+    {
+        pid_t pid;
+        int fd;
+        bool busy = false;
+    };
+
+    void Spawn();
+    // Выполняет один запрос в дочернем процессе и завершает его
+    [[noreturn]] void Work(int notify_fd);
+    // Завершает свободные дочерние процессы и дожидается всех
+    void StopWorkers();
+
+    std::filesystem::path socket_path_;
+    ForkServerOptions options_;
+    int listen_fd_ = -1;
+    int wake_fds_[2] = {-1, -1};
+    std::atomic<bool> stopping_ = false;
+    std::unordered_map<std::string, std::shared_ptr<runtime::Executable>> preloaded_;
+    std::vector<Worker> workers_;
+    std::atomic<size_t> jobs_started_ = 0;
+};
+
+// Соединение с сервером
+class Client
+{
+public:
+    // Подключается к серверу через сокет socket_path. Выбрасывает std::system_error,
+    // если подключиться не удалось
+    explicit Client(const std::filesystem::path& socket_path);
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    ~Client();
+
+    // Выполняет программу source на сервере и записывает её вывод в output.
+    // Выбрасывает std::runtime_error с текстом ошибки, если программа завершилась с ошибкой.
+    // Вывод, сделанный до ошибки, к этому моменту уже записан в output
+    void Execute(std::string_view source, std::ostream& output);
+
+    // Выполняет программу source на сервере, который записывает её вывод в файл output_path.
+    // Относительный путь отсчитывается от рабочего каталога сервера
+    void Execute(std::string_view source, const std::filesystem::path& output_path);
+
+private:
+    void Request(std::string_view source, std::string_view output_path, std::ostream* output);
+
+    int fd_;
+};
+
+}  // namespace server
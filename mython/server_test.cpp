@@ -0,0 +1,295 @@
+#include "lexer.h"
+#include "server.h"
+#include "test_runner_p.h"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace server {
+
+namespace {
+
+// Обслуживает соединения в отдельном потоке и останавливает сервер при разрушении,
+// в том числе если проверка в тесте не прошла
+class ServingThread {
+public:
+    explicit ServingThread(Server& server)
+        : server_(server)
+        , thread_([&server] { server.Run(); }) {
+    }
+
+    ~ServingThread() {
+        server_.Stop();
+        thread_.join();
+    }
+
+private:
+    Server& server_;
+    thread thread_;
+};
+
+void TestServer() {
+    const auto socket_path = filesystem::temp_directory_path() / "mython_server_test.sock"s;
+    const auto output_path = filesystem::temp_directory_path() / "mython_server_test.txt"s;
+
+    ServerOptions options;
+    options.thread_count = 2;
+    options.send_buffer_size = 16;
+    Server server(socket_path, options);
+    auto serving = make_unique<ServingThread>(server);
+
+    const string program = R"(
+class Greeter:
+  def __init__(name):
+    self.name = name
+
+  def __str__():
+    return 'Hello, ' + self.name
+
+print Greeter('world')
+print 1, 2, 3
+)";
+    const string expected = "Hello, world\n1 2 3\n"s;
+    {
+        Client client(socket_path);
+        for (int i = 0; i < 3; ++i) {
+            ostringstream output;
+            client.Execute(program, output);
+            ASSERT_EQUAL(output.str(), expected);
+        }
+
+        // Ошибка выполнения не закрывает соединение, а вывод до ошибки доходит до клиента
+        ostringstream output;
+        ASSERT_THROWS(client.Execute("print 'before'\nprint x"s, output), runtime_error);
+        ASSERT_EQUAL(output.str(), "before\n"s);
+        ASSERT_THROWS(client.Execute("x = 1 +"s, output), runtime_error);
+
+        client.Execute(program, output_path);
+        ifstream file(output_path, ios::binary);
+        ASSERT_EQUAL(string(istreambuf_iterator<char>(file), istreambuf_iterator<char>()), expected);
+    }
+    {
+        // Вывод, который не помещается в буфер отправки, передаётся несколькими сообщениями
+        string long_program;
+        string long_expected;
+        for (int i = 0; i < 100; ++i) {
+            long_program += "print "s + to_string(i) + ", 'some text'\n"s;
+            long_expected += to_string(i) + " some text\n"s;
+        }
+        vector<thread> clients;
+        vector<string> outputs(4);
+        for (string& result : outputs) {
+            clients.emplace_back([&] {
+                Client client(socket_path);
+                ostringstream output;
+                client.Execute(long_program, output);
+                result = output.str();
+            });
+        }
+        for (thread& client : clients) {
+            client.join();
+        }
+        for (const string& result : outputs) {
+            ASSERT_EQUAL(result, long_expected);
+        }
+    }
+
+    serving.reset();
+
+    const ServerStats stats = server.GetStats();
+    ASSERT_EQUAL(stats.requests, 10U);
+    ASSERT_EQUAL(stats.failed, 2U);
+    // Первая программа разобрана один раз на 4 выполнения. Длинную программу клиенты
+    // могли разобрать одновременно, поэтому число попаданий в кэш для неё не определено
+    ASSERT(stats.cache_hits >= 3U && stats.cache_hits <= 6U);
+
+    filesystem::remove(output_path);
+}
+
+void TestServerCancellation() {
+    const auto socket_path = filesystem::temp_directory_path() / "mython_cancel_test.sock"s;
+    // Программа выполнялась бы годами, но глубина рекурсии в ней мала
+    const string endless = R"(
+class Fibonacci:
+  def calc(n):
+    if n < 2:
+      return n
+    return self.calc(n - 1) + self.calc(n - 2)
+
+f = Fibonacci()
+print 'start'
+print f.calc(60)
+)";
+
+    ServerOptions options;
+    options.thread_count = 1;
+    options.send_buffer_size = 1;
+    options.timeout = 100ms;
+    {
+        Server server(socket_path, options);
+        {
+            ServingThread serving(server);
+            Client client(socket_path);
+            ostringstream output;
+            const auto start = chrono::steady_clock::now();
+            ASSERT_THROWS(client.Execute(endless, output), runtime_error);
+            ASSERT(chrono::steady_clock::now() - start < 5s);
+            ASSERT_EQUAL(output.str(), "start\n"s);
+            // Соединение остаётся открытым, и следующий запрос выполняется
+            client.Execute("print 'next'"s, output);
+            ASSERT_EQUAL(output.str(), "start\nnext\n"s);
+        }
+        ASSERT_EQUAL(server.GetStats().cancelled, 1U);
+    }
+
+    // Клиент отправил запрос и отключился: сервер отменяет его и освобождает поток
+    options.timeout = 0ms;
+    Server server(socket_path, options);
+    ServingThread serving(server);
+    {
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+        ASSERT(connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0);
+        string request;
+        const uint64_t sizes[] = {endless.size(), 0};
+        request.append(reinterpret_cast<const char*>(&sizes[0]), sizeof(uint64_t));
+        request += endless;
+        request.append(reinterpret_cast<const char*>(&sizes[1]), sizeof(uint64_t));
+        ASSERT(write(fd, request.data(), request.size()) == static_cast<ssize_t>(request.size()));
+        // Ответ на запрос начинается с вывода первой строки
+        char header = 0;
+        ASSERT(read(fd, &header, 1) == 1);
+        close(fd);
+    }
+    Client client(socket_path);
+    ostringstream output;
+    client.Execute("print 'free'"s, output);
+    ASSERT_EQUAL(output.str(), "free\n"s);
+    ASSERT_EQUAL(server.GetStats().cancelled, 1U);
+}
+
+void TestForkServer() {
+    const auto socket_path = filesystem::temp_directory_path() / "mython_fork_server_test.sock"s;
+    const string preloaded = R"(
+class Counter:
+  def __init__():
+    self.value = 0
+
+  def add():
+    self.value = self.value + 1
+    return self
+
+c = Counter()
+c.add()
+c.add()
+print c.value
+)";
+
+    ForkServerOptions options;
+    options.workers = 2;
+    options.heap_reserve = 1 << 20;
+    options.preload = {preloaded};
+    ForkServer server(socket_path, options);
+    {
+        thread serving([&server] { server.Run(); });
+        // Вывод подготовленной программы при подготовке отбрасывается
+        for (int i = 0; i < 5; ++i) {
+            Client client(socket_path);
+            ostringstream output;
+            client.Execute(preloaded, output);
+            ASSERT_EQUAL(output.str(), "2\n"s);
+            // Процесс выполняет один запрос и завершается
+            ASSERT_THROWS(client.Execute(preloaded, output), runtime_error);
+        }
+        {
+            Client client(socket_path);
+            ostringstream output;
+            ASSERT_THROWS(client.Execute("print 'partial'\nprint missing"s, output), runtime_error);
+            ASSERT_EQUAL(output.str(), "partial\n"s);
+        }
+        server.Stop();
+        serving.join();
+    }
+    ASSERT_EQUAL(server.JobsStarted(), 6U);
+
+    // Запрос, который не уложился во время, отменяется в дочернем процессе
+    options.timeout = 100ms;
+    {
+        ForkServer timed_server(socket_path, options);
+        thread serving([&timed_server] { timed_server.Run(); });
+        Client client(socket_path);
+        ostringstream output;
+        ASSERT_THROWS(client.Execute("class A:\n  def f(n):\n    if n < 2:\n      return n\n"
+                                     "    return self.f(n - 1) + self.f(n - 2)\n\n"
+                                     "a = A()\nprint a.f(60)\n"s,
+                                     output),
+                      runtime_error);
+        timed_server.Stop();
+        serving.join();
+    }
+
+    options.preload = {"print 1 +"s};
+    ASSERT_THROWS(ForkServer(socket_path, options), parse::LexerError);
+}
+
+void TestListenKeepsForeignFiles() {
+    // Обычный файл по пути сокета не удаляется, а сервер не запускается
+    const auto file_path = filesystem::temp_directory_path() / "mython_listen_test.txt"s;
+    {
+        ofstream file(file_path);
+        file << "data"s;
+    }
+    ASSERT_THROWS(Server(file_path, ServerOptions{}), system_error);
+    ASSERT_THROWS(ForkServer(file_path, ForkServerOptions{}), system_error);
+    {
+        ifstream file(file_path);
+        ASSERT_EQUAL(string(istreambuf_iterator<char>(file), istreambuf_iterator<char>()), "data"s);
+    }
+    filesystem::remove(file_path);
+
+    // Сокет, который остался от остановленного сервера, заменяется
+    const auto socket_path = filesystem::temp_directory_path() / "mython_listen_test.sock"s;
+    filesystem::remove(socket_path);
+    {
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+        ASSERT(bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0);
+        close(fd);
+    }
+    ServerOptions options;
+    options.thread_count = 1;
+    Server server(socket_path, options);
+    ServingThread serving(server);
+    // Работающий сервер не заменяется
+    ASSERT_THROWS(Server(socket_path, options), system_error);
+    Client client(socket_path);
+    ostringstream output;
+    client.Execute("print 'ok'"s, output);
+    ASSERT_EQUAL(output.str(), "ok\n"s);
+}
+
+}  // namespace
+
+void RunServerTests(TestRunner& tr) {
+    RUN_TEST(tr, server::TestServer);
+    RUN_TEST(tr, server::TestServerCancellation);
+    RUN_TEST(tr, server::TestForkServer);
+    RUN_TEST(tr, server::TestListenKeepsForeignFiles);
+}
+
+}  // namespace server
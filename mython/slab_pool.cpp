@@ -0,0 +1,89 @@
+#include "slab_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+
+using namespace std;
+
+namespace util
+{
+
+SlabPool::SlabPool(size_t first_page_slots, size_t max_page_slots)
+    : next_page_slots_(max<size_t>(first_page_slots, 1)),
+      max_page_slots_(max(max_page_slots, next_page_slots_))
+{
+}
+
+void* SlabPool::Allocate(size_t size)
+{
+    const size_t slot_size = SlotSize(size);
+    lock_guard lock(mutex_);
+    if (slot_size_ == 0)
+    {
+        slot_size_ = slot_size;
+    }
+    else if (slot_size != slot_size_)
+    {
+        return nullptr;
+    }
+    if (!free_)
+    {
+        AddPage();
+    }
+    FreeSlot* slot = free_;
+    free_ = slot->next;
+    ++used_;
+    return slot;
+}
+
+bool SlabPool::Deallocate(void* p, size_t size) noexcept
+{
+    const size_t slot_size = SlotSize(size);
+    lock_guard lock(mutex_);
+    if (slot_size != slot_size_)
+    {
+        return false;
+    }
+    auto* slot = static_cast<FreeSlot*>(p);
+    slot->next = free_;
+    free_ = slot;
+    --used_;
+    return true;
+}
+
+size_t SlabPool::GetUsedSlots() const
+{
+    lock_guard lock(mutex_);
+    return used_;
+}
+
+size_t SlabPool::GetCapacity() const
+{
+    lock_guard lock(mutex_);
+    return capacity_;
+}
+
+size_t SlabPool::SlotSize(size_t size) noexcept
+{
+    constexpr size_t ALIGNMENT = alignof(max_align_t);
+    return (max(size, sizeof(FreeSlot)) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+void SlabPool::AddPage()
+{
+    const size_t slots = next_page_slots_;
+    pages_.reserve(pages_.size() + 1);
+    pages_.emplace_back(new byte[slots * slot_size_]);
+    byte* page = pages_.back().get();
+    // Ячейки связываются в порядке адресов, чтобы экземпляры, созданные подряд, лежали рядом
+    for (size_t i = slots; i > 0; --i)
+    {
+        auto* slot = reinterpret_cast<FreeSlot*>(page + (i - 1) * slot_size_);
+        slot->next = free_;
+        free_ = slot;
+    }
+    capacity_ += slots;
+    next_page_slots_ = min(slots * 2, max_page_slots_);
+}
+
+}  // namespace util
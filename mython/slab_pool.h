@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace util
+{
+
+// Пул ячеек одного размера. Память выделяется страницами по нескольку ячеек, а освобождённые
+// ячейки попадают в список свободных и выдаются снова, не возвращаясь в общую кучу.
+// Размер ячейки задаёт первое выделение, запросы другого размера пул не обслуживает.
+// Страницы освобождаются вместе с пулом. Пул можно использовать из нескольких потоков
+class SlabPool
+{
+public:
+    // first_page_slots - сколько ячеек в первой странице. Следующие страницы вдвое больше
+    // предыдущих, пока не достигнут max_page_slots ячеек
+    explicit SlabPool(size_t first_page_slots = 16, size_t max_page_slots = 1024);
+
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    // Возвращает ячейку для объекта размера size или nullptr, если ячейки пула другого размера.
+    // Ячейка выровнена как std::max_align_t
+    [[nodiscard]] void* Allocate(size_t size);
+
+    // Возвращает в пул ячейку p, выделенную через Allocate(size). Возвращает false и ничего
+    // не делает, если ячейки пула другого размера и p выделена не пулом
+    bool Deallocate(void* p, size_t size) noexcept;
+
+    // Сколько ячеек занято сейчас
+    [[nodiscard]] size_t GetUsedSlots() const;
+    // Сколько ячеек во всех страницах пула
+    [[nodiscard]] size_t GetCapacity() const;
+
+private:
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    // Размер ячейки для объекта размера size
+    static size_t SlotSize(size_t size) noexcept;
+    // Выделяет новую страницу и добавляет её ячейки в список свободных
+    void AddPage();
+
+    mutable std::mutex mutex_;
+    size_t slot_size_ = 0;
+    size_t next_page_slots_;
+    size_t max_page_slots_;
+    FreeSlot* free_ = nullptr;
+    std::vector<std::unique_ptr<std::byte[]>> pages_;
+    size_t capacity_ = 0;
+    size_t used_ = 0;
+};
+
+}  // namespace util
@@ -0,0 +1,454 @@
+#include "snapshot.h"
+
+#include "version.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace runtime
+{
+
+namespace
+{
+
+constexpr string_view SNAPSHOT_MAGIC = "Mython snapshot\n";
+
+// Вид сохранённого значения
+enum class ValueTag : uint8_t
+{
+    NONE,
+    NUMBER,
+    STRING,
+    BOOL,
+    CLASS,
+    INSTANCE,
+};
+
+[[noreturn]] void ThrowSystemError(const string& what)
+{
+    throw system_error(errno, generic_category(), what);
+}
+
+// Записывает значения в буфер снимка. Числа записываются в порядке байт машины:
+// снимок с другой архитектуры не подходит и по версии интерпретатора
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(const vector<const Class*>& classes)
+    {
+        for (size_t i = 0; i < classes.size(); ++i)
+        {
+            class_indices_.emplace(classes[i], i);
+        }
+    }
+
+    template <typename T>
+    void Write(T value)
+    {
+        data_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void WriteString(string_view value)
+    {
+        Write<uint64_t>(value.size());
+        data_.append(value);
+    }
+
+    // Запоминает экземпляр класса, если он встретился впервые
+    void AddInstance(const ClassInstance* instance)
+    {
+        if (instance_indices_.emplace(instance, instances_.size()).second)
+        {
+            instances_.push_back(instance);
+        }
+    }
+
+    void WriteValue(const ObjectHolder& value)
+    {
+        if (!value)
+        {
+            Write(ValueTag::NONE);
+        }
+        else if (const auto* number = value.TryAs<Number>())
+        {
+            Write(ValueTag::NUMBER);
+            Write(number->GetValue());
+        }
+        else if (const auto* str = value.TryAs<String>())
+        {
+            Write(ValueTag::STRING);
+            WriteString(str->GetValue());
+        }
+        else if (const auto* boolean = value.TryAs<Bool>())
+        {
+            Write(ValueTag::BOOL);
+            Write<uint8_t>(boolean->GetValue() ? 1 : 0);
+        }
+        else if (const auto* cls = value.TryAs<Class>())
+        {
+            Write(ValueTag::CLASS);
+            Write<uint64_t>(ClassIndex(*cls));
+        }
+        else if (const auto* instance = value.TryAs<ClassInstance>())
+        {
+            Write(ValueTag::INSTANCE);
+            Write<uint64_t>(instance_indices_.at(instance));
+        }
+        else
+        {
+            throw runtime_error("Can't save value to snapshot"s);
+        }
+    }
+
+    size_t ClassIndex(const Class& cls) const
+    {
+        auto it = class_indices_.find(&cls);
+        if (it == class_indices_.end())
+        {
+            throw runtime_error("Can't save class "s + cls.GetName() + " to snapshot"s);
+        }
+        return it->second;
+    }
+
+    const vector<const ClassInstance*>& Instances() const
+    {
+        return instances_;
+    }
+
+    string& Data()
+    {
+        return data_;
+    }
+
+private:
+    string data_;
+    unordered_map<const Class*, size_t> class_indices_;
+    unordered_map<const ClassInstance*, size_t> instance_indices_;
+    vector<const ClassInstance*> instances_;
+};
+
+// Читает значения из отображённого в память снимка, проверяя границы
+class SnapshotReader
+{
+public:
+    SnapshotReader(const char* data, size_t size, size_t offset)
+        : pos_(data + offset), end_(data + size)
+    {
+    }
+
+    template <typename T>
+    T Read()
+    {
+        T value;
+        memcpy(&value, Take(sizeof(value)), sizeof(value));
+        return value;
+    }
+
+    string_view ReadString()
+    {
+        const auto size = Read<uint64_t>();
+        if (size > static_cast<uint64_t>(end_ - pos_))
+        {
+            throw SnapshotError("Snapshot is corrupted"s);
+        }
+        return {Take(size), static_cast<size_t>(size)};
+    }
+
+    // Читает номер, который должен быть меньше count
+    size_t ReadIndex(size_t count)
+    {
+        const auto index = Read<uint64_t>();
+        if (index >= count)
+        {
+            throw SnapshotError("Snapshot is corrupted"s);
+        }
+        return static_cast<size_t>(index);
+    }
+
+    // Память прочитанных значений учитывается в счётчике памяти context
+    ObjectHolder ReadValue(const vector<const Class*>& classes,
+                           const vector<ObjectHolder>& instances, Context& context)
+    {
+        switch (Read<ValueTag>())
+        {
+        case ValueTag::NONE:
+            return ObjectHolder::None();
+        case ValueTag::NUMBER:
+            return ObjectHolder::Own(Number(Read<int>()), context);
+        case ValueTag::STRING:
+            return ObjectHolder::Own(String(string(ReadString())), context);
+        case ValueTag::BOOL:
+            return ObjectHolder::Own(Bool(Read<uint8_t>() != 0), context);
+        case ValueTag::CLASS:
+        {
+            // Классы не изменяются при выполнении программы, ими владеет дерево пролога
+            const Class& cls = *classes[ReadIndex(classes.size())];
+            return ObjectHolder::Share(const_cast<Class&>(cls));  // NOLINT
+        }
+        case ValueTag::INSTANCE:
+            return instances[ReadIndex(instances.size())];
+        }
+        throw SnapshotError("Snapshot is corrupted"s);
+    }
+
+    size_t Offset(const char* data) const
+    {
+        return static_cast<size_t>(pos_ - data);
+    }
+
+private:
+    const char* Take(size_t size)
+    {
+        if (size > static_cast<size_t>(end_ - pos_))
+        {
+            throw SnapshotError("Snapshot is corrupted"s);
+        }
+        const char* result = pos_;
+        pos_ += size;
+        return result;
+    }
+
+    const char* pos_;
+    const char* end_;
+};
+
+}  // namespace
+
+optional<pair<string_view, string_view>> SplitAtSnapshotMarker(string_view source)
+{
+    for (size_t line_start = 0; line_start < source.size();)
+    {
+        size_t line_end = source.find('\n', line_start);
+        if (line_end == string_view::npos)
+        {
+            line_end = source.size();
+        }
+        string_view line = source.substr(line_start, line_end - line_start);
+        while (!line.empty() && (line.back() == ' ' || line.back() == '\r'))
+        {
+            line.remove_suffix(1);
+        }
+        if (line == SNAPSHOT_MARKER)
+        {
+            return pair{source.substr(0, line_start), source.substr(line_start)};
+        }
+        line_start = line_end + 1;
+    }
+    return nullopt;
+}
+
+void SaveSnapshot(const std::filesystem::path& path, string_view prologue, string_view output,
+                  bool output_deterministic, const Closure& closure,
+                  const vector<const Class*>& classes)
+{
+    SnapshotWriter writer(classes);
+    writer.WriteString(SNAPSHOT_MAGIC);
+    writer.WriteString(MYTHON_VERSION);
+    writer.Write<uint8_t>(output_deterministic ? 1 : 0);
+    writer.WriteString(prologue);
+    writer.WriteString(output);
+
+    writer.Write<uint64_t>(classes.size());
+    for (const Class* cls : classes)
+    {
+        writer.WriteString(cls->GetName());
+    }
+
+    // Экземпляры нумеруются в порядке обхода, общие экземпляры и циклы сохраняются один раз
+    for (const auto& [name, value] : closure)
+    {
+        if (const auto* instance = value.TryAs<ClassInstance>())
+        {
+            writer.AddInstance(instance);
+        }
+    }
+    for (size_t i = 0; i < writer.Instances().size(); ++i)
+    {
+        for (const auto& [name, value] : writer.Instances()[i]->Fields())
+        {
+            if (const auto* instance = value.TryAs<ClassInstance>())
+            {
+                writer.AddInstance(instance);
+            }
+        }
+    }
+
+    writer.Write<uint64_t>(writer.Instances().size());
+    for (const ClassInstance* instance : writer.Instances())
+    {
+        writer.Write<uint64_t>(writer.ClassIndex(instance->GetClass()));
+    }
+    for (const ClassInstance* instance : writer.Instances())
+    {
+        writer.Write<uint64_t>(instance->Fields().size());
+        for (const auto& [name, value] : instance->Fields())
+        {
+            writer.WriteString(name.GetName());
+            writer.WriteValue(value);
+        }
+    }
+    writer.Write<uint64_t>(closure.size());
+    for (const auto& [name, value] : closure)
+    {
+        writer.WriteString(name.GetName());
+        writer.WriteValue(value);
+    }
+
+    string temp_path = path.string() + ".XXXXXX"s;
+    const int fd = mkstemp(temp_path.data());
+    if (fd < 0)
+    {
+        ThrowSystemError("Can't save snapshot "s + path.string());
+    }
+    const string& data = writer.Data();
+    for (size_t written = 0; written < data.size();)
+    {
+        const ssize_t count = write(fd, data.data() + written, data.size() - written);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count < 0)
+        {
+            const int error = errno;
+            close(fd);
+            unlink(temp_path.c_str());
+            throw system_error(error, generic_category(), "Can't save snapshot "s + path.string());
+        }
+        written += static_cast<size_t>(count);
+    }
+    close(fd);
+    if (rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        const int error = errno;
+        unlink(temp_path.c_str());
+        throw system_error(error, generic_category(), "Can't save snapshot "s + path.string());
+    }
+}
+
+Snapshot::Snapshot(const std::filesystem::path& path)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info{};
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        const int error = errno;
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        throw system_error(error, generic_category(), "Can't open snapshot "s + path.string());
+    }
+    size_ = static_cast<size_t>(info.st_size);
+    void* data = size_ > 0 ? mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    const int error = errno;
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        throw system_error(error, generic_category(), "Can't map snapshot "s + path.string());
+    }
+    data_ = static_cast<const char*>(data);
+
+    try
+    {
+        SnapshotReader reader(data_, size_, 0);
+        if (reader.ReadString() != SNAPSHOT_MAGIC)
+        {
+            throw SnapshotError(path.string() + " is not a snapshot"s);
+        }
+        if (string_view version = reader.ReadString(); version != MYTHON_VERSION)
+        {
+            throw SnapshotError("Snapshot "s + path.string() + " was made by interpreter version "s
+                                + string(version));
+        }
+        output_deterministic_ = reader.Read<uint8_t>() != 0;
+        prologue_ = reader.ReadString();
+        output_ = reader.ReadString();
+        objects_offset_ = reader.Offset(data_);
+    }
+    catch (...)
+    {
+        if (data_)
+        {
+            munmap(const_cast<char*>(data_), size_);  // NOLINT
+        }
+        throw;
+    }
+}
+
+Snapshot::~Snapshot()
+{
+    if (data_)
+    {
+        munmap(const_cast<char*>(data_), size_);  // NOLINT
+    }
+}
+
+string_view Snapshot::Prologue() const
+{
+    return prologue_;
+}
+
+string_view Snapshot::Output() const
+{
+    return output_;
+}
+
+bool Snapshot::IsOutputDeterministic() const
+{
+    return output_deterministic_;
+}
+
+void Snapshot::Restore(Closure& closure, const vector<const Class*>& classes,
+                       Context& context) const
+{
+    SnapshotReader reader(data_, size_, objects_offset_);
+    if (reader.Read<uint64_t>() != classes.size())
+    {
+        throw SnapshotError("Snapshot classes don't match the program"s);
+    }
+    for (const Class* cls : classes)
+    {
+        if (reader.ReadString() != cls->GetName())
+        {
+            throw SnapshotError("Snapshot classes don't match the program"s);
+        }
+    }
+
+    // Сначала создаются все экземпляры, чтобы поля могли ссылаться на любой из них
+    const auto instance_count = reader.Read<uint64_t>();
+    vector<ObjectHolder> instances;
+    for (uint64_t i = 0; i < instance_count; ++i)
+    {
+        const Class& cls = *classes[reader.ReadIndex(classes.size())];
+        instances.push_back(cls.CreateInstance(context));
+    }
+    for (const ObjectHolder& instance : instances)
+    {
+        Closure& fields = instance.TryAs<ClassInstance>()->Fields();
+        for (auto field_count = reader.Read<uint64_t>(); field_count > 0; --field_count)
+        {
+            const Symbol name = reader.ReadString();
+            fields[name] = reader.ReadValue(classes, instances, context);
+        }
+    }
+    for (auto global_count = reader.Read<uint64_t>(); global_count > 0; --global_count)
+    {
+        const Symbol name = reader.ReadString();
+        closure[name] = reader.ReadValue(classes, instances, context);
+    }
+}
+
+}  // namespace runtime
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace runtime
+{
+
+// Строка, которая отделяет пролог программы (объявления классов и подготовку данных)
+// от основной части. Состояние программы после пролога можно сохранить в снимок
+constexpr std::string_view SNAPSHOT_MARKER = "# @snapshot";
+
+// Делит текст программы source на пролог и основную часть по первой строке, совпадающей
+// с SNAPSHOT_MARKER. Основная часть начинается со строки маркера.
+// Возвращает std::nullopt, если маркера в программе нет
+std::optional<std::pair<std::string_view, std::string_view>> SplitAtSnapshotMarker(
+    std::string_view source);
+
+// Снимок нельзя загрузить: файл повреждён или создан другой версией интерпретатора
+struct SnapshotError : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// Сохраняет в файл path снимок состояния программы после выполнения пролога prologue:
+// переменные closure со всеми достижимыми из них объектами и вывод пролога output.
+// Классы сохраняются как номера в списке classes - классов пролога в порядке объявления.
+// Файл заменяется целиком, поэтому его могут одновременно читать другие процессы.
+// Выбрасывает std::runtime_error, если среди значений есть класс не из classes,
+// и std::system_error, если файл не удалось записать
+void SaveSnapshot(const std::filesystem::path& path, std::string_view prologue,
+                  std::string_view output, bool output_deterministic, const Closure& closure,
+                  const std::vector<const Class*>& classes);
+
+// Снимок, отображённый в память. Текст и вывод пролога читаются прямо из отображения,
+// а объекты создаются только при восстановлении переменных
+class Snapshot
+{
+public:
+    // Выбрасывает std::system_error, если файл не удалось открыть, и SnapshotError, если
+    // снимок создан другой версией интерпретатора или повреждён
+    explicit Snapshot(const std::filesystem::path& path);
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    ~Snapshot();
+
+    // Текст пролога, после которого сделан снимок
+    [[nodiscard]] std::string_view Prologue() const;
+    // Вывод, сделанный прологом
+    [[nodiscard]] std::string_view Output() const;
+    // Возвращает false, если пролог выводил адреса объектов
+    [[nodiscard]] bool IsOutputDeterministic() const;
+
+    // Восстанавливает переменные пролога в closure. classes - классы заново разобранного
+    // пролога в порядке объявления. Объекты создаются так же, как их создают инструкции
+    // контекста context, и их память учитывается в его счётчике памяти.
+    // Выбрасывает SnapshotError, если классы не совпадают с классами, которые были
+    // при создании снимка, и MemoryLimitExceeded, если объекты не помещаются в лимит
+    void Restore(Closure& closure, const std::vector<const Class*>& classes,
+                 Context& context) const;
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    std::string_view prologue_;
+    std::string_view output_;
+    bool output_deterministic_ = true;
+    // Смещение таблицы классов, с которой начинаются сохранённые объекты
+    size_t objects_offset_ = 0;
+};
+
+}  // namespace runtime
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace util
+{
+
+// Ограниченная очередь без блокировок для одного потока-писателя и одного потока-читателя.
+// TryPush вызывается только писателем, TryPop - только читателем
+template <typename T>
+class SpscQueue
+{
+public:
+    // Создаёт очередь, вмещающую не меньше capacity элементов
+    explicit SpscQueue(size_t capacity)
+        : slots_(RoundUpToPowerOfTwo(capacity)), mask_(slots_.size() - 1)
+    {
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Перемещает value в конец очереди. Если очередь заполнена, возвращает false,
+    // и value остаётся нетронутым
+    bool TryPush(T& value)
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cached_head_ == slots_.size())
+        {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail - cached_head_ == slots_.size())
+            {
+                return false;
+            }
+        }
+        slots_[tail & mask_] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Перемещает в value первый элемент очереди. Если очередь пуста, возвращает false
+    bool TryPop(T& value)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cached_tail_)
+        {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == cached_tail_)
+            {
+                return false;
+            }
+        }
+        value = std::move(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static size_t RoundUpToPowerOfTwo(size_t value)
+    {
+        size_t result = 1;
+        while (result < value)
+        {
+            result *= 2;
+        }
+        return result;
+    }
+
+    // Размер строки кэша. Данные читателя и писателя лежат в разных строках,
+    // чтобы потоки не мешали друг другу
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    std::vector<T> slots_;
+    const size_t mask_;
+
+    // Данные читателя
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head_ = 0;
+    size_t cached_tail_ = 0;
+
+    // Данные писателя
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail_ = 0;
+    size_t cached_head_ = 0;
+};
+
+}  // namespace util
@@ -1,7 +1,6 @@
 #include "statement.h"
 
 #include <iostream>
-#include <sstream>
 #include <algorithm>
 #include <iterator>
 
@@ -16,60 +15,191 @@ using runtime::ObjectHolder;
 
 namespace
 {
-const string ADD_METHOD = "__add__"s;
-const string INIT_METHOD = "__init__"s;
+
+// Дописывает к строке lhs строки pieces[0], ..., pieces[count - 1]. Если на lhs больше никто
+// не ссылается, строки дописываются к ней на месте, иначе создаётся новая строка
+ObjectHolder Concatenate(const ObjectHolder& lhs, const ObjectHolder* pieces, size_t count,
+                         Context& context)
+{
+    if (!lhs.IsUniquelyOwned() || lhs.TryAs<runtime::String>()->IsInterned())
+    {
+        const string& text = lhs.TryAs<runtime::String>()->GetValue();
+        size_t size = text.size();
+        for (size_t i = 0; i < count; ++i)
+        {
+            size += pieces[i].TryAs<runtime::String>()->GetValue().size();
+        }
+        string result;
+        result.reserve(size);
+        result += text;
+        for (size_t i = 0; i < count; ++i)
+        {
+            result += pieces[i].TryAs<runtime::String>()->GetValue();
+        }
+        return ObjectHolder::Own(runtime::String(move(result)), context);
+    }
+
+    string& value = lhs.TryAs<runtime::String>()->GetMutableValue();
+    const size_t size = value.size();
+    const size_t capacity = value.capacity();
+    try
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            value += pieces[i].TryAs<runtime::String>()->GetValue();
+        }
+    }
+    catch (...)
+    {
+        value.resize(size);
+        throw;
+    }
+    if (!context.GetMemoryAccount() || value.capacity() == capacity)
+    {
+        return lhs;
+    }
+    // Текст строки учитывается в счётчике памяти при создании объекта, поэтому
+    // строка, которой понадобилось больше памяти, переносится в новый объект
+    runtime::String joined(move(value));
+    try
+    {
+        return ObjectHolder::Own(move(joined), context);
+    }
+    catch (...)
+    {
+        value = move(joined.GetMutableValue());
+        value.resize(size);
+        throw;
+    }
+}
+
+// Присваивает target[name] значение lhs + e1 + ... + en, где lhs - строка, прочитанная
+// из target[name], а e1, ..., en - выражения pieces, вычисляемые в closure.
+// Пока строки дописываются, target не ссылается на lhs, поэтому накопление s = s + piece
+// дописывает piece к s на месте, а не копирует s каждый раз
+ObjectHolder AssignConcatenation(Closure& target, runtime::Symbol name, ObjectHolder lhs,
+                                 const vector<runtime::Executable*>& pieces, Closure& closure,
+                                 Context& context)
+{
+    vector<ObjectHolder> values;
+    values.reserve(pieces.size());
+    for (runtime::Executable* piece : pieces)
+    {
+        values.push_back(piece->Execute(closure, context));
+        if (!values.back().TryAs<runtime::String>())
+        {
+            throw runtime_error("Add error"s);
+        }
+    }
+
+    // Если при вычислении слагаемых target[name] присвоили другое значение, оно не нужно
+    auto it = target.find(name);
+    const bool detached = it != target.end() && it->second.Get() == lhs.Get();
+    if (detached)
+    {
+        it->second = ObjectHolder::None();
+    }
+    ObjectHolder result;
+    try
+    {
+        result = Concatenate(lhs, values.data(), values.size(), context);
+    }
+    catch (...)
+    {
+        if (detached)
+        {
+            target[name] = move(lhs);
+        }
+        throw;
+    }
+    return target[name] = move(result);
+}
 }  // namespace
 
+StringConst::StringConst(runtime::String value)
+    : value_(runtime::InternString(move(value.GetMutableValue())))
+{
+}
+
 ObjectHolder Assignment::Execute(Closure& closure, Context& context)
 {
+    if (!appended_.empty())
+    {
+        if (auto it = closure.find(var_);
+            it != closure.end() && it->second.TryAs<runtime::String>())
+        {
+            return AssignConcatenation(closure, var_, it->second, appended_, closure, context);
+        }
+    }
     closure[var_] = rv_->Execute(closure, context);
     return closure.at(var_);
 }
 
-Assignment::Assignment(string var, unique_ptr<Statement> rv)
-    : var_(move(var)), rv_(move(rv))
+Assignment::Assignment(runtime::Symbol var, unique_ptr<Statement> rv)
+    : var_(var), rv_(move(rv))
 {
+    if (const auto* add = dynamic_cast<const Add*>(rv_.get()))
+    {
+        const VariableValue* source = add->SplitConcatenation(appended_);
+        if (!source || !source->IsVariable(var_))
+        {
+            appended_.clear();
+        }
+    }
 }
 
-VariableValue::VariableValue(const string& var_name)
+VariableValue::VariableValue(runtime::Symbol var_name)
     : var_name_(var_name)
 {
 }
 
-VariableValue::VariableValue(vector<string> dotted_ids)
+VariableValue::VariableValue(const vector<string>& dotted_ids)
 {
     if (auto size = dotted_ids.size(); size > 0)
     {
-        var_name_ = move(dotted_ids.at(0));
-        dotted_ids_.resize(size - 1);
-        move(next(dotted_ids.begin()), dotted_ids.end(), dotted_ids_.begin());
+        var_name_ = dotted_ids.at(0);
+        dotted_ids_.assign(next(dotted_ids.begin()), dotted_ids.end());
     }
 }
 
-ObjectHolder VariableValue::Execute(Closure& closure, Context& context)
+ObjectHolder VariableValue::Execute(Closure& closure, [[maybe_unused]] Context& context)
 {
-    if (closure.count(var_name_))
+    // Каждое следующее имя ищется среди полей объекта, найденного по предыдущему
+    Closure* scope = &closure;
+    runtime::Symbol name = var_name_;
+    for (size_t i = 0;; ++i)
     {
-        auto result = closure.at(var_name_);
-        if (dotted_ids_.size() > 0)
+        auto it = scope->find(name);
+        if (it == scope->end())
         {
-            if (auto obj = result.TryAs<runtime::ClassInstance>())
-            {
-                return VariableValue(dotted_ids_).Execute(obj->Fields(), context);
-            }
-            else
-            {
-                throw runtime_error("Variable " + var_name_+ " is not a class"s);
-            }
+            throw runtime_error("Variable "s + string(name.GetName()) + " not found"s);
         }
-        return result;
-    }
-    else
-    {
-        throw runtime_error("Variable "s + var_name_ + " not found"s);
+        if (i == dotted_ids_.size())
+        {
+            return it->second;
+        }
+        auto* obj = it->second.TryAs<runtime::ClassInstance>();
+        if (!obj)
+        {
+            throw runtime_error("Variable "s + string(name.GetName()) + " is not a class"s);
+        }
+        scope = &obj->Fields();
+        name = dotted_ids_[i];
     }
 }
 
+bool VariableValue::IsVariable(runtime::Symbol name) const
+{
+    return dotted_ids_.empty() && var_name_ == name;
+}
+
+bool VariableValue::IsField(const VariableValue& object, runtime::Symbol field) const
+{
+    return var_name_ == object.var_name_ && dotted_ids_.size() == object.dotted_ids_.size() + 1
+        && equal(object.dotted_ids_.begin(), object.dotted_ids_.end(), dotted_ids_.begin())
+        && dotted_ids_.back() == field;
+}
+
 unique_ptr<Print> Print::Variable(const string& name)
 {
     return make_unique<Print>(make_unique<VariableValue>(name));
@@ -87,33 +217,45 @@ Print::Print(vector<unique_ptr<Statement>> args)
 
 ObjectHolder Print::Execute(Closure& closure, Context& context)
 {
-    bool first = true;
     auto &os = context.GetOutputStream();
-    for (auto &arg : args_) {
-        if (!first) {
-            os << " "s;
+    if (args_.empty()) {
+        os.put('\n');
+        return {};
+    }
+
+    // Каждое значение выводится сразу, как только отформатировано: аргументы и метод __str__
+    // могут сами выполнять print, и их вывод должен оказаться между значениями
+    runtime::FormatScope scope(context);
+    for (size_t i = 0; i < args_.size(); ++i) {
+        if (i > 0) {
+            os.put(' ');
         }
-        auto obj = arg->Execute(closure, context);
+        auto obj = args_[i]->Execute(closure, context);
         if (obj) {
-            obj->Print(os, context);
+            obj->Format(scope.Buffer(), context);
         } else {
-            os << "None"s;
+            scope.Buffer() += "None"sv;
         }
-        first = false;
+        if (i + 1 == args_.size()) {
+            scope.Buffer() += '\n';
+        }
+        scope.WriteTo(os);
     }
-    os << "\n"s;
     return {};
 }
 
-MethodCall::MethodCall(unique_ptr<Statement> object, string method,
+MethodCall::MethodCall(unique_ptr<Statement> object, runtime::Symbol method,
                        vector<unique_ptr<Statement>> args)
-    : object_(move(object)), method_(move(method)), args_(move(args))
+    : object_(move(object)), method_(method), args_(move(args))
 {
 }
 
 ObjectHolder MethodCall::Execute(Closure& closure, Context& context)
 {
-    runtime::ClassInstance* class_instance = object_->Execute(closure, context).TryAs<runtime::ClassInstance>();
+    // Экземпляр удерживается до конца вызова: вычисление аргументов может удалить
+    // последнюю ссылку на него
+    ObjectHolder object = object_->Execute(closure, context);
+    runtime::ClassInstance* class_instance = object.TryAs<runtime::ClassInstance>();
     if (class_instance)
     {
         vector<runtime::ObjectHolder> actual_args;
@@ -134,13 +276,13 @@ ObjectHolder Stringify::Execute(Closure& closure, Context& context)
     ObjectHolder object_holder = argument_->Execute(closure, context);
     if (object_holder)
     {
-        ostringstream os;
-        object_holder->Print(os, context);
-        return ObjectHolder::Own(runtime::String(os.str()));
+        runtime::FormatScope scope(context);
+        object_holder->Format(scope.Buffer(), context);
+        return ObjectHolder::Own(runtime::String(scope.Take()), context);
     }
     else
     {
-        return ObjectHolder::Own(runtime::String("None"s));
+        return ObjectHolder::Own(runtime::String("None"s), context);
     }
 }
 
@@ -154,23 +296,39 @@ ObjectHolder Add::Execute(Closure& closure, Context& context)
     if (lhs_number && rhs_number)
     {
         return ObjectHolder::Own(runtime::Number(lhs_number->GetValue() +
-                                                 rhs_number->GetValue()));
+                                                 rhs_number->GetValue()), context);
     }
     runtime::String* lhs_string = lhs_holder.TryAs<runtime::String>();
     runtime::String* rhs_string = rhs_holder.TryAs<runtime::String>();
     if (lhs_string && rhs_string)
     {
-        return ObjectHolder::Own(runtime::String(lhs_string->GetValue() +
-                                                 rhs_string->GetValue()));
+        return Concatenate(lhs_holder, &rhs_holder, 1, context);
     }
     runtime::ClassInstance* class_instance = lhs_holder.TryAs<runtime::ClassInstance>();
     if (class_instance)
     {
-        return class_instance->Call(ADD_METHOD, {rhs_holder}, context);
+        return class_instance->Call(runtime::SpecialMethod::ADD, {rhs_holder}, context);
     }
     throw runtime_error("Add error"s);
 }
 
+const VariableValue* Add::SplitConcatenation(vector<Statement*>& pieces) const
+{
+    const auto* source = dynamic_cast<const VariableValue*>(lhs_.get());
+    if (!source)
+    {
+        if (const auto* add = dynamic_cast<const Add*>(lhs_.get()))
+        {
+            source = add->SplitConcatenation(pieces);
+        }
+    }
+    if (source)
+    {
+        pieces.push_back(rhs_.get());
+    }
+    return source;
+}
+
 ObjectHolder Sub::Execute(Closure& closure, Context& context)
 {
     ObjectHolder lhs_holder = lhs_->Execute(closure, context);
@@ -181,7 +339,7 @@ ObjectHolder Sub::Execute(Closure& closure, Context& context)
     if (lhs_number && rhs_number)
     {
         return ObjectHolder::Own(runtime::Number(lhs_number->GetValue() -
-                                                 rhs_number->GetValue()));
+                                                 rhs_number->GetValue()), context);
     }
     throw runtime_error("Subtract error"s);
 }
@@ -196,7 +354,7 @@ ObjectHolder Mult::Execute(Closure& closure, Context& context)
     if (lhs_number && rhs_number)
     {
         return ObjectHolder::Own(runtime::Number(lhs_number->GetValue() *
-                                                 rhs_number->GetValue()));
+                                                 rhs_number->GetValue()), context);
     }
     throw runtime_error("Multiply error"s);
 }
@@ -215,7 +373,7 @@ ObjectHolder Div::Execute(Closure& closure, Context& context)
     else if (lhs_number && rhs_number)
     {
         return ObjectHolder::Own(runtime::Number(lhs_number->GetValue() /
-                                                 rhs_number->GetValue()));
+                                                 rhs_number->GetValue()), context);
     }
     throw runtime_error("Divison error"s);
 }
@@ -224,6 +382,7 @@ ObjectHolder Compound::Execute(Closure& closure, Context& context)
 {
     for (auto &arg : args_)
     {
+        context.Step();
         arg->Execute(closure, context);
     }
     return ObjectHolder::None();
@@ -235,28 +394,49 @@ ObjectHolder Return::Execute(Closure& closure, Context& context)
 }
 
 ClassDefinition::ClassDefinition(ObjectHolder cls)
-    : cls_(move(cls))
+    : cls_(move(cls)), name_(cls_.TryAs<runtime::Class>()->GetName())
 {
 }
 
 ObjectHolder ClassDefinition::Execute(Closure& closure, [[maybe_unused]] Context& context)
 {
-    closure[cls_.TryAs<runtime::Class>()->GetName()] = cls_;
+    closure[name_] = cls_;
     return ObjectHolder::None();
 }
 
-FieldAssignment::FieldAssignment(VariableValue object, string field_name,
+FieldAssignment::FieldAssignment(VariableValue object, runtime::Symbol field_name,
                                  unique_ptr<Statement> rv)
-    : object_(move(object)), field_name_(move(field_name)), rv_(move(rv))
+    : object_(move(object)), field_name_(field_name), rv_(move(rv))
 {
+    if (const auto* add = dynamic_cast<const Add*>(rv_.get()))
+    {
+        const VariableValue* source = add->SplitConcatenation(appended_);
+        if (!source || !source->IsField(object_, field_name_))
+        {
+            appended_.clear();
+        }
+    }
 }
 
 ObjectHolder FieldAssignment::Execute(Closure& closure, Context& context)
 {
-    runtime::ClassInstance* class_instance = object_.Execute(closure, context).TryAs<runtime::ClassInstance>();
+    // Экземпляр удерживается, пока вычисляется значение, даже если переменная object
+    // перестанет на него ссылаться
+    ObjectHolder object = object_.Execute(closure, context);
+    runtime::ClassInstance* class_instance = object.TryAs<runtime::ClassInstance>();
     if (class_instance)
     {
-        return class_instance->Fields()[field_name_] = rv_->Execute(closure, context);
+        Closure& fields = class_instance->Fields();
+        if (!appended_.empty())
+        {
+            if (auto it = fields.find(field_name_);
+                it != fields.end() && it->second.TryAs<runtime::String>())
+            {
+                return AssignConcatenation(fields, field_name_, it->second, appended_, closure,
+                                           context);
+            }
+        }
+        return fields[field_name_] = rv_->Execute(closure, context);
     }
     else
     {
@@ -287,24 +467,26 @@ ObjectHolder Or::Execute(Closure& closure, Context& context)
 {
     if (runtime::IsTrue(lhs_->Execute(closure, context)))
     {
-        return ObjectHolder::Own(runtime::Bool(true));
+        return ObjectHolder::Own(runtime::Bool(true), context);
     }
-    return ObjectHolder::Own(runtime::Bool(runtime::IsTrue(rhs_->Execute(closure, context))));
+    return ObjectHolder::Own(runtime::Bool(runtime::IsTrue(rhs_->Execute(closure, context))),
+                             context);
 }
 
 ObjectHolder And::Execute(Closure& closure, Context& context)
 {
     if (runtime::IsTrue(lhs_->Execute(closure, context)))
     {
-        return ObjectHolder::Own(runtime::Bool(runtime::IsTrue(rhs_->Execute(closure, context))));
+        return ObjectHolder::Own(runtime::Bool(runtime::IsTrue(rhs_->Execute(closure, context))),
+                                 context);
     }
-    return ObjectHolder::Own(runtime::Bool(false));
+    return ObjectHolder::Own(runtime::Bool(false), context);
 }
 
 ObjectHolder Not::Execute(Closure& closure, Context& context)
 {
     bool result = !runtime::IsTrue(argument_->Execute(closure, context));
-    return ObjectHolder::Own(runtime::Bool(result));
+    return ObjectHolder::Own(runtime::Bool(result), context);
 }
 
 Comparison::Comparison(Comparator cmp, unique_ptr<Statement> lhs, unique_ptr<Statement> rhs)
@@ -316,11 +498,11 @@ Comparison::Comparison(Comparator cmp, unique_ptr<Statement> lhs, unique_ptr<Sta
 ObjectHolder Comparison::Execute(Closure& closure, Context& context)
 {
     bool result = cmp_(lhs_->Execute(closure, context), rhs_->Execute(closure, context), context);
-    return runtime::ObjectHolder::Own(runtime::Bool(result));
+    return runtime::ObjectHolder::Own(runtime::Bool(result), context);
 }
 
 NewInstance::NewInstance(const runtime::Class& class_, vector<unique_ptr<Statement>> args)
-    : class_instance_(class_), args_(std::move(args))
+    : cls_(class_), args_(std::move(args))
 {
 }
 
@@ -331,16 +513,25 @@ NewInstance::NewInstance(const runtime::Class& class_)
 
 ObjectHolder NewInstance::Execute(Closure& closure, Context& context)
 {
-    if (class_instance_.HasMethod(INIT_METHOD, args_.size()))
+    // Каждое выполнение создаёт новый экземпляр, поэтому дерево программы не хранит
+    // состояния выполнения и может выполняться повторно и в нескольких потоках
+    auto instance = cls_.CreateInstance(context);
+    auto& class_instance = static_cast<runtime::ClassInstance&>(*instance);
+    if (runtime::CycleCollector* collector = context.GetCollector())
+    {
+        collector->Track(class_instance);
+    }
+    if (const runtime::Method* init = cls_.GetSpecialMethod(runtime::SpecialMethod::INIT);
+        init && init->formal_params.size() == args_.size())
     {
         std::vector<runtime::ObjectHolder> actual_args;
         for (auto &arg : args_)
         {
             actual_args.push_back(arg->Execute(closure, context));
         }
-        class_instance_.Call(INIT_METHOD, actual_args, context);
+        class_instance.Call(*init, actual_args, context);
     }
-    return runtime::ObjectHolder::Share(class_instance_);
+    return instance;
 }
 
 MethodBody::MethodBody(unique_ptr<Statement>&& body)
@@ -31,9 +31,25 @@ private:
 };
 
 using NumericConst = ValueStatement<runtime::Number>;
-using StringConst = ValueStatement<runtime::String>;
 using BoolConst = ValueStatement<runtime::Bool>;
 
+// Строковая константа. Константы с одинаковым текстом, в том числе из разных программ,
+// разделяют одну интернированную строку
+class StringConst : public Statement
+{
+public:
+    explicit StringConst(runtime::String value);
+
+    runtime::ObjectHolder Execute([[maybe_unused]] runtime::Closure& closure,
+                                  [[maybe_unused]] runtime::Context& context) override
+    {
+        return runtime::ObjectHolder::Share(*value_);
+    }
+
+private:
+    std::shared_ptr<runtime::String> value_;
+};
+
 /*
 Вычисляет значение переменной либо цепочки вызовов полей объектов id1.id2.id3.
 Например, выражение circle.center.x - цепочка вызовов полей объектов в инструкции:
@@ -42,14 +58,19 @@ x = circle.center.x
 class VariableValue : public Statement
 {
 public:
-    explicit VariableValue(const std::string& var_name);
-    explicit VariableValue(std::vector<std::string> dotted_ids);
+    explicit VariableValue(runtime::Symbol var_name);
+    explicit VariableValue(const std::vector<std::string>& dotted_ids);
 
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
 
+    // Возвращает true, если выражение - переменная name
+    [[nodiscard]] bool IsVariable(runtime::Symbol name) const;
+    // Возвращает true, если выражение - поле field объекта object
+    [[nodiscard]] bool IsField(const VariableValue& object, runtime::Symbol field) const;
+
 private:
-    std::string var_name_;
-    std::vector<std::string> dotted_ids_;
+    runtime::Symbol var_name_;
+    std::vector<runtime::Symbol> dotted_ids_;
 
 };
 
@@ -57,28 +78,34 @@ private:
 class Assignment : public Statement
 {
 public:
-    Assignment(std::string var, std::unique_ptr<Statement> rv);
+    Assignment(runtime::Symbol var, std::unique_ptr<Statement> rv);
 
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
 
 public:
-    std::string var_;
+    runtime::Symbol var_;
     std::unique_ptr<Statement> rv_;
 
+private:
+    // Слагаемые e1, ..., en, если rv имеет вид var + e1 + ... + en
+    std::vector<Statement*> appended_;
 };
 
 // Присваивает полю object.field_name значение выражения rv
 class FieldAssignment : public Statement
 {
 public:
-    FieldAssignment(VariableValue object, std::string field_name, std::unique_ptr<Statement> rv);
+    FieldAssignment(VariableValue object, runtime::Symbol field_name,
+                    std::unique_ptr<Statement> rv);
 
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
 
 private:
     VariableValue object_;
-    std::string field_name_;
+    runtime::Symbol field_name_;
     std::unique_ptr<Statement> rv_;
+    // Слагаемые e1, ..., en, если rv имеет вид object.field_name + e1 + ... + en
+    std::vector<Statement*> appended_;
 
 };
 
@@ -118,14 +145,14 @@ private:
 class MethodCall : public Statement
 {
 public:
-    MethodCall(std::unique_ptr<Statement> object, std::string method,
+    MethodCall(std::unique_ptr<Statement> object, runtime::Symbol method,
                std::vector<std::unique_ptr<Statement>> args);
 
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
 
 private:
     std::unique_ptr<Statement> object_;
-    std::string method_;
+    runtime::Symbol method_;
     std::vector<std::unique_ptr<Statement>> args_;
 
 };
@@ -152,7 +179,7 @@ public:
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
 
 private:
-    runtime::ClassInstance class_instance_;
+    const runtime::Class& cls_;
     std::vector<std::unique_ptr<Statement>> args_;
 
 };
@@ -202,8 +229,13 @@ public:
     //  число + число
     //  строка + строка
     //  объект1 + объект2, если у объект1 - пользовательский класс с методом _add__(rhs)
-    // В противном случае при вычислении выбрасывается runtime_error
+    // В противном случае при вычислении выбрасывается runtime_error.
+    // Если на левую строку больше никто не ссылается, правая дописывается к ней на месте
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+    // Если выражение имеет вид x + e1 + ... + en, где x - переменная или поле, возвращает x
+    // и дописывает e1, ..., en в pieces. Иначе возвращает nullptr
+    const VariableValue* SplitConcatenation(std::vector<Statement*>& pieces) const;
 };
 
 // Возвращает результат вычитания аргументов lhs и rhs
@@ -352,6 +384,7 @@ public:
 
 private:
     runtime::ObjectHolder cls_;
+    runtime::Symbol name_;
 
 };
 
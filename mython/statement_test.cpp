@@ -63,6 +63,10 @@ void TestStringConst() {
     o->Print(os, context);
     ASSERT_EQUAL(os.str(), "Hello!"s);
 
+    // Одинаковые константы разделяют одну строку
+    StringConst same(runtime::String("Hello!"s));
+    ASSERT_EQUAL(same.Execute(empty, context).Get(), o.Get());
+
     ASSERT(context.output.str().empty());
 }
 
@@ -238,6 +242,94 @@ void TestStringsAddition() {
     ASSERT(context.output.str().empty());
 }
 
+void TestStringAppend() {
+    runtime::DummyContext context;
+    Closure closure;
+
+    // s = s + 'ab' + t
+    Assignment init("s"s, make_unique<StringConst>("x"s));
+    Assignment append("s"s,
+                      make_unique<Add>(make_unique<Add>(make_unique<VariableValue>("s"s),
+                                                        make_unique<StringConst>("ab"s)),
+                                       make_unique<VariableValue>("t"s)));
+    Assignment alias("u"s, make_unique<VariableValue>("s"s));
+    closure["t"s] = ObjectHolder::Own(runtime::String("!"s));
+
+    init.Execute(closure, context);
+    // Константа программы не изменяется
+    append.Execute(closure, context);
+    ASSERT_OBJECT_VALUE_EQUAL(closure.at("s"s), "xab!"s);
+    init.Execute(closure, context);
+    ASSERT_OBJECT_VALUE_EQUAL(closure.at("s"s), "x"s);
+
+    // Строка, на которую ссылается только переменная, дописывается на месте
+    append.Execute(closure, context);
+    const runtime::Object* accumulated = closure.at("s"s).Get();
+    append.Execute(closure, context);
+    append.Execute(closure, context);
+    ASSERT_EQUAL(closure.at("s"s).Get(), accumulated);
+    ASSERT_OBJECT_VALUE_EQUAL(closure.at("s"s), "xab!ab!ab!"s);
+
+    // Строка, на которую есть другие ссылки, копируется
+    alias.Execute(closure, context);
+    append.Execute(closure, context);
+    ASSERT(closure.at("s"s).Get() != accumulated);
+    ASSERT_OBJECT_VALUE_EQUAL(closure.at("u"s), "xab!ab!ab!"s);
+    ASSERT_OBJECT_VALUE_EQUAL(closure.at("s"s), "xab!ab!ab!ab!"s);
+
+    // s = s + s
+    Assignment twice("s"s, make_unique<Add>(make_unique<VariableValue>("s"s),
+                                            make_unique<VariableValue>("s"s)));
+    init.Execute(closure, context);
+    append.Execute(closure, context);
+    twice.Execute(closure, context);
+    ASSERT_OBJECT_VALUE_EQUAL(closure.at("s"s), "xab!xab!"s);
+
+    // При ошибке переменная сохраняет прежнее значение
+    closure["t"s] = ObjectHolder::Own(runtime::Number(1));
+    ASSERT_THROWS(append.Execute(closure, context), std::runtime_error);
+    ASSERT_OBJECT_VALUE_EQUAL(closure.at("s"s), "xab!xab!"s);
+
+    // self.text = self.text + 'ab' дописывает поле на месте
+    runtime::Class text_class("Text"s, {}, nullptr);
+    ObjectHolder object = ObjectHolder::Own(runtime::ClassInstance(text_class));
+    closure["self"s] = object;
+    FieldAssignment field_init(VariableValue{"self"s}, "text"s, make_unique<StringConst>(""s));
+    FieldAssignment field_append(
+        VariableValue{"self"s}, "text"s,
+        make_unique<Add>(make_unique<VariableValue>(vector<string>{"self"s, "text"s}),
+                         make_unique<StringConst>("ab"s)));
+    field_init.Execute(closure, context);
+    field_append.Execute(closure, context);
+    const Closure& fields = object.TryAs<runtime::ClassInstance>()->Fields();
+    const runtime::Object* field = fields.at("text"s).Get();
+    for (int i = 0; i < 100; ++i) {
+        field_append.Execute(closure, context);
+    }
+    ASSERT_EQUAL(fields.at("text"s).Get(), field);
+    ASSERT_EQUAL(fields.at("text"s).TryAs<runtime::String>()->GetValue().size(), 202U);
+
+    // Промежуточная сумма в выражении тоже дописывается на месте
+    Add chain(make_unique<Add>(make_unique<StringConst>("a"s), make_unique<StringConst>("b"s)),
+              make_unique<StringConst>("c"s));
+    ASSERT_OBJECT_VALUE_EQUAL(chain.Execute(closure, context), "abc"s);
+    ASSERT_OBJECT_VALUE_EQUAL(chain.Execute(closure, context), "abc"s);
+
+    // Строка, выросшая на месте, учитывается в счётчике памяти
+    context.SetLimits(runtime::ExecutionLimits{0, 1 << 20});
+    const auto account = context.GetMemoryAccount();
+    closure["t"s] = ObjectHolder::Own(runtime::String(string(1000, 't')));
+    init.Execute(closure, context);
+    for (int i = 0; i < 100; ++i) {
+        append.Execute(closure, context);
+    }
+    ASSERT(account->GetUsed() >= 100U * 1000U);
+    closure.clear();
+    ASSERT_EQUAL(account->GetUsed(), 0U);
+
+    ASSERT(context.output.str().empty());
+}
+
 void TestBadAddition() {
     runtime::DummyContext context;
 
@@ -467,6 +559,7 @@ void RunUnitTests(TestRunner& tr) {
     RUN_TEST(tr, ast::TestStringify);
     RUN_TEST(tr, ast::TestNumbersAddition);
     RUN_TEST(tr, ast::TestStringsAddition);
+    RUN_TEST(tr, ast::TestStringAppend);
     RUN_TEST(tr, ast::TestBadAddition);
     RUN_TEST(tr, ast::TestSuccessfulClassInstanceAdd);
     RUN_TEST(tr, ast::TestClassInstanceAddWithoutMethod);
@@ -0,0 +1,89 @@
+#include "symbol.h"
+
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace std;
+
+namespace runtime
+{
+
+namespace
+{
+
+// Таблица имён. Имена хранятся в deque, поэтому ссылки на них не меняются при добавлении
+class SymbolTable
+{
+public:
+    SymbolTable()
+    {
+        Register({});
+    }
+
+    uint32_t Register(string_view name)
+    {
+        lock_guard lock(mutex_);
+        if (auto it = ids_.find(name); it != ids_.end())
+        {
+            return it->second;
+        }
+        if (names_.size() >= numeric_limits<uint32_t>::max())
+        {
+            throw length_error("Too many symbols"s);
+        }
+        const auto id = static_cast<uint32_t>(names_.size());
+        ids_.emplace(names_.emplace_back(name), id);
+        return id;
+    }
+
+    string_view GetName(uint32_t id) const
+    {
+        lock_guard lock(mutex_);
+        return names_[id];
+    }
+
+private:
+    mutable mutex mutex_;
+    deque<string> names_;
+    // Ключи ссылаются на строки из names_
+    unordered_map<string_view, uint32_t> ids_;
+};
+
+SymbolTable& GetSymbolTable()
+{
+    // Таблица не разрушается, чтобы символами можно было пользоваться до конца работы процесса
+    static auto* table = new SymbolTable();
+    return *table;
+}
+
+}  // namespace
+
+Symbol::Symbol(string_view name)
+    : id_(GetSymbolTable().Register(name))
+{
+}
+
+Symbol::Symbol(const string& name)
+    : Symbol(string_view(name))
+{
+}
+
+Symbol::Symbol(const char* name)
+    : Symbol(string_view(name))
+{
+}
+
+string_view Symbol::GetName() const
+{
+    return GetSymbolTable().GetName(id_);
+}
+
+ostream& operator<<(ostream& os, Symbol symbol)
+{
+    return os << symbol.GetName();
+}
+
+}  // namespace runtime
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace runtime
+{
+
+// Имя переменной, поля или метода. Имена регистрируются в общей для процесса таблице символов,
+// а символ хранит только номер имени, поэтому символы сравниваются и хэшируются как числа.
+// Зарегистрированное имя остаётся в таблице до завершения процесса
+class Symbol
+{
+public:
+    // Пустое имя
+    Symbol() noexcept = default;
+
+    // Возвращает символ имени name, регистрируя имя, если его ещё нет в таблице.
+    // Можно вызывать из нескольких потоков
+    Symbol(std::string_view name);  // NOLINT(google-explicit-constructor)
+    Symbol(const std::string& name);  // NOLINT(google-explicit-constructor)
+    Symbol(const char* name);  // NOLINT(google-explicit-constructor)
+
+    [[nodiscard]] uint32_t GetId() const noexcept
+    {
+        return id_;
+    }
+
+    [[nodiscard]] std::string_view GetName() const;
+
+    friend bool operator==(Symbol lhs, Symbol rhs) noexcept
+    {
+        return lhs.id_ == rhs.id_;
+    }
+
+    friend bool operator!=(Symbol lhs, Symbol rhs) noexcept
+    {
+        return lhs.id_ != rhs.id_;
+    }
+
+private:
+    uint32_t id_ = 0;
+};
+
+std::ostream& operator<<(std::ostream& os, Symbol symbol);
+
+}  // namespace runtime
+
+namespace std
+{
+
+// Номер символа служит его хэшем
+template <>
+struct hash<runtime::Symbol>
+{
+    size_t operator()(runtime::Symbol symbol) const noexcept
+    {
+        return symbol.GetId();
+    }
+};
+
+}  // namespace std
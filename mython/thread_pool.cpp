@@ -0,0 +1,169 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace util
+{
+
+namespace
+{
+
+// Пул и номер потока, в котором выполняется текущая задача
+struct CurrentWorker
+{
+    const ThreadPool* pool = nullptr;
+    size_t index = 0;
+};
+
+thread_local CurrentWorker current_worker;
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t thread_count)
+{
+    if (thread_count == 0)
+    {
+        thread_count = max(thread::hardware_concurrency(), 1U);
+    }
+    queues_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        queues_.push_back(make_unique<WorkerQueue>());
+    }
+    threads_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        threads_.emplace_back([this, i] { Work(i); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    has_tasks_.notify_all();
+    for (thread& worker : threads_)
+    {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::Size() const
+{
+    return threads_.size();
+}
+
+size_t ThreadPool::StolenTasks() const
+{
+    return stolen_.load(memory_order_relaxed);
+}
+
+void ThreadPool::Push(function<void()> task)
+{
+    WorkerQueue& queue = current_worker.pool == this ? *queues_[current_worker.index] : injected_;
+    {
+        lock_guard lock(queue.mutex);
+        queue.tasks.push_back(move(task));
+    }
+    // Пара с WaitForTasks: либо спящий поток увидит новую задачу, проверяя pending_,
+    // либо здесь будет видно, что он спит, и его нужно разбудить
+    pending_.fetch_add(1);
+    if (sleeping_.load() > 0)
+    {
+        lock_guard lock(mutex_);
+        has_tasks_.notify_one();
+    }
+}
+
+bool ThreadPool::TryClaim()
+{
+    size_t pending = pending_.load(memory_order_relaxed);
+    while (pending > 0)
+    {
+        if (pending_.compare_exchange_weak(pending, pending - 1))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace
+{
+
+function<void()> PopFront(deque<function<void()>>& tasks)
+{
+    function<void()> task = move(tasks.front());
+    tasks.pop_front();
+    return task;
+}
+
+}  // namespace
+
+function<void()> ThreadPool::Take(size_t index)
+{
+    // Задача обязательно найдётся: поток берётся за задачу, только уменьшив pending_,
+    // а pending_ увеличивается уже после того, как задача попала в очередь
+    while (true)
+    {
+        {
+            WorkerQueue& own = *queues_[index];
+            lock_guard lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                function<void()> task = move(own.tasks.back());
+                own.tasks.pop_back();
+                return task;
+            }
+        }
+        {
+            lock_guard lock(injected_.mutex);
+            if (!injected_.tasks.empty())
+            {
+                return PopFront(injected_.tasks);
+            }
+        }
+        for (size_t i = 1; i < queues_.size(); ++i)
+        {
+            WorkerQueue& victim = *queues_[(index + i) % queues_.size()];
+            lock_guard lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                stolen_.fetch_add(1, memory_order_relaxed);
+                return PopFront(victim.tasks);
+            }
+        }
+        this_thread::yield();
+    }
+}
+
+bool ThreadPool::WaitForTasks()
+{
+    unique_lock lock(mutex_);
+    sleeping_.fetch_add(1);
+    has_tasks_.wait(lock, [this] { return stopping_ || pending_.load() > 0; });
+    sleeping_.fetch_sub(1);
+    return pending_.load() > 0;
+}
+
+void ThreadPool::Work(size_t index)
+{
+    current_worker = {this, index};
+    while (true)
+    {
+        if (TryClaim())
+        {
+            Take(index)();
+        }
+        else if (!WaitForTasks())
+        {
+            return;
+        }
+    }
+}
+
+}  // namespace util
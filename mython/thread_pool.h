@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace util
+{
+
+// Пул потоков фиксированного размера с перехватом задач. У каждого потока своя очередь:
+// задачи, поставленные из потока пула, попадают в его очередь и выполняются им же
+// в обратном порядке. Задачи извне попадают в общую очередь, из которой их в порядке
+// постановки берёт первый освободившийся поток. Поток, у которого закончились задачи,
+// забирает самые старые задачи из чужих очередей.
+// Число невзятых задач учитывается атомарным счётчиком; общий мьютекс нужен только потокам,
+// которым нечего делать, и тому, кто ставит задачу, пока такие потоки спят
+class ThreadPool
+{
+public:
+    // Создаёт пул из thread_count потоков. Если thread_count равен 0,
+    // количество потоков выбирается по числу ядер процессора
+    explicit ThreadPool(size_t thread_count = 0);
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Дожидается выполнения всех поставленных задач и останавливает потоки
+    ~ThreadPool();
+
+    // Ставит в очередь задачу task. Результат задачи (или выброшенное ею исключение)
+    // можно получить через возвращённый future
+    template <typename Task>
+    [[nodiscard]] std::future<std::invoke_result_t<Task>> Submit(Task task)
+    {
+        auto packaged = std::make_shared<std::packaged_task<std::invoke_result_t<Task>()>>(
+            std::move(task));
+        auto result = packaged->get_future();
+        Push([packaged] { (*packaged)(); });
+        return result;
+    }
+
+    [[nodiscard]] size_t Size() const;
+
+    // Возвращает, сколько задач потоки забрали из чужих очередей
+    [[nodiscard]] size_t StolenTasks() const;
+
+private:
+    // Очередь задач одного потока
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void Push(std::function<void()> task);
+    // Уменьшает pending_, если он больше нуля. После этого задача гарантированно лежит в очередях
+    bool TryClaim();
+    // Берёт задачу из своей очереди с конца, а если она пуста - из общей очереди
+    // и из чужих очередей с начала
+    std::function<void()> Take(size_t index);
+    // Ждёт появления задач. Возвращает false, если пул останавливается и задач не осталось
+    bool WaitForTasks();
+    void Work(size_t index);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+    // Задачи, поставленные не из потоков пула
+    WorkerQueue injected_;
+    std::vector<std::thread> threads_;
+
+    // Количество задач, за которые ещё не взялся ни один поток
+    std::atomic<size_t> pending_ = 0;
+    // Количество потоков, которые ждут задач или собираются заснуть
+    std::atomic<size_t> sleeping_ = 0;
+    std::atomic<size_t> stolen_ = 0;
+    std::mutex mutex_;
+    std::condition_variable has_tasks_;
+    bool stopping_ = false;
+};
+
+}  // namespace util
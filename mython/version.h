@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string_view>
+
+// Версия интерпретатора. Кэш вывода и снимки, созданные другой версией, не используются,
+// поэтому версию нужно увеличивать при изменениях, которые меняют вывод программ
+inline constexpr std::string_view MYTHON_VERSION = "1.1.0";
@@ -0,0 +1,87 @@
+#include "watchdog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace runtime
+{
+
+Watchdog::Watchdog(CancellationToken& token, chrono::milliseconds timeout, int fd)
+{
+    if (pipe2(stop_fds_, O_CLOEXEC) != 0)
+    {
+        throw system_error(errno, generic_category(), "Can't start watchdog"s);
+    }
+    const auto deadline = chrono::steady_clock::now() + timeout;
+    try
+    {
+        thread_ = thread([this, &token, deadline, has_deadline = timeout.count() > 0, fd] {
+            Watch(token, deadline, has_deadline, fd);
+        });
+    }
+    catch (...)
+    {
+        close(stop_fds_[0]);
+        close(stop_fds_[1]);
+        throw;
+    }
+}
+
+Watchdog::~Watchdog()
+{
+    [[maybe_unused]] ssize_t result = write(stop_fds_[1], "", 1);
+    thread_.join();
+    close(stop_fds_[0]);
+    close(stop_fds_[1]);
+}
+
+void Watchdog::Watch(CancellationToken& token, chrono::steady_clock::time_point deadline,
+                     bool has_deadline, int fd)
+{
+    // Для соединения не запрашиваются события: poll всё равно сообщает о его закрытии
+    // через POLLHUP и POLLERR, а данные следующего запроса не должны будить поток
+    pollfd watched[] = {{stop_fds_[0], POLLIN, 0}, {fd, 0, 0}};
+    const nfds_t count = fd >= 0 ? 2 : 1;
+    while (true)
+    {
+        int timeout_ms = -1;
+        if (has_deadline)
+        {
+            const auto left = deadline - chrono::steady_clock::now();
+            if (left <= chrono::steady_clock::duration::zero())
+            {
+                token.Cancel();
+                return;
+            }
+            // Округление вверх: поток не должен проснуться раньше срока и ждать заново
+            timeout_ms = static_cast<int>(
+                min<chrono::milliseconds::rep>(chrono::ceil<chrono::milliseconds>(left).count(),
+                                               INT_MAX));
+        }
+        const int ready = poll(watched, count, timeout_ms);
+        if (ready < 0 && errno != EINTR)
+        {
+            return;
+        }
+        if (ready > 0)
+        {
+            if (watched[0].revents != 0)
+            {
+                return;
+            }
+            token.Cancel();
+            return;
+        }
+    }
+}
+
+}  // namespace runtime
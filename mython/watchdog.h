@@ -0,0 +1,34 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <chrono>
+#include <thread>
+
+namespace runtime
+{
+
+// Поток, который отменяет выполнение программы через token, когда истекает время timeout
+// или когда клиент закрывает соединение fd. При разрушении поток останавливается
+class Watchdog
+{
+public:
+    // Нулевой timeout - без ограничения времени, отрицательный fd - без соединения.
+    // Выбрасывает std::system_error, если поток не удалось запустить
+    Watchdog(CancellationToken& token, std::chrono::milliseconds timeout, int fd = -1);
+
+    Watchdog(const Watchdog&) = delete;
+    Watchdog& operator=(const Watchdog&) = delete;
+
+    ~Watchdog();
+
+private:
+    void Watch(CancellationToken& token, std::chrono::steady_clock::time_point deadline,
+               bool has_deadline, int fd);
+
+    // Канал, через который деструктор будит поток
+    int stop_fds_[2] = {-1, -1};
+    std::thread thread_;
+};
+
+}  // namespace runtime